@@ -0,0 +1,131 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#ifndef MAIDSAFE_DRIVE_BUFFER_BUDGET_H_
+#define MAIDSAFE_DRIVE_BUFFER_BUDGET_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+
+#include "maidsafe/drive/config.h"
+
+namespace maidsafe {
+
+namespace drive {
+
+namespace detail {
+
+class SpillStore;
+
+// Bounds the memory and disk used by the buffers of all the files open on a drive.  Each buffer is
+// granted at most a per-buffer limit out of what remains of the drive-wide totals, so a buffer
+// created while the budget is low gets a smaller grant.  Memory and disk are granted separately.
+//
+// A buffer may outlive its file's last close in a KeepAliveCache.  When a grant falls short, the
+// least recently used of these idle buffers are asked to release theirs early, so that later
+// grants can be met in full.  A grant is never less than a minimum: if the budget can't cover that,
+// Acquire() waits for other grants to be returned, and once the wait is up, grants the minimum
+// beyond the budget.
+class BufferBudget : public std::enable_shared_from_this<BufferBudget> {
+ public:
+  // Asked of an idle buffer's owner when its grant is wanted back.  Must not block, nor call back
+  // into the budget.
+  typedef std::function<void()> ReleaseFunctor;
+
+  // Returned to the budget on destruction.
+  class Grant {
+   public:
+    ~Grant();
+    Grant(const Grant&) = delete;
+    Grant& operator=(const Grant&) = delete;
+
+    std::uint64_t memory() const { return memory_; }
+    std::uint64_t disk() const { return disk_; }
+    // An idle buffer's file isn't open.  Marking a buffer in use also makes it the most recently
+    // used.
+    void SetIdle(bool idle);
+
+   private:
+    friend class BufferBudget;
+    Grant(std::shared_ptr<BufferBudget> budget, std::uint64_t memory, std::uint64_t disk,
+          ReleaseFunctor release);
+
+    const std::shared_ptr<BufferBudget> budget_;
+    const std::uint64_t memory_, disk_;
+    const ReleaseFunctor release_;
+    bool idle_, release_requested_;
+    // Position in budget_->grants_
+    std::list<Grant*>::iterator position_;
+  };
+
+  // Must be created via std::make_shared.  Buffers overflow into 'spill_store' if given.
+  BufferBudget(std::uint64_t max_memory, std::uint64_t max_disk,
+               std::uint64_t max_memory_per_buffer, std::uint64_t max_disk_per_buffer,
+               std::shared_ptr<SpillStore> spill_store = nullptr,
+               std::uint64_t min_per_buffer = kMinBufferGrant,
+               std::chrono::steady_clock::duration release_wait = kBufferGrantWait);
+  BufferBudget(const BufferBudget&) = delete;
+  BufferBudget& operator=(const BufferBudget&) = delete;
+
+  //
+  // All public methods are thread-safe.
+  //
+
+  // May block for up to the release wait given on construction.
+  std::unique_ptr<Grant> Acquire(ReleaseFunctor release);
+
+  const std::shared_ptr<SpillStore>& spill_store() const { return spill_store_; }
+  std::uint64_t max_memory() const { return max_memory_; }
+  std::uint64_t max_disk() const { return max_disk_; }
+  std::uint64_t memory_granted() const;
+  std::uint64_t disk_granted() const;
+  std::size_t buffer_count() const;
+  // Number of grants which fell short of the per-buffer limits.
+  std::uint64_t shortfalls() const;
+  // Number of grants of the minimum made beyond the budget.
+  std::uint64_t overcommits() const;
+
+ private:
+  // Both capped at the per-buffer limits.  The caller must hold mutex_.
+  std::uint64_t MemoryLeft() const;
+  std::uint64_t DiskLeft() const;
+
+  const std::uint64_t max_memory_, max_disk_, max_memory_per_buffer_, max_disk_per_buffer_;
+  const std::shared_ptr<SpillStore> spill_store_;
+  const std::uint64_t min_memory_per_buffer_, min_disk_per_buffer_;
+  const std::chrono::steady_clock::duration release_wait_;
+  mutable std::mutex mutex_;
+  // Notified whenever a grant is returned.
+  std::condition_variable returned_;
+  std::uint64_t memory_granted_, disk_granted_, shortfalls_, overcommits_;
+  // Least recently used first
+  std::list<Grant*> grants_;
+};
+
+}  // namespace detail
+
+}  // namespace drive
+
+}  // namespace maidsafe
+
+#endif  // MAIDSAFE_DRIVE_BUFFER_BUDGET_H_
@@ -0,0 +1,96 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#ifndef MAIDSAFE_DRIVE_CHUNK_CACHE_H_
+#define MAIDSAFE_DRIVE_CHUNK_CACHE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "maidsafe/common/types.h"
+
+namespace maidsafe {
+
+namespace drive {
+
+namespace detail {
+
+// A bounded cache of chunk contents keyed by chunk name, shared by all files on a drive.  A file's
+// encryptor and buffer are destroyed shortly after its last close, so without this every reopen
+// would fetch its chunks from storage again.  Chunks are content-addressed, so cached entries
+// never need invalidating.
+//
+// Entries are spread over independently locked shards, each evicting its least recently used
+// entries to stay within its share of the total capacity.
+class ChunkCache {
+ public:
+  // A 'capacity' of 0 disables caching.
+  explicit ChunkCache(std::uint64_t capacity, std::size_t shard_count = 16);
+  ChunkCache(const ChunkCache&) = delete;
+  ChunkCache& operator=(const ChunkCache&) = delete;
+
+  //
+  // All public methods are thread-safe.
+  //
+
+  // Returns true and sets 'content' if the chunk is cached.
+  bool Get(const std::string& name, NonEmptyString& content);
+  // Unlike Get(), neither updates the counters nor the entry's recency.
+  bool Contains(const std::string& name) const;
+  void Put(const std::string& name, const NonEmptyString& content);
+
+  std::uint64_t capacity() const { return capacity_; }
+  // Total size of the cached chunks.
+  std::uint64_t size() const;
+  std::uint64_t hits() const { return hits_; }
+  std::uint64_t misses() const { return misses_; }
+  std::uint64_t evictions() const { return evictions_; }
+
+ private:
+  struct Shard {
+    typedef std::list<std::pair<std::string, NonEmptyString>> Entries;
+    Shard() : mutex(), entries(), index(), size(0) {}
+    mutable std::mutex mutex;
+    // Most recently used first
+    Entries entries;
+    std::unordered_map<std::string, Entries::iterator> index;
+    std::uint64_t size;
+  };
+
+  Shard& GetShard(const std::string& name) const;
+
+  const std::uint64_t capacity_, shard_capacity_;
+  const std::unique_ptr<Shard[]> shards_;
+  const std::size_t shard_count_;
+  std::atomic<std::uint64_t> hits_, misses_, evictions_;
+};
+
+}  // namespace detail
+
+}  // namespace drive
+
+}  // namespace maidsafe
+
+#endif  // MAIDSAFE_DRIVE_CHUNK_CACHE_H_
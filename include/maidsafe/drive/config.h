@@ -19,6 +19,7 @@
 #ifndef MAIDSAFE_DRIVE_CONFIG_H_
 #define MAIDSAFE_DRIVE_CONFIG_H_
 
+#include <cstddef>
 #include <cstdint>
 #include <chrono>
 
@@ -48,9 +49,46 @@ extern const boost::filesystem::path kRoot;
 extern const MaxVersions kMaxVersions;
 // The delay between the last update to a directory and the creation of the corresponding version.
 extern const std::chrono::steady_clock::duration kDirectoryInactivityDelay;
-// The delay between the last close on a file and the deletion of its buffer and encryptor.
+// The longest a file's buffer and encryptor are kept after its last close, in case it's reopened.
 extern const std::chrono::steady_clock::duration kFileInactivityDelay;
+// The interval between checks of cached directories' version tips for changes by other clients.
+extern const std::chrono::steady_clock::duration kRemoteChangePollInterval;
 const int kFileBlockSize = 512;
+// The preferred I/O size reported for files; matches self-encryption's maximum chunk size so that
+// well-behaved clients write whole chunks at a time.
+const int kOptimalIoSize = 1024 * 1024;
+// The largest file kept in its parent directory's listing rather than being self-encrypted.
+const std::uint32_t kMaxInlineFileSize = 4096;
+// The most bytes of small contiguous writes gathered by a file before they're passed to its
+// encryptor together.
+const std::uint32_t kWriteCoalescingSize = kOptimalIoSize;
+// In write-behind mode, the most bytes of writes a file accepts ahead of its encryptor.  Writers
+// wait for the queue to drain below this before their writes are accepted.
+const std::uint64_t kWriteBehindQueueSize = 16 * kOptimalIoSize;
+// The most chunks fetched ahead of a sequential reader of one file.
+const std::size_t kMaxReadaheadChunks = 16;
+// The most chunk fetches outstanding at once for the reads of one file.
+const std::size_t kMaxChunksInFlight = 16;
+// The most chunks of one file being stored at once while it's still written to, once its buffer
+// and the spill store are full.  Beyond this, writers wait before taking the file's lock.
+const std::size_t kMaxChunksStreaming = 8;
+// The most memory used by the buffers of all the files open on a drive at once.
+const std::uint64_t kBufferMemoryBudget = 256 * 1024 * 1024;
+// The least memory and disk granted to a file's buffer however short the budget is; room for one
+// chunk.
+const std::uint64_t kMinBufferGrant = kOptimalIoSize;
+// The longest the opening of a file waits for other buffers to be released when the budget is
+// short, before its buffer is granted kMinBufferGrant beyond the budget.
+extern const std::chrono::steady_clock::duration kBufferGrantWait;
+// The most closed files whose buffers are kept for a reopen at once; the least recently closed
+// beyond this are released before kFileInactivityDelay is up.
+const std::size_t kMaxIdleOpenFiles = 1024;
+// The number of threads storing the chunks written to files before their last close.
+const int kUploadThreadCount = 4;
+// The number of threads passing files' write-behind queues to their encryptors.
+const int kWriteBehindThreadCount = 2;
+// The default capacity in bytes of the drive-wide cache of chunk contents.
+const std::uint64_t kDefaultChunkCacheSize = 64 * 1024 * 1024;
 
 }  // namespace detail
 
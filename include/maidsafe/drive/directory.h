@@ -20,7 +20,10 @@
 #define MAIDSAFE_DRIVE_DIRECTORY_H_
 
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <deque>
+#include <exception>
 #include <memory>
 #include <atomic>
 #include <string>
@@ -65,6 +68,7 @@ class Directory : public Path {
     virtual void DirectoryPut(std::shared_ptr<Directory>) = 0;
     virtual boost::future<void> DirectoryPutChunk(const ImmutableData&) = 0;
     virtual void DirectoryIncrementChunks(const std::vector<ImmutableData::Name>&) = 0;
+    virtual void DirectoryDecrementChunks(const std::vector<ImmutableData::Name>&) = 0;
 
    public:
     virtual ~Listener() {}
@@ -76,6 +80,10 @@ class Directory : public Path {
     void IncrementChunks(const std::vector<ImmutableData::Name>& names) {
       DirectoryIncrementChunks(names);
     }
+
+    void DecrementChunks(const std::vector<ImmutableData::Name>& names) {
+      DirectoryDecrementChunks(names);
+    }
   };
 
   // This class must always be constructed using a Create() call to ensure that it will be
@@ -98,6 +106,8 @@ class Directory : public Path {
   void FlushChildAndDeleteEncryptor(File* child);
 
   size_t VersionsCount() const;
+  // The most recently stored version, or a default-constructed one if none has been stored yet.
+  StructuredDataVersions::VersionName CurrentVersion() const;
   std::tuple<DirectoryId, StructuredDataVersions::VersionName> InitialiseVersions(
       ImmutableData::Name version_id);
   // This marks the end of an attempt to store the directory.  It returns directory_id and most
@@ -115,6 +125,8 @@ class Directory : public Path {
   typename std::enable_if<std::is_base_of<detail::Path, T>::value, std::shared_ptr<T>>::type
       GetMutableChild(const boost::filesystem::path& name);
   std::shared_ptr<const Path> GetChildAndIncrementCounter();
+  // Returns all children in name order, taken under a single lock.
+  std::vector<std::shared_ptr<const Path>> GetChildren() const;
   void AddChild(std::shared_ptr<Path> child);
   std::shared_ptr<Path> RemoveChild(const boost::filesystem::path& name);
   void RenameChild(const boost::filesystem::path& old_name,
@@ -126,6 +138,14 @@ class Directory : public Path {
   DirectoryId directory_id() const;
   virtual void ScheduleForStoring();
   void StoreImmediatelyIfPending();
+  // True if any child file holds a buffer, i.e. is open or has a close still to be flushed.
+  bool HasBufferedFiles() const;
+  // Names of the children which are added, removed or modified in 'other' relative to this.
+  std::vector<boost::filesystem::path> ChangedChildren(const Directory& other) const;
+  // Blocks until every change made to this directory (and its files' contents) before the call
+  // has been stored.  Concurrent callers are group-committed: those arriving while a store is in
+  // flight wait for, and share, the single store which follows it.
+  void Sync();
   bool HasPending() const;
 
   friend void test::DirectoriesMatch(const Directory&, const Directory&);
@@ -160,7 +180,12 @@ class Directory : public Path {
   Children::const_iterator Find(const boost::filesystem::path& name) const;
   void SortAndResetChildrenCounter();
   void DoScheduleForStoring();
+  // Handles the store timer, logging rather than throwing if the store fails.
   void ProcessTimer(const boost::system::error_code&);
+  // Stores the directory unless 'ec' reports the timer's cancellation.  Requires pending_count_
+  // to have been incremented for the store, and decrements it even if the store throws.
+  void Store(const boost::system::error_code& ec);
+  void StoreNow();
 
   ParentId parent_id_;
   DirectoryId directory_id_;
@@ -180,8 +205,15 @@ class Directory : public Path {
   const std::weak_ptr<Listener> listener_;
   std::unique_ptr<NewParent> newParent_;  // Use std::unique_ptr<> to fake an optional<>
   int pending_count_;
+  // Group commit state for Sync(), guarded by mutex_.
+  std::uint64_t sync_started_, sync_completed_;
+  bool sync_in_progress_;
+  std::exception_ptr sync_error_;
+  std::condition_variable sync_condition_;
 
   mutable std::mutex mutex_;
+  // Serialises the stores themselves, so a timer-driven store and a Sync() never overlap.
+  std::mutex store_mutex_;
 };
 
 bool operator<(const Directory& lhs, const Directory& rhs);
@@ -65,6 +65,13 @@ namespace test {
 class DirectoryHandlerTest;
 }
 
+// A cached directory which was reloaded because another client stored a newer version of it.
+struct RemoteChange {
+  boost::filesystem::path relative_path;
+  // Names of the children which were added, removed or modified by the newer version.
+  std::vector<boost::filesystem::path> changed_children;
+};
+
 template <typename Storage>
 class DirectoryHandler : public std::enable_shared_from_this<DirectoryHandler<Storage>>,
                          public Directory::Listener {
@@ -84,6 +91,11 @@ class DirectoryHandler : public std::enable_shared_from_this<DirectoryHandler<St
   // Immediate stores directories (blocks and store happens on this thread)
   void StoreAll();
 
+  // Compares the version tip of each cached directory against storage and reloads those which
+  // another client has changed.  Directories with local changes still to be stored, or with
+  // buffered files, are left alone until a later call.  Blocks on storage.
+  std::vector<RemoteChange> RefreshFromStorage();
+
   void Delete(const boost::filesystem::path& relative_path);
   void Rename(const boost::filesystem::path& old_relative_path,
               const boost::filesystem::path& new_relative_path);
@@ -124,6 +136,11 @@ class DirectoryHandler : public std::enable_shared_from_this<DirectoryHandler<St
       const ParentId& parent_id, const DirectoryId& directory_id,
       std::vector<StructuredDataVersions::VersionName> versions);
   void DeleteOldestVersion(Path* path);
+  // Drops cached subdirectories of 'relative_path' whose entries are gone from, or point at a
+  // different directory in, 'reloaded'.  Requires cache_mutex_ to be held.
+  void EraseReplacedSubdirectories(const boost::filesystem::path& relative_path,
+                                   const Directory& reloaded,
+                                   const std::vector<boost::filesystem::path>& names);
   NonEmptyString GetChunkFromStore(const std::string& name) const;
 
 
@@ -133,6 +150,7 @@ class DirectoryHandler : public std::enable_shared_from_this<DirectoryHandler<St
   virtual void DirectoryPut(std::shared_ptr<Directory>) override;
   virtual boost::future<void> DirectoryPutChunk(const ImmutableData&) override;
   virtual void DirectoryIncrementChunks(const std::vector<ImmutableData::Name>&) override;
+  virtual void DirectoryDecrementChunks(const std::vector<ImmutableData::Name>&) override;
 
   std::shared_ptr<Storage> storage_;
   Identity unique_user_id_, root_parent_id_;
@@ -235,7 +253,10 @@ void DirectoryHandler<Storage>::Add(const boost::filesystem::path& relative_path
      metadata (timestamps, etc.). So second.ScheduleForStoring() and
      first.AddChild() must both be invoked for both the metadata and children to
      be updated in the parent directory. */
-  parent.second->meta_data.UpdateLastModifiedTime();
+  {
+    const std::lock_guard<std::mutex> lock(parent.second->meta_data_mutex);
+    parent.second->meta_data.UpdateLastModifiedTime();
+  }
   parent.second->ScheduleForStoring();
 
   // TODO(Fraser#5#): 2013-11-28 - Use on_scope_exit or similar to undo changes if AddChild throws.
@@ -285,10 +306,10 @@ typename std::enable_if<std::is_base_of<detail::Path, T>::value, std::shared_ptr
                                   *file->meta_data.directory_id()));
     {
       std::lock_guard<std::mutex> lock(cache_mutex_);
-      parent = directory;
+      // Another thread may have fetched and cached the same directory while this one was doing
+      // so; the cached instance must win, otherwise the two threads would modify diverging copies.
       auto insertion_result(cache_.emplace(antecedent, std::move(directory)));
-      assert(insertion_result.second);
-      static_cast<void>(insertion_result);
+      parent = insertion_result.first->second;
     }
     ++path_itr;
   }
@@ -315,6 +336,55 @@ void DirectoryHandler<Storage>::StoreAll() {
   }
 }
 
+template <typename Storage>
+std::vector<RemoteChange> DirectoryHandler<Storage>::RefreshFromStorage() {
+  SCOPED_PROFILE
+  std::vector<std::pair<boost::filesystem::path, std::shared_ptr<Directory>>> directories;
+  {
+    const std::lock_guard<std::mutex> lock(cache_mutex_);
+    directories.assign(std::begin(cache_), std::end(cache_));
+  }
+
+  std::vector<RemoteChange> changes;
+  for (const auto& entry : directories) {
+    const auto& directory(entry.second);
+    // Open files belong to the cached instance, so it can't be swapped out beneath them.  Local
+    // changes win for now; merging them with a remote version is the TODO in GetFromStorage.
+    if (directory->VersionsCount() == 0 || directory->HasPending() ||
+        directory->HasBufferedFiles()) {
+      continue;
+    }
+    try {
+      MutableData::Name hash_directory_id(crypto::Hash<crypto::SHA512>(directory->directory_id()));
+      const auto tips(storage_->GetVersions(hash_directory_id).get());
+      if (tips.empty() ||
+          std::find(std::begin(tips), std::end(tips), directory->CurrentVersion()) !=
+              std::end(tips)) {
+        continue;
+      }
+
+      auto reloaded(GetFromStorage(entry.first, directory->parent_id(), directory->directory_id()));
+      RemoteChange change;
+      change.relative_path = entry.first;
+      change.changed_children = directory->ChangedChildren(*reloaded);
+      {
+        const std::lock_guard<std::mutex> lock(cache_mutex_);
+        auto itr(cache_.find(entry.first));
+        if (itr == std::end(cache_) || itr->second != directory || directory->HasPending())
+          continue;
+        itr->second = reloaded;
+        EraseReplacedSubdirectories(entry.first, *reloaded, change.changed_children);
+      }
+      LOG(kInfo) << "Reloaded " << entry.first << " changed remotely; "
+                 << change.changed_children.size() << " children differ.";
+      changes.push_back(std::move(change));
+    } catch (const std::exception& e) {
+      LOG(kWarning) << "Failed to refresh " << entry.first << ": " << e.what();
+    }
+  }
+  return changes;
+}
+
 template <typename Storage>
 void DirectoryHandler<Storage>::Delete(const boost::filesystem::path& relative_path) {
   SCOPED_PROFILE
@@ -332,6 +402,7 @@ void DirectoryHandler<Storage>::Delete(const boost::filesystem::path& relative_p
   }
 
   parent.first->RemoveChild(relative_path.filename());
+  const std::lock_guard<std::mutex> lock(parent.second->meta_data_mutex);
   parent.second->meta_data.UpdateLastModifiedTime();
 }
 
@@ -441,10 +512,14 @@ void DirectoryHandler<Storage>::RenameDifferentParent(
     directory->ScheduleForStoring();
   }
 
-  file->meta_data.set_name(new_relative_path.filename());
+  {
+    const std::lock_guard<std::mutex> lock(file->meta_data_mutex);
+    file->meta_data.set_name(new_relative_path.filename());
+  }
   file->SetParent(new_parent);
   new_parent->AddChild(file);
 
+  const std::lock_guard<std::mutex> lock(old_parent.second->meta_data_mutex);
   old_parent.second->meta_data.UpdateLastModifiedTime();
 }
 
@@ -559,6 +634,34 @@ void DirectoryHandler<Storage>::DeleteOldestVersion(Path* /*path*/) {
   // }
 }
 
+template <typename Storage>
+void DirectoryHandler<Storage>::EraseReplacedSubdirectories(
+    const boost::filesystem::path& relative_path, const Directory& reloaded,
+    const std::vector<boost::filesystem::path>& names) {
+  for (const auto& name : names) {
+    const auto subdirectory_path(relative_path / name);
+    const auto itr(cache_.find(subdirectory_path));
+    if (itr == std::end(cache_) || itr->second->HasPending())
+      continue;
+    if (reloaded.HasChild(name)) {
+      const auto child(reloaded.GetChild(name));
+      if (child->meta_data.directory_id() &&
+          *child->meta_data.directory_id() == itr->second->directory_id()) {
+        continue;
+      }
+    }
+    // Anything cached beneath it is unreachable too.
+    const std::string prefix(subdirectory_path.string() + '/');
+    for (auto descendant(std::begin(cache_)); descendant != std::end(cache_);) {
+      if (descendant->first.string().compare(0, prefix.size(), prefix) == 0)
+        descendant = cache_.erase(descendant);
+      else
+        ++descendant;
+    }
+    cache_.erase(subdirectory_path);
+  }
+}
+
 template <typename Storage>
 NonEmptyString DirectoryHandler<Storage>::GetChunkFromStore(const std::string& name) const {
   try {
@@ -586,6 +689,12 @@ void DirectoryHandler<Storage>::DirectoryIncrementChunks(
   storage_->IncrementReferenceCount(names);
 }
 
+template <typename Storage>
+void DirectoryHandler<Storage>::DirectoryDecrementChunks(
+    const std::vector<ImmutableData::Name>& names) {
+  storage_->DecrementReferenceCount(names);
+}
+
 }  // namespace detail
 
 }  // namespace drive
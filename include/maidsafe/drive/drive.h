@@ -39,9 +39,14 @@
 #include "maidsafe/common/rsa.h"
 #include "maidsafe/common/utils.h"
 
+#include "maidsafe/drive/buffer_budget.h"
+#include "maidsafe/drive/chunk_cache.h"
 #include "maidsafe/drive/config.h"
 #include "maidsafe/drive/meta_data.h"
 #include "maidsafe/drive/directory_handler.h"
+#include "maidsafe/drive/keep_alive_cache.h"
+#include "maidsafe/drive/latency_histogram.h"
+#include "maidsafe/drive/spill_store.h"
 #include "maidsafe/drive/utils.h"
 #include "maidsafe/drive/tools/launcher.h"
 
@@ -64,7 +69,8 @@ class Drive {
   Drive(std::shared_ptr<Storage> storage, const Identity& unique_user_id,
         const Identity& root_parent_id, const boost::filesystem::path& mount_dir,
         const boost::filesystem::path& user_app_dir, std::string mount_status_shared_object_name,
-        bool create);
+        bool create, std::uint64_t chunk_cache_size = detail::kDefaultChunkCacheSize,
+        bool write_behind = false);
 
   template <typename T = detail::Path>
   typename std::enable_if<std::is_base_of<detail::Path, T>::value,
@@ -76,36 +82,70 @@ class Drive {
   void Create(const boost::filesystem::path& relative_path, std::shared_ptr<detail::Path> path);
   void Open(detail::File& file);
   void ReleaseDir(const boost::filesystem::path& relative_path);
+  // Both block until the directory holding the latest state of the target has been stored.  A
+  // file's data map lives in its parent, so syncing a file commits its parent directory.
+  void SyncFile(detail::File& file);
+  void SyncDirectory(const boost::filesystem::path& relative_path);
   void Delete(const boost::filesystem::path& relative_path);
   void Rename(const boost::filesystem::path& old_relative_path,
               const boost::filesystem::path& new_relative_path);
 
   detail::MetaData::Permissions get_base_file_permissions() const;
+  // Safe to call more than once.  Unmount() calls it before DoUnmount(), so that
+  // InvalidateRemoteChanges() never runs against a torn-down mount.
+  void StopRemoteChangeWatcher();
 
   const boost::filesystem::path kMountDir_;
   const boost::filesystem::path kUserAppDir_;
   const std::unique_ptr<const boost::filesystem::path,
                         std::function<void(const boost::filesystem::path* const)>> kBufferRoot_;
   const std::string kMountStatusSharedObjectName_;
+  // Of the frontends' write handlers, logged when the drive is destroyed.
+  detail::LatencyHistogram write_latency_;
   boost::promise<void> mount_promise_;
   std::once_flag unmounted_once_flag_;
 
  private:
   virtual void DoMount() = 0;
   virtual void DoUnmount() = 0;
+  // Called on the watcher thread with the directories just reloaded because another client
+  // changed them, so that any kernel caches of their children can be dropped.
+  virtual void InvalidateRemoteChanges(const std::vector<detail::RemoteChange>& /*changes*/) {}
+
+  void WatchRemoteChanges();
+  // Creates the file, shared by all buffers, which takes the chunks they can't hold.
+  static std::shared_ptr<detail::SpillStore> CreateSpillStore(
+      const boost::filesystem::path& buffer_root, std::uint64_t capacity);
 
  private:
   typedef detail::File::Buffer Buffer;
 
+  // Shared by all files, and consulted before storage for every chunk they read.
+  const std::shared_ptr<detail::ChunkCache> chunk_cache_;
   std::function<NonEmptyString(const std::string&)> get_chunk_from_store_;
+  detail::Readahead::PrefetchFunctor prefetch_chunk_from_store_;
+  // The disk set aside for all open files' buffers.
+  const std::uint64_t buffer_disk_budget_;
   MemoryUsage default_max_buffer_memory_;
   DiskUsage default_max_buffer_disk_;
+  // Bounds the total of all open files' buffers; the defaults above only bound each one.
+  const std::shared_ptr<detail::BufferBudget> buffer_budget_;
 
   const detail::MetaData::Permissions base_file_permissions_;
+  std::mutex watcher_mutex_;
+  std::condition_variable watcher_condition_;
+  bool watcher_stopped_;
+  std::thread watcher_;
+  // Stores the chunks of closed files, so that the uploads don't hold up asio_service_.
+  AsioService upload_service_;
+  // If write-behind is on, passes files' queued writes to their encryptors.
+  const std::unique_ptr<AsioService> write_behind_service_;
 
  protected:
   AsioService asio_service_;
   const std::shared_ptr<detail::DirectoryHandler<Storage>> directory_handler_;
+  // Holds the buffers of recently closed files, in case they're reopened.
+  const std::shared_ptr<detail::KeepAliveCache> keep_alive_cache_;
 };
 
 // ==================== Implementation =============================================================
@@ -113,7 +153,8 @@ template <typename Storage>
 Drive<Storage>::Drive(std::shared_ptr<Storage> storage, const Identity& unique_user_id,
                       const Identity& root_parent_id, const boost::filesystem::path& mount_dir,
                       const boost::filesystem::path& user_app_dir,
-                      std::string mount_status_shared_object_name, bool create)
+                      std::string mount_status_shared_object_name, bool create,
+                      std::uint64_t chunk_cache_size, bool write_behind)
     : kMountDir_(mount_dir),
       kUserAppDir_(user_app_dir),
       kBufferRoot_(new boost::filesystem::path(user_app_dir / "Buffers"),
@@ -128,37 +169,82 @@ Drive<Storage>::Drive(std::shared_ptr<Storage> storage, const Identity& unique_u
         delete delete_path;
       }),
       kMountStatusSharedObjectName_(std::move(mount_status_shared_object_name)),
+      write_latency_(),
       mount_promise_(),
       unmounted_once_flag_(),
+      chunk_cache_(std::make_shared<detail::ChunkCache>(chunk_cache_size)),
       get_chunk_from_store_(),
+      prefetch_chunk_from_store_(),
       // TODO(Fraser#5#): 2013-11-27 - BEFORE_RELEASE - confirm the following 2 variables.
-      default_max_buffer_memory_(Concurrency() * 1024 * 1024),  // cores * default chunk size
-      default_max_buffer_disk_(
+      buffer_disk_budget_(
           static_cast<uint64_t>(boost::filesystem::space(kUserAppDir_).available / 10)),
+      default_max_buffer_memory_(Concurrency() * 1024 * 1024),  // cores * default chunk size
+      default_max_buffer_disk_(buffer_disk_budget_ / 4),  // so at least 4 buffers fit in full
+      buffer_budget_(std::make_shared<detail::BufferBudget>(
+          detail::kBufferMemoryBudget, buffer_disk_budget_, default_max_buffer_memory_.data,
+          default_max_buffer_disk_.data, CreateSpillStore(*kBufferRoot_, buffer_disk_budget_))),
       base_file_permissions_(detail::MetaData::Permissions::owner_read |
                              detail::MetaData::Permissions::owner_write),
+      watcher_mutex_(),
+      watcher_condition_(),
+      watcher_stopped_(false),
+      watcher_(),
+      upload_service_(detail::kUploadThreadCount),
+      write_behind_service_(write_behind ? new AsioService(detail::kWriteBehindThreadCount)
+                                         : nullptr),
       asio_service_(2),
       directory_handler_(detail::DirectoryHandler<Storage>::Create(
           storage, unique_user_id, root_parent_id,
           boost::filesystem::unique_path(*kBufferRoot_ / "%%%%%-%%%%%-%%%%%-%%%%%"), create,
-          asio_service_.service())) {
+          asio_service_.service())),
+      keep_alive_cache_(std::make_shared<detail::KeepAliveCache>(
+          asio_service_.service(), detail::kMaxIdleOpenFiles, detail::kFileInactivityDelay)) {
   assert(storage != nullptr);
-  get_chunk_from_store_ = [storage](const std::string& name) {
+  const std::shared_ptr<detail::ChunkCache> chunk_cache(chunk_cache_);
+  get_chunk_from_store_ = [storage, chunk_cache](const std::string& name) -> NonEmptyString {
+    NonEmptyString content;
+    if (chunk_cache->Get(name, content))
+      return content;
     try {
       auto chunk(storage->Get(ImmutableData::Name(Identity(name))).get());
+      chunk_cache->Put(name, chunk.data());
       return chunk.data();
     } catch (const std::exception& e) {
       LOG(kError) << "Failed to get chunk from storage: " << e.what();
       throw;
     }
   };
+  prefetch_chunk_from_store_ = [storage](const std::string& name) {
+    return storage->Get(ImmutableData::Name(Identity(name))).share();
+  };
 }
 
 template <typename Storage>
 Drive<Storage>::~Drive() {
   try {
+    StopRemoteChangeWatcher();
     asio_service_.Stop();
+    LOG(kInfo) << "Chunk cache: " << chunk_cache_->hits() << " hits, " << chunk_cache_->misses()
+               << " misses, " << chunk_cache_->evictions() << " evictions";
+    LOG(kInfo) << "Buffer budget: " << buffer_budget_->shortfalls() << " grants cut short, "
+               << buffer_budget_->overcommits() << " made beyond the budget, "
+               << buffer_budget_->buffer_count() << " buffers still holding "
+               << buffer_budget_->memory_granted() << " bytes of memory";
+    LOG(kInfo) << "Keep-alive cache: " << keep_alive_cache_->evictions() << " evictions, "
+               << keep_alive_cache_->size() << " files still idle";
+    LOG(kInfo) << "Write latency with write-behind " << (write_behind_service_ ? "on" : "off")
+               << ": " << write_latency_.count() << " writes, p50 < "
+               << write_latency_.Percentile(0.5).count() << "us, p90 < "
+               << write_latency_.Percentile(0.9).count() << "us, p99 < "
+               << write_latency_.Percentile(0.99).count() << "us, max "
+               << write_latency_.max().count() << "us";
     assert(directory_handler_ != nullptr);
+    // Files whose chunks are still uploading are stored with their last complete data maps, and
+    // their parents stored again once upload_service_ has finished.
+    directory_handler_->StoreAll();
+    if (write_behind_service_)
+      write_behind_service_->Stop();
+    upload_service_.Stop();
     directory_handler_->StoreAll();
   } catch (...) {
   }
@@ -166,12 +252,18 @@ Drive<Storage>::~Drive() {
 
 template <typename Storage>
 void Drive<Storage>::Unmount() {
+  StopRemoteChangeWatcher();
   asio_service_.Stop();
   DoUnmount();
 }
 
 template <typename Storage>
 void Drive<Storage>::Mount() {
+  {
+    const std::lock_guard<std::mutex> lock(watcher_mutex_);
+    if (!watcher_stopped_ && !watcher_.joinable())
+      watcher_ = std::thread([this] { WatchRemoteChanges(); });
+  }
   DoMount();
 }
 
@@ -213,6 +305,8 @@ void Drive<Storage>::Create(const boost::filesystem::path& relative_path,
   if (path->meta_data.file_type() == detail::MetaData::FileType::regular_file) {
     auto file = std::dynamic_pointer_cast<detail::File>(path);
     assert(file != nullptr);
+    // New files are kept in the parent's listing until they outgrow kMaxInlineFileSize.
+    file->meta_data.SetInlineContent(std::string());
     Open(*file);
   }
   directory_handler_->Add(relative_path, path);
@@ -222,7 +316,9 @@ template <typename Storage>
 void Drive<Storage>::Open(detail::File& file) {
   assert(kBufferRoot_ != nullptr);
   file.Open(get_chunk_from_store_, default_max_buffer_memory_, default_max_buffer_disk_,
-            *kBufferRoot_);
+            *kBufferRoot_, prefetch_chunk_from_store_, chunk_cache_, &upload_service_.service(),
+            buffer_budget_, keep_alive_cache_,
+            write_behind_service_ ? &write_behind_service_->service() : nullptr);
 }
 
 template <typename Storage>
@@ -232,6 +328,26 @@ void Drive<Storage>::ReleaseDir(const boost::filesystem::path& relative_path) {
   directory->ResetChildrenCounter();
 }
 
+template <typename Storage>
+void Drive<Storage>::SyncFile(detail::File& file) {
+  SCOPED_PROFILE
+  file.Flush();
+  const auto parent(file.Parent());
+  if (!parent)  // An unlinked file has nothing left to commit.
+    return;
+  parent->Sync();
+  // The store checkpointed the file, but serialised its last data map whose chunks were all
+  // stored.  Once the checkpoint's chunks are, the parent is stored again with its data map.
+  if (file.WaitForUploads())
+    parent->Sync();
+}
+
+template <typename Storage>
+void Drive<Storage>::SyncDirectory(const boost::filesystem::path& relative_path) {
+  SCOPED_PROFILE
+  directory_handler_->template Get<detail::Directory>(relative_path)->Sync();
+}
+
 template <typename Storage>
 void Drive<Storage>::Delete(const boost::filesystem::path& relative_path) {
   directory_handler_->Delete(relative_path);
@@ -248,6 +364,50 @@ detail::MetaData::Permissions Drive<Storage>::get_base_file_permissions() const
   return base_file_permissions_;
 }
 
+template <typename Storage>
+void Drive<Storage>::StopRemoteChangeWatcher() {
+  std::thread watcher;
+  {
+    const std::lock_guard<std::mutex> lock(watcher_mutex_);
+    watcher_stopped_ = true;
+    watcher.swap(watcher_);
+  }
+  watcher_condition_.notify_all();
+  if (watcher.joinable())
+    watcher.join();
+}
+
+template <typename Storage>
+void Drive<Storage>::WatchRemoteChanges() {
+  std::unique_lock<std::mutex> lock(watcher_mutex_);
+  while (!watcher_condition_.wait_for(lock, detail::kRemoteChangePollInterval,
+                                      [this] { return watcher_stopped_; })) {
+    lock.unlock();
+    try {
+      const auto changes(directory_handler_->RefreshFromStorage());
+      if (!changes.empty())
+        InvalidateRemoteChanges(changes);
+    } catch (const std::exception& e) {
+      LOG(kError) << "Failed checking for remote changes: " << e.what();
+    }
+    lock.lock();
+  }
+}
+
+template <typename Storage>
+std::shared_ptr<detail::SpillStore> Drive<Storage>::CreateSpillStore(
+    const boost::filesystem::path& buffer_root, std::uint64_t capacity) {
+  try {
+    boost::filesystem::create_directories(buffer_root);
+    return std::make_shared<detail::SpillStore>(
+        boost::filesystem::unique_path(buffer_root / "spill-%%%%%-%%%%%"), capacity);
+  } catch (const std::exception& e) {
+    // Buffers then fail writes they can't hold, as they did before there was a spill store.
+    LOG(kWarning) << "Failed to create spill store: " << e.what();
+    return nullptr;
+  }
+}
+
 }  // namespace drive
 
 }  // namespace maidsafe
@@ -19,18 +19,34 @@
 #ifndef MAIDSAFE_DRIVE_FILE_H_
 #define MAIDSAFE_DRIVE_FILE_H_
 
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
-#include "boost/asio/steady_timer.hpp"
+#include "boost/asio/io_service.hpp"
 #include "boost/filesystem/path.hpp"
+#include "boost/thread/locks.hpp"
+#include "boost/thread/shared_mutex.hpp"
 
 #include "maidsafe/common/asio_service.h"
 #include "maidsafe/common/config.h"
 #include "maidsafe/common/data_buffer.h"
 
+#include "maidsafe/drive/buffer_budget.h"
+#include "maidsafe/drive/keep_alive_cache.h"
 #include "maidsafe/drive/path.h"
+#include "maidsafe/drive/readahead.h"
+#include "maidsafe/drive/spill_store.h"
 
 namespace maidsafe {
 
@@ -43,6 +59,15 @@ class Directory;
 class File : public Path {
  public:
   typedef DataBuffer<std::string> Buffer;
+  // One segment of a scatter-gather transfer.
+  template <typename Char>
+  struct Segment {
+    Segment(Char* data_in, std::uint32_t length_in) : data(data_in), length(length_in) {}
+    Char* data;
+    std::uint32_t length;
+  };
+  typedef Segment<char> ReadSegment;
+  typedef Segment<const char> WriteSegment;
 
   // This class must always be constructed using a Create() call to ensure that it will be
   // a shared_ptr. See the private constructors for the argument lists.
@@ -62,13 +87,49 @@ class File : public Path {
   virtual void Serialise(protobuf::Directory&, std::vector<ImmutableData::Name>&);
   virtual void ScheduleForStoring();
 
+  // If 'prefetch_chunk_from_store' is given, the chunks spanned by a read, and those ahead of a
+  // sequential reader, are fetched in parallel with it (see Readahead).  Chunks so fetched are
+  // added to 'chunk_cache' if given.  The chunks written before the last close are stored on
+  // 'upload_service' if given, or else on the thread releasing the idle buffer; either way without
+  // holding the file's lock, so that a reopen needn't wait for them.  If 'buffer_budget' is given,
+  // the buffer's limits are further bounded by a grant from it.  Chunks which fit neither the
+  // buffer nor the spill store are stored before the close, so a file with a parent can outgrow
+  // both (see StreamFinalChunks()).  A file with inline content only
+  // creates its buffer if it outgrows kMaxInlineFileSize.  After the last close, the buffer is
+  // kept for a reopen by 'keep_alive_cache' if given, or else released straight away.  If
+  // 'write_behind_service' is given, writes to the buffer are queued and acknowledged at once, and
+  // passed to the encryptor on that service (see QueueWrite()).
   void Open(const std::function<NonEmptyString(const std::string&)>& get_chunk_from_store,
             const MemoryUsage max_memory_usage, const DiskUsage max_disk_usage,
-            const boost::filesystem::path& disk_buffer_location);
+            const boost::filesystem::path& disk_buffer_location,
+            const Readahead::PrefetchFunctor& prefetch_chunk_from_store =
+                Readahead::PrefetchFunctor(),
+            std::shared_ptr<ChunkCache> chunk_cache = nullptr,
+            boost::asio::io_service* upload_service = nullptr,
+            const std::shared_ptr<BufferBudget>& buffer_budget = nullptr,
+            const std::shared_ptr<KeepAliveCache>& keep_alive_cache = nullptr,
+            boost::asio::io_service* write_behind_service = nullptr);
   std::uint32_t Read(char* data, std::uint32_t length, std::uint64_t offset);
   std::uint32_t Write(const char* data, std::uint32_t length, std::uint64_t offset);
+  // Scatter-gather forms of Read and Write.  The segments are treated as one contiguous range
+  // starting at 'offset' and are transferred under a single acquisition of the file's lock.
+  // ReadV stops at the end of the file; both return the total number of bytes transferred.
+  std::uint64_t ReadV(const std::vector<ReadSegment>& segments, std::uint64_t offset);
+  std::uint64_t WriteV(const std::vector<WriteSegment>& segments, std::uint64_t offset);
   void Truncate(std::uint64_t offset);
+  // Passes any queued or gathered writes to the encryptor.  Throws the error, if any, with which
+  // a write acknowledged in write-behind mode failed to reach it.
+  void Flush();
+  // Blocks, without the file's lock, until the chunks being stored for the file have been.
+  // Returns false if there were none.
+  bool WaitForUploads() const;
+  // As for Flush(), the close throws such an error, having closed the file regardless.
   void Close();
+  // True while the file is open, or closed with its buffer not yet flushed.
+  bool IsBuffered();
+  // Incremented by every write and truncate, so that holders of copies of the file's data can
+  // tell whether they are stale.
+  std::uint64_t WriteCount() const { return write_count_; }
 
  private:
   File(boost::asio::io_service& asio_service, MetaData meta_data_in,
@@ -78,15 +139,135 @@ class File : public Path {
   File(File&&) = delete;
   File& operator=(File) = delete;
 
+  // The names and contents of chunks which are to be stored.
+  typedef std::vector<std::pair<std::string, NonEmptyString>> NewChunks;
+
+  // Chunks written by a close, or streamed while the file is written, which are still being
+  // stored.  Until they are, a reopen of the file reads them from here rather than from storage.
+  class PendingChunks {
+   public:
+    PendingChunks() : mutex_(), stored_(), chunks_(), streaming_(0), store_deferred_(false) {}
+    // 'streamed' is passed the same to both for the chunks of a stream.
+    void Add(const NewChunks& chunks, bool streamed = false);
+    // Returns true if this left no chunks pending after DeferStore() had been called.
+    bool Remove(const NewChunks& chunks, bool streamed = false);
+    // If any chunks are pending, records that the parent was stored without them, and returns
+    // their names.
+    std::unordered_set<std::string> DeferStore();
+    bool Get(const std::string& name, NonEmptyString& content) const;
+    // Blocks until every chunk added has been removed.  Returns false if none were pending.
+    bool WaitUntilStored() const;
+    // Blocks until none of 'names' is still to be removed.
+    void WaitUntilStored(const std::vector<ImmutableData::Name>& names) const;
+    // Blocks until fewer than 'count' streamed chunks are still to be removed.
+    void WaitUntilFewerStreaming(std::size_t count) const;
+
+   private:
+    mutable std::mutex mutex_;
+    mutable std::condition_variable stored_;
+    // Each chunk with the number of outstanding stores of it.
+    std::unordered_map<std::string, std::pair<NonEmptyString, unsigned>> chunks_;
+    std::size_t streaming_;
+    bool store_deferred_;
+  };
+
   //
-  // Private methods require caller to hold data_mutex_
+  // Private methods require caller to hold data_mutex_ exclusively, or shared along with
+  // encryptor_mutex_
   //
 
   bool HasBuffer() const;
   // Throw exception if file is not open
   void VerifyHasBuffer() const;
-
-  void CloseEncryptor(std::vector<ImmutableData::Name>& chunks_to_be_incremented);
+  // True if the file's content is kept in meta_data rather than self-encrypted.
+  bool IsInline() const;
+  void VerifyInlineIsOpen() const;
+
+  void OpenBuffer(const std::function<NonEmptyString(const std::string&)>& get_chunk_from_store,
+                  const MemoryUsage max_memory_usage, const DiskUsage max_disk_usage,
+                  const boost::filesystem::path& disk_buffer_location,
+                  const Readahead::PrefetchFunctor& prefetch_chunk_from_store,
+                  std::shared_ptr<ChunkCache> chunk_cache, boost::asio::io_service* upload_service,
+                  const std::shared_ptr<BufferBudget>& buffer_budget,
+                  boost::asio::io_service* write_behind_service);
+  // True if the file is inline and will still fit after a write ending at 'end'.  If it won't,
+  // the buffer is opened and the content moved into its encryptor.
+  bool KeepInline(std::uint64_t end);
+  // Transfers to and from the inline content.  ReadInline() requires meta_data_mutex to be held.
+  std::uint32_t ReadInline(char* data, std::uint32_t length, std::uint64_t offset) const;
+  void WriteInline(const char* data, std::uint32_t length, std::uint64_t offset);
+  void TruncateInline(std::uint64_t offset);
+  void TruncateBuffer(std::uint64_t offset);
+
+  // Closes the encryptor, which updates the data map, and returns the chunks not in the original
+  // data map.  Those which were are added to 'chunks_to_be_incremented' instead.  Chunks streamed
+  // since the encryptor was created which the data map no longer refers to are added to
+  // 'chunks_to_be_decremented'.
+  NewChunks CloseEncryptor(std::vector<ImmutableData::Name>& chunks_to_be_incremented,
+                           std::vector<ImmutableData::Name>& chunks_to_be_decremented);
+  // Publishes the encryptor's data map to meta_data, storing any new chunks on upload_service_ if
+  // given, as for a close.  The encryptor is only closed and replaced if the file has been written
+  // since it was created.  Returns false, leaving the encryptor as it is, if a write acknowledged
+  // in write-behind mode failed to reach it and the application hasn't yet been told.
+  bool CheckpointEncryptor(std::vector<ImmutableData::Name>& chunks_to_be_incremented);
+  // Hands the idle file to keep_alive_cache_, or releases its buffer now if there's no cache.
+  void KeepAlive();
+  // Closes the encryptor and destroys the buffer, unless the file has been reopened.
+  void ReleaseIdleBuffer();
+  // Lets the buffer budget have an idle buffer destroyed early.
+  BufferBudget::ReleaseFunctor MakeBufferReleaseFunctor();
+  // Lets the buffer hold chunks it pushes out once the spill store is full, if the file has a
+  // parent to store them through.
+  std::function<bool()> MakeCanStreamFunctor();
+  // Stores the held chunks which the encryptor won't write again before the close, on
+  // upload_service_.  Until stored, they're kept with the pending chunks.  Without
+  // upload_service_, they stay held for the close to store.  Doesn't wait for earlier streams;
+  // writers do that in Write() before taking data_mutex_.
+  void StreamFinalChunks();
+  // Stores the chunks left by a close on upload_service_, without holding data_mutex_.
+  void StoreClosedChunks(NewChunks new_chunks,
+                         std::vector<ImmutableData::Name> chunks_to_be_incremented,
+                         std::vector<ImmutableData::Name> chunks_to_be_decremented);
+  // Stores 'new_chunks', which the caller has added to pending_chunks_, then updates the
+  // reference counts.  The chunks to be decremented are only decremented once any streams of
+  // them have completed.
+  std::function<void()> MakeStoreFunctor(
+      NewChunks new_chunks, std::vector<ImmutableData::Name> chunks_to_be_incremented,
+      std::vector<ImmutableData::Name> chunks_to_be_decremented);
+
+  std::uint32_t DoRead(char* data, std::uint32_t length, std::uint64_t offset);
+  void DoWrite(const char* data, std::uint32_t length, std::uint64_t offset);
+  // Gathers a write smaller than kWriteCoalescingSize into the current extent if it follows on
+  // from it, passing the extent to the encryptor once it's full.  Returns true if the write
+  // began an extent or went straight to the encryptor, and so needs the parent to store.  The
+  // times are left alone unless 'update_times' is set.
+  bool CoalesceWrite(const char* data, std::uint32_t length, std::uint64_t offset,
+                     bool update_times);
+  // Passes the queued writes and then the gathered extent, if any, to the encryptor.
+  void FlushCoalescedWrites();
+  // Passes just the gathered extent, if any, to the encryptor.
+  void FlushExtent();
+  // Sets meta_data's size, counting only the bytes written as allocated.  Any part of the file
+  // past the end of the encryptor's data is a hole.  Caller must also hold meta_data_mutex.
+  void SetSize(std::uint64_t size, bool update_times);
+  // As above, for callers holding data_mutex_ shared.  Upgrades to an exclusive lock only if
+  // there is anything to flush, returning with 'lock' held shared again.
+  void FlushCoalescedWrites(boost::shared_lock<boost::shared_mutex>& lock);
+
+  // Called without data_mutex_.  In write-behind mode, queues the segments as one write and
+  // returns true, having waited for room in the queue if it was full; otherwise returns false for
+  // the caller to write synchronously.  Throws the error, if any, with which the queue last failed
+  // to drain.
+  bool QueueWrite(const WriteSegment* segments, std::size_t count, std::uint64_t offset);
+  // Passes the queued writes, in order, to the encryptor via CoalesceWrite().  Failures are kept
+  // for the next write, truncate, flush or close to report, as the writes have already been
+  // acknowledged.
+  void DrainWriteQueue();
+  bool HasQueuedWrites();
+  // Throws, and then forgets, the error with which the queue last failed to drain.  Call only
+  // where the application will be told.
+  void ThrowWriteBehindError();
+  bool HasWriteBehindError();
 
   void Serialise(protobuf::Path&);
 
@@ -95,9 +276,13 @@ class File : public Path {
     // Stores some of the original constructor values that are encapsulated in
     // other objects. Needed to "flush" self encryptor (only close is given).
     struct OriginalParameters {
+      typedef std::function<bool()> CanStreamFunctor;
+
       OriginalParameters(const MemoryUsage max_memory_usage, const DiskUsage max_disk_usage,
                          const boost::filesystem::path& disk_buffer_location,
-                         std::function<NonEmptyString(const std::string&)> get_chunk_from_store);
+                         std::function<NonEmptyString(const std::string&)> get_chunk_from_store,
+                         std::shared_ptr<SpillStore> spill_store,
+                         const DiskUsage max_spill_usage, CanStreamFunctor can_stream);
 
       OriginalParameters(OriginalParameters&& rhs);  // alow move construction
       OriginalParameters(const OriginalParameters&) = delete;
@@ -108,24 +293,111 @@ class File : public Path {
       std::function<NonEmptyString(const std::string&)> get_chunk_from_store_;
       MemoryUsage max_memory_usage_;
       DiskUsage max_disk_usage_;
+      std::shared_ptr<SpillStore> spill_store_;
+      // The most of spill_store_ the buffer may use.
+      DiskUsage max_spill_usage_;
+      CanStreamFunctor can_stream_;
+    };
+
+    // Names of the chunks the buffer has pushed out into the spill store, or once that's full,
+    // the chunks themselves until they're streamed to storage.  Added to by the buffer's pop
+    // functor, which may run on the buffer's own thread.
+    struct SpilledChunks {
+      SpilledChunks() : mutex(), names(), held(), streamed(), bytes(0) {}
+      std::mutex mutex;
+      std::unordered_multiset<std::string> names;
+      std::unordered_map<std::string, NonEmptyString> held;
+      std::unordered_set<std::string> streamed;
+      // Of the chunks put in the spill store.
+      std::uint64_t bytes;
     };
 
     Data(OriginalParameters original_parameters, const boost::filesystem::path& name,
          encrypt::DataMap& data_map);
+    ~Data();
 
     bool IsOpen() const { return open_count_ > 0; }
+    // Records that [offset, offset + length) has been written or truncated since the encryptor
+    // was created.
+    void MarkWritten(std::uint64_t offset, std::uint64_t length);
+    // True if any of [offset, offset + length) has been written.
+    bool IsWritten(std::uint64_t offset, std::uint64_t length) const;
+    // Gets a chunk written by the encryptor, whether still in the buffer, spilled or held.
+    NonEmptyString GetChunk(const std::string& name);
+    // The chunks pushed out of the buffer straight to storage.
+    std::unordered_set<std::string> StreamedChunks() const;
+    bool HoldsChunks() const;
+    // Removes and returns the held chunks which are final, recording them as streamed.  Chunks 0
+    // and 1 are keyed from the last two, so none of those four is final until the close.
+    NewChunks TakeFinalChunks();
+    // Moves chunks pushed out of the full buffer into the spill store, up to 'max_spill_usage',
+    // or if there's no room there either, holds them for streaming to storage.  Fails the write
+    // if neither can take the chunk.
+    static std::function<void(const std::string&, const NonEmptyString&)> MakeSpillFunctor(
+        const boost::filesystem::path& name, std::shared_ptr<SpillStore> spill_store,
+        DiskUsage max_spill_usage, OriginalParameters::CanStreamFunctor can_stream,
+        std::shared_ptr<SpilledChunks> spilled_chunks);
+    // Has the encryptor find held chunks before trying 'get_chunk_from_store'.
+    static std::function<NonEmptyString(const std::string&)> MakeChunkGetter(
+        std::function<NonEmptyString(const std::string&)> get_chunk_from_store,
+        std::shared_ptr<SpilledChunks> spilled_chunks);
 
     OriginalParameters original_parameters_;
+    const std::shared_ptr<SpilledChunks> spilled_chunks_;
     Buffer buffer_;
     encrypt::SelfEncryptor self_encryptor_;
     unsigned open_count_;
+    // Disjoint byte ranges written since the encryptor was created, as first byte to end.
+    std::map<std::uint64_t, std::uint64_t> written_;
+    // Small contiguous writes not yet passed to the encryptor, starting at coalesced_offset_.
+    std::string coalesced_;
+    std::uint64_t coalesced_offset_;
   };
 
   std::unique_ptr<Data> file_data_;
-  boost::asio::steady_timer close_timer_;
-  std::mutex data_mutex_;
+  // While an inline file is open, creates its buffer with the arguments given to Open().
+  std::function<void()> open_buffer_;
+  unsigned inline_open_count_;
+  // Created by the first Open() and shared with the self-encryptor's chunk getter.
+  std::shared_ptr<Readahead> readahead_;
+  const std::shared_ptr<PendingChunks> pending_chunks_;
+  boost::asio::io_service* upload_service_;
+  // Held, if Open() was given a budget, for as long as file_data_ exists.
+  std::unique_ptr<BufferBudget::Grant> buffer_grant_;
+  // Writes acknowledged but not yet passed to the encryptor, while the file is open in
+  // write-behind mode.  Writers only take its mutex, which may be held while taking
+  // meta_data_mutex but is otherwise innermost.
+  struct WriteQueue {
+    WriteQueue()
+        : mutex(), space(), writes(), bytes(0), enabled(false), drain_posted(false), error() {}
+    std::mutex mutex;
+    std::condition_variable space;
+    std::vector<std::pair<std::uint64_t, std::string>> writes;
+    // Counts the writes being drained as well as those queued.
+    std::uint64_t bytes;
+    bool enabled, drain_posted;
+    std::exception_ptr error;
+  };
+  WriteQueue write_queue_;
+  boost::asio::io_service* write_behind_service_;
+  boost::asio::io_service& io_service_;
+  // Keeps the buffer of a closed file for a while, in case it's reopened.
+  std::shared_ptr<KeepAliveCache> keep_alive_cache_;
+  // Reads hold this shared, so that they can request their chunks in parallel; anything which
+  // changes the file or its encryptor holds it exclusively.  The encryptor isn't safe for
+  // concurrent use, so readers serialise their calls into it on encryptor_mutex_.
+  boost::shared_mutex data_mutex_;
+  std::mutex encryptor_mutex_;
+  std::atomic<std::uint64_t> write_count_;
   // True if close completed since last serialisation
   bool skip_chunk_incrementing_;
+  // For a regular file, the last entry serialised into the parent whose chunks had all been
+  // stored.  Serialised in its place while any are pending.
+  protobuf::Path published_;
+  // The last entry serialised while chunks were pending, with the names of those chunks.  Becomes
+  // published_ once none of them is.
+  protobuf::Path unpublished_;
+  std::vector<std::string> unpublished_chunks_;
 };
 
 }  // namespace detail
@@ -0,0 +1,96 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#ifndef MAIDSAFE_DRIVE_KEEP_ALIVE_CACHE_H_
+#define MAIDSAFE_DRIVE_KEEP_ALIVE_CACHE_H_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "boost/asio/io_service.hpp"
+#include "boost/asio/steady_timer.hpp"
+
+namespace maidsafe {
+
+namespace drive {
+
+namespace detail {
+
+// Keeps the buffers of files closed for the last time for a reopen.  Each is released once it has
+// been idle for 'idle_time', or once it's the least recently closed of more than 'capacity' idle
+// buffers, whichever comes first.  One timer serves every entry.
+class KeepAliveCache : public std::enable_shared_from_this<KeepAliveCache> {
+ public:
+  // Run on the io_service given to the constructor.
+  typedef std::function<void()> ReleaseFunctor;
+
+  // Must be created via std::make_shared.
+  KeepAliveCache(boost::asio::io_service& io_service, std::size_t capacity,
+                 std::chrono::steady_clock::duration idle_time);
+  KeepAliveCache(const KeepAliveCache&) = delete;
+  KeepAliveCache& operator=(const KeepAliveCache&) = delete;
+
+  //
+  // All public methods are thread-safe.
+  //
+
+  // Replaces any entry already held for 'key'.
+  void Add(const void* key, ReleaseFunctor release);
+  // Forgets the entry for 'key' without releasing it, as when the file is reopened.  Returns false
+  // if there was none.
+  bool Remove(const void* key);
+
+  std::size_t size() const;
+  // Number of entries released because the cache was full, rather than because they expired.
+  std::uint64_t evictions() const;
+
+ private:
+  struct Entry {
+    const void* key;
+    ReleaseFunctor release;
+    std::chrono::steady_clock::time_point expiry;
+  };
+
+  // Caller must hold mutex_.
+  void ArmSweeper();
+  void Sweep();
+
+  boost::asio::io_service& io_service_;
+  const std::size_t capacity_;
+  const std::chrono::steady_clock::duration idle_time_;
+  mutable std::mutex mutex_;
+  // Earliest expiry first
+  std::list<Entry> entries_;
+  std::unordered_map<const void*, std::list<Entry>::iterator> positions_;
+  boost::asio::steady_timer sweeper_;
+  bool sweeper_armed_;
+  std::uint64_t evictions_;
+};
+
+}  // namespace detail
+
+}  // namespace drive
+
+}  // namespace maidsafe
+
+#endif  // MAIDSAFE_DRIVE_KEEP_ALIVE_CACHE_H_
@@ -0,0 +1,83 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#ifndef MAIDSAFE_DRIVE_LATENCY_HISTOGRAM_H_
+#define MAIDSAFE_DRIVE_LATENCY_HISTOGRAM_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace maidsafe {
+
+namespace drive {
+
+namespace detail {
+
+// Counts durations in power-of-two buckets of microseconds, so that percentiles can be reported to
+// within a factor of two without keeping every sample.
+class LatencyHistogram {
+ public:
+  LatencyHistogram();
+  LatencyHistogram(const LatencyHistogram&) = delete;
+  LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+  //
+  // All public methods are thread-safe.
+  //
+
+  void Record(std::chrono::steady_clock::duration latency);
+
+  std::uint64_t count() const { return count_; }
+  // The upper bound of the bucket holding the sample at 'fraction' (0 to 1) of the way through
+  // the recorded samples in order, or zero if there are none.
+  std::chrono::microseconds Percentile(double fraction) const;
+  std::chrono::microseconds max() const { return std::chrono::microseconds(max_); }
+
+ private:
+  // Bucket 0 holds latencies under 1us, and bucket i > 0 those in [2^(i-1), 2^i) us.  The last
+  // also holds anything longer.
+  static const std::size_t kBucketCount = 40;
+
+  std::array<std::atomic<std::uint64_t>, kBucketCount> buckets_;
+  std::atomic<std::uint64_t> count_;
+  std::atomic<std::uint64_t> max_;
+};
+
+// Records the time from its construction to its destruction.
+class ScopedLatency {
+ public:
+  explicit ScopedLatency(LatencyHistogram& histogram)
+      : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+  ~ScopedLatency() { histogram_.Record(std::chrono::steady_clock::now() - start_); }
+  ScopedLatency(const ScopedLatency&) = delete;
+  ScopedLatency& operator=(const ScopedLatency&) = delete;
+
+ private:
+  LatencyHistogram& histogram_;
+  const std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace detail
+
+}  // namespace drive
+
+}  // namespace maidsafe
+
+#endif  // MAIDSAFE_DRIVE_LATENCY_HISTOGRAM_H_
@@ -28,6 +28,7 @@
 
 #include <cstdint>
 #include <memory>
+#include <string>
 
 #include "boost/filesystem/path.hpp"
 #include "boost/filesystem/operations.hpp"
@@ -75,6 +76,10 @@ class MetaData {
 
   const encrypt::DataMap* data_map() const { return data_map_.get(); }
   encrypt::DataMap* data_map() { return data_map_.get(); }
+  // A regular file's content, if it's small enough to be kept in its parent's listing instead of
+  // being self-encrypted.  The data map is then empty.
+  const std::string* inline_content() const { return inline_content_.get(); }
+  std::string* inline_content() { return inline_content_.get(); }
   const DirectoryId* directory_id() const { return directory_id_.get(); }
   const boost::filesystem::path& name() const { return name_; }
 
@@ -98,6 +103,8 @@ class MetaData {
   void set_status_time(const TimePoint new_time) { last_status_time_ = new_time; }
   void set_last_access_time(const TimePoint new_time) { last_access_time_ = new_time; }
   void set_last_write_time(const TimePoint new_time) { last_write_time_ = new_time; }
+  // Lets a sparse file report less allocated than its size, without touching the times.
+  void set_allocation_size(const std::uint64_t new_size) { allocation_size_ = new_size; }
 
   // Updates the last attributes modification time and access time
   void UpdateLastStatusTime();
@@ -112,6 +119,12 @@ class MetaData {
      Allocation size is modified to match the size. */
   void UpdateSize(const std::uint64_t new_size);
 
+  // Updates only the size and allocation size, leaving the times to a later UpdateSize().
+  void ExtendSize(const std::uint64_t new_size);
+
+  void SetInlineContent(std::string content);
+  void ClearInlineContent();
+
   // Updates the allocated size of the file, status time, write time, and access time
   void UpdateAllocationSize(const std::uint64_t new_size);
 
@@ -121,6 +134,7 @@ class MetaData {
   friend class test::DirectoryTest;
 
   std::unique_ptr<encrypt::DataMap> data_map_;
+  std::unique_ptr<std::string> inline_content_;
   std::unique_ptr<DirectoryId> directory_id_;
   boost::filesystem::path name_;
 
@@ -20,6 +20,7 @@
 #define MAIDSAFE_DRIVE_PATH_H_
 
 #include <memory>
+#include <mutex>
 #include <atomic>
 #include <thread>
 #include <string>
@@ -59,6 +60,9 @@ class Path : public std::enable_shared_from_this<Path> {
 
  public:
   MetaData meta_data;
+  // Guards 'meta_data' between concurrent filesystem worker threads.  This must always be the
+  // innermost lock held; no other lock may be acquired while holding it.
+  mutable std::mutex meta_data_mutex;
 };
 
 bool operator<(const Path& lhs, const Path& rhs);
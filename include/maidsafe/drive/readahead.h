@@ -0,0 +1,147 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#ifndef MAIDSAFE_DRIVE_READAHEAD_H_
+#define MAIDSAFE_DRIVE_READAHEAD_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "boost/thread/future.hpp"
+
+#include "maidsafe/common/types.h"
+#include "maidsafe/common/data_types/immutable_data.h"
+#include "maidsafe/encrypt/data_map.h"
+
+#include "maidsafe/drive/chunk_cache.h"
+#include "maidsafe/drive/config.h"
+
+namespace maidsafe {
+
+namespace drive {
+
+namespace detail {
+
+// Fetches the chunks a file's reader will need in parallel rather than one at a time.  A read
+// spanning several chunks has all of them requested at once, and once reads form a sequential
+// stream, the chunks lying ahead of the reader are requested too.  Large reads and streaming reads
+// are then bounded by the storage's bandwidth rather than by one round trip per chunk.  At most
+// 'max_in_flight' requests are outstanding at a time; the rest are issued as earlier ones complete.
+//
+// The window of chunks fetched ahead starts small and doubles whenever the reader has to wait for
+// a prefetched chunk or overtakes the window, i.e. whenever the storage latency exceeds the time
+// the reader takes to consume the window.  A non-sequential read drops the window back to its
+// initial size.  Chunks are content-addressed, so a prefetched chunk is never stale, even if the
+// file has since been written.
+class Readahead {
+ public:
+  typedef std::function<NonEmptyString(const std::string&)> GetChunkFunctor;
+  typedef std::function<boost::shared_future<ImmutableData>(const std::string&)> PrefetchFunctor;
+
+  // If 'prefetch_chunk' is empty, no chunks are fetched ahead and GetChunk() just forwards to
+  // 'get_chunk'.  If 'chunk_cache' is given, chunks held there aren't prefetched, and prefetched
+  // chunks are added to it once used.
+  Readahead(GetChunkFunctor get_chunk, PrefetchFunctor prefetch_chunk,
+            std::shared_ptr<ChunkCache> chunk_cache = nullptr,
+            std::size_t max_in_flight = kMaxChunksInFlight);
+  Readahead(const Readahead&) = delete;
+  Readahead& operator=(const Readahead&) = delete;
+
+  //
+  // All public methods are thread-safe.
+  //
+
+  // To be called before reading 'length' bytes at 'offset' from the file described by 'data_map'.
+  // Returns the indices of the chunks requested for this read, which are kept for it until passed
+  // to Release(), even if other readers of the file are active.
+  std::vector<std::size_t> Notify(const encrypt::DataMap& data_map, std::uint64_t offset,
+                                  std::uint32_t length);
+  // To be called with Notify()'s result once the read has completed.
+  void Release(const std::vector<std::size_t>& demanded);
+  // Returns the named chunk, waiting for it to be prefetched if that is in progress.  Suitable for
+  // use as a self-encryptor's chunk getter.
+  NonEmptyString GetChunk(const std::string& name);
+  // Drops all prefetched chunks.  Must be called whenever the data map passed to Notify() is
+  // replaced, as prefetched chunks are keyed by their index in it.
+  void Reset();
+
+  std::size_t window() const;
+  // The cache consulted before storage, if any.
+  const std::shared_ptr<ChunkCache>& chunk_cache() const { return chunk_cache_; }
+  std::uint64_t hits() const { return hits_; }
+  std::uint64_t misses() const { return misses_; }
+  // Number of hits for which the chunk was still being fetched.
+  std::uint64_t stalls() const { return stalls_; }
+
+ private:
+  struct Prefetched {
+    std::string name;
+    boost::shared_future<ImmutableData> chunk;
+    // The number of reads in progress which span this chunk; 0 if it was only fetched ahead
+    unsigned demand_count;
+  };
+
+  //
+  // Private methods require caller to hold mutex_
+  //
+
+  bool IsStreaming() const;
+  void GrowWindow();
+  // Returns false if the chunk is cached, so needn't be requested.
+  bool Enqueue(const encrypt::DataMap& data_map, std::size_t index, bool ahead);
+  // Drops the requests before 'end' which no read in progress spans.
+  void DropUndemanded(std::map<std::size_t, Prefetched>& requests,
+                      std::map<std::size_t, Prefetched>::iterator end);
+  // Issues queued requests while fewer than max_in_flight_ are outstanding.
+  void IssueQueued();
+  // Returns the index of the chunk holding 'position', or the number of chunks if it's beyond the
+  // last.  Scans forward from the previous call's result, so a sequential reader costs O(1).
+  std::size_t FindChunk(const encrypt::DataMap& data_map, std::uint64_t position);
+
+  const GetChunkFunctor get_chunk_;
+  const PrefetchFunctor prefetch_chunk_;
+  const std::shared_ptr<ChunkCache> chunk_cache_;
+  const std::size_t max_in_flight_;
+  mutable std::mutex mutex_;
+  // Start of the previous read and end of the furthest one in the current stream
+  std::uint64_t last_offset_, next_offset_;
+  unsigned sequential_count_;
+  std::size_t window_;
+  // One past the index of the furthest chunk requested in the current stream
+  std::size_t prefetch_end_;
+  // Cursor for FindChunk()
+  std::size_t cursor_index_;
+  std::uint64_t cursor_offset_;
+  // Both keyed by index in the data map.  Requests in 'queued_' have not been issued yet.
+  std::map<std::size_t, Prefetched> prefetched_, queued_;
+  std::atomic<std::uint64_t> hits_, misses_, stalls_;
+};
+
+}  // namespace detail
+
+}  // namespace drive
+
+}  // namespace maidsafe
+
+#endif  // MAIDSAFE_DRIVE_READAHEAD_H_
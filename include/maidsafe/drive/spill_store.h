@@ -0,0 +1,112 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#ifndef MAIDSAFE_DRIVE_SPILL_STORE_H_
+#define MAIDSAFE_DRIVE_SPILL_STORE_H_
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#ifdef MAIDSAFE_WIN32
+#include <fstream>
+#endif
+
+#include "boost/filesystem/path.hpp"
+
+#include "maidsafe/common/types.h"
+
+namespace maidsafe {
+
+namespace drive {
+
+namespace detail {
+
+// Holds the chunks which overflow file buffers, in fixed-size slots of a single file shared by the
+// whole drive, rather than as a file apiece.  The file is preallocated a step at a time as it's
+// needed, up to a fixed capacity, and is read and written with positioned I/O.
+//
+// A chunk is stored in a run of consecutive slots.  Chunks are content-addressed, so storing a
+// chunk already held just adds a reference to it, which Delete() removes.
+class SpillStore {
+ public:
+  // The file at 'path' is created, and is removed on destruction.
+  SpillStore(const boost::filesystem::path& path, std::uint64_t capacity,
+             std::uint32_t slot_size = 64 * 1024, std::uint64_t growth_step = 64 * 1024 * 1024);
+  ~SpillStore();
+  SpillStore(const SpillStore&) = delete;
+  SpillStore& operator=(const SpillStore&) = delete;
+
+  //
+  // All public methods are thread-safe.
+  //
+
+  // Returns false if there is no room for the chunk.
+  bool Put(const std::string& name, const NonEmptyString& content);
+  // Returns true and sets 'content' if the chunk is held.
+  bool Get(const std::string& name, NonEmptyString& content);
+  void Delete(const std::string& name);
+
+  std::uint64_t capacity() const { return capacity_; }
+  // Bytes of the slots in use.
+  std::uint64_t size() const;
+  // Bytes preallocated so far.
+  std::uint64_t file_size() const;
+
+ private:
+  struct Entry {
+    std::uint64_t first_slot, slot_count;
+    std::uint32_t size;
+    unsigned references;
+    bool written;
+  };
+
+  // Returns the first slot of a free run of 'count' slots, growing the file if need be, or
+  // capacity_ / slot_size_ if there's no room.
+  std::uint64_t Allocate(std::uint64_t count);
+  void Free(std::uint64_t first_slot, std::uint64_t count);
+  // Drops a reference, freeing the entry's slots with the last.
+  void Release(std::unordered_map<std::string, Entry>::iterator entry);
+  bool Grow();
+  bool WriteAt(std::uint64_t offset, const char* data, std::size_t size);
+  bool ReadAt(std::uint64_t offset, char* data, std::size_t size) const;
+
+  const boost::filesystem::path path_;
+  const std::uint64_t slot_size_, slot_limit_, capacity_, growth_step_;
+  mutable std::mutex mutex_;
+  // Runs of free slots, as first slot to slot count
+  std::map<std::uint64_t, std::uint64_t> free_;
+  std::unordered_map<std::string, Entry> entries_;
+  std::uint64_t slot_count_, slots_used_;
+#ifdef MAIDSAFE_WIN32
+  mutable std::mutex io_mutex_;
+  mutable std::fstream file_;
+#else
+  int file_descriptor_;
+#endif
+};
+
+}  // namespace detail
+
+}  // namespace drive
+
+}  // namespace maidsafe
+
+#endif  // MAIDSAFE_DRIVE_SPILL_STORE_H_
@@ -19,6 +19,7 @@
 #ifndef MAIDSAFE_DRIVE_TOOLS_LAUNCHER_H_
 #define MAIDSAFE_DRIVE_TOOLS_LAUNCHER_H_
 
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <vector>
@@ -34,6 +35,8 @@
 
 #include "maidsafe/common/types.h"
 
+#include "maidsafe/drive/config.h"
+
 #include "maidsafe/nfs/client/maid_node_nfs.h"
 
 namespace maidsafe {
@@ -86,7 +89,16 @@ struct Options {
         encrypted_maid(),
         symm_key(),
         symm_iv(),
-        parent_handle(nullptr) {}
+        parent_handle(nullptr),
+        worker_count(1),
+        low_level_fuse(false),
+        entry_timeout(1.0),
+        attr_timeout(1.0),
+        negative_timeout(0.0),
+        direct_io_min_size(0),
+        direct_io_patterns(),
+        chunk_cache_size(detail::kDefaultChunkCacheSize),
+        write_behind(false) {}
 
   boost::filesystem::path mount_path, storage_path, drive_name;
   Identity unique_id, root_parent_id;
@@ -95,6 +107,23 @@ struct Options {
   std::string drive_logging_args, mount_status_shared_object_name, encrypted_maid, symm_key,
       symm_iv;
   void* parent_handle;
+  // Number of threads servicing filesystem requests.  A value of 1 runs the drive single-threaded.
+  unsigned worker_count;
+  // Use the inode-based FUSE low-level API rather than the path-based one.  Ignored on Windows.
+  bool low_level_fuse;
+  // Seconds for which the kernel may cache name lookups, attributes and failed lookups.  Ignored on
+  // Windows.
+  double entry_timeout, attr_timeout, negative_timeout;
+  // Files at least this many bytes (0 disables the size test), or whose names match one of the
+  // comma-separated glob patterns, are opened direct_io and streamed past the kernel page cache.
+  // Ignored on Windows.
+  std::uint64_t direct_io_min_size;
+  std::string direct_io_patterns;
+  // Bytes of chunk contents cached across all files, so that reopened files needn't fetch their
+  // chunks again.  0 disables the cache.
+  std::uint64_t chunk_cache_size;
+  // Acknowledge writes once queued, and encrypt them on background threads.
+  bool write_behind;
 };
 
 class Launcher {
@@ -107,6 +136,9 @@ class Launcher {
   // process (i.e. this process) and will exit if the parent process stops.
   void StopDriveProcess(bool terminate_on_ipc_failure = false);
   boost::filesystem::path kMountPath() const { return kMountPath_; }
+#ifndef MAIDSAFE_WIN32
+  pid_t DriveProcessId() const { return drive_process_ ? drive_process_->pid : 0; }
+#endif
 
  private:
   Launcher(const Launcher&);
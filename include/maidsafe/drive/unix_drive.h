@@ -20,14 +20,27 @@
 #define MAIDSAFE_DRIVE_UNIX_DRIVE_H_
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <limits>
+#include <iterator>
+#include <locale>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <sstream>
 #include <string>
 #include <thread>
 #include <utility>
 #include <functional>
+#include <vector>
+
+#include <fcntl.h>
+#include <fnmatch.h>
 
 #include "boost/filesystem/path.hpp"
 #include "boost/thread/future.hpp"
@@ -174,26 +187,419 @@ inline struct stat ToStat(const MetaData& meta, const MetaData::Permissions base
   result.st_gid = getgid();
   result.st_nlink = (meta.file_type() == MetaData::FileType::directory_file) ? 2 : 1;
   result.st_size = meta.size();
-  result.st_blksize = detail::kFileBlockSize;
-  result.st_blocks = result.st_size / result.st_blksize;
+  result.st_blksize = detail::kOptimalIoSize;
+  // st_blocks is always in 512-byte units, whatever st_blksize says.  The hole at the end of a
+  // sparse file isn't counted.
+  const std::uint64_t allocated(meta.file_type() == MetaData::FileType::regular_file
+                                    ? meta.allocation_size()
+                                    : static_cast<std::uint64_t>(result.st_size));
+  result.st_blocks = (allocated + detail::kFileBlockSize - 1) / detail::kFileBlockSize;
   result.st_atime = common::Clock::to_time_t(meta.last_access_time());
   result.st_mtime = common::Clock::to_time_t(meta.last_write_time());
   result.st_ctime = common::Clock::to_time_t(meta.last_status_time());
   return result;
 }
 
+inline struct stat ToStat(const Path& path, const MetaData::Permissions base_permissions) {
+  const std::lock_guard<std::mutex> lock(path.meta_data_mutex);
+  return ToStat(path.meta_data, base_permissions);
+}
+
+// State for one open() of a regular file, carried in 'fuse_file_info::fh' so that operations on
+// the handle can reach the file directly rather than resolving its path again.
+struct FileHandle {
+  FileHandle(std::shared_ptr<File> file_in, int flags_in, bool direct_io_in)
+      : file(std::move(file_in)),
+        flags(flags_in),
+        direct_io(direct_io_in),
+        stream_mutex(),
+        stream_data(),
+        stream_offset(0),
+        stream_write_count(0) {}
+  const std::shared_ptr<File> file;
+  const int flags;
+  // Opened with 'direct_io', so reads bypass the page cache and are served by StreamRead().
+  const bool direct_io;
+  // For direct_io handles, the chunk-aligned span of the file most recently decrypted, and the
+  // file's write count when it was read.
+  std::mutex stream_mutex;
+  std::vector<char> stream_data;
+  std::uint64_t stream_offset, stream_write_count;
+};
+
+inline void SetFileHandle(struct fuse_file_info* file_info, std::shared_ptr<File> file) {
+  file_info->fh = reinterpret_cast<std::uint64_t>(
+      new FileHandle(std::move(file), file_info->flags, file_info->direct_io != 0));
+}
+
+inline FileHandle* GetFileHandle(const struct fuse_file_info* file_info) {
+  return file_info == nullptr ? nullptr : reinterpret_cast<FileHandle*>(file_info->fh);
+}
+
+inline std::unique_ptr<FileHandle> TakeFileHandle(struct fuse_file_info* file_info) {
+  std::unique_ptr<FileHandle> handle(GetFileHandle(file_info));
+  file_info->fh = 0;
+  return handle;
+}
+
+// Serves a read on a direct_io handle.  The kernel splits such reads into requests far smaller
+// than a chunk, so rather than decrypting the same chunk for each of them, the chunk-aligned span
+// holding 'offset' is read once into the handle and later requests are copied from it.  Unlike the
+// page cache, this costs one span per open handle and is dropped with it.
+inline std::uint32_t StreamRead(FileHandle& handle, char* data, std::uint32_t length,
+                                std::uint64_t offset) {
+  const std::lock_guard<std::mutex> lock(handle.stream_mutex);
+  std::uint32_t copied(0);
+  while (copied < length) {
+    const std::uint64_t position(offset + copied);
+    if (handle.stream_write_count != handle.file->WriteCount() ||
+        position < handle.stream_offset ||
+        position >= handle.stream_offset + handle.stream_data.size()) {
+      const std::uint64_t stream_offset(position - (position % kOptimalIoSize));
+      handle.stream_write_count = handle.file->WriteCount();
+      handle.stream_data.resize(kOptimalIoSize);
+      handle.stream_data.resize(
+          handle.file->Read(handle.stream_data.data(), kOptimalIoSize, stream_offset));
+      handle.stream_offset = stream_offset;
+      if (position >= handle.stream_offset + handle.stream_data.size())
+        break;  // end of file
+    }
+    const auto available(handle.stream_offset + handle.stream_data.size() - position);
+    const auto count(static_cast<std::uint32_t>(
+        std::min<std::uint64_t>(length - copied, available)));
+    std::memcpy(data + copied, handle.stream_data.data() + (position - handle.stream_offset),
+                count);
+    copied += count;
+  }
+  return copied;
+}
+
+#if FUSE_VERSION >= 29
+// Writes the data described by 'buffers' to 'file' at 'offset' as one scatter-gather operation.
+// Memory-backed buffers are used in place; if any refers to a file descriptor (i.e. the data was
+// spliced from the kernel) the whole vector is first copied into memory.
+inline std::uint64_t WriteBuffers(File& file, struct fuse_bufvec& buffers, off_t offset) {
+  bool in_memory(true);
+  for (std::size_t i(buffers.idx); i < buffers.count; ++i)
+    in_memory = in_memory && !(buffers.buf[i].flags & FUSE_BUF_IS_FD);
+
+  std::vector<File::WriteSegment> segments;
+  std::vector<char> copy;
+  if (in_memory) {
+    segments.reserve(buffers.count - buffers.idx);
+    for (std::size_t i(buffers.idx); i < buffers.count; ++i) {
+      const std::size_t skip(i == buffers.idx ? buffers.off : 0);
+      segments.emplace_back(static_cast<const char*>(buffers.buf[i].mem) + skip,
+                            static_cast<std::uint32_t>(buffers.buf[i].size - skip));
+    }
+  } else {
+    copy.resize(fuse_buf_size(&buffers));
+    struct fuse_bufvec destination = FUSE_BUFVEC_INIT(copy.size());
+    destination.buf[0].mem = copy.data();
+    const auto copied(fuse_buf_copy(&destination, &buffers, fuse_buf_copy_flags(0)));
+    if (copied < 0)
+      BOOST_THROW_EXCEPTION(MakeError(CommonErrors::filesystem_io_error));
+    segments.emplace_back(copy.data(), static_cast<std::uint32_t>(copied));
+  }
+  return file.WriteV(segments, offset);
+}
+#endif
+
+// Asks the kernel for large writes and asynchronous reads, and accepts as much readahead as it
+// offers up to a chunk.  'max_write' is left at the largest size libfuse can buffer.
+inline void NegotiateConnection(struct fuse_conn_info* connection) {
+  connection->async_read = 1;
+#ifdef FUSE_CAP_ASYNC_READ
+  connection->want |= (connection->capable & FUSE_CAP_ASYNC_READ);
+#endif
+#ifdef FUSE_CAP_BIG_WRITES
+  connection->want |= (connection->capable & FUSE_CAP_BIG_WRITES);
+#endif
+#ifdef FUSE_CAP_AUTO_INVAL_DATA
+  // Lets the kernel keep file pages cached across opens, dropping them when a fresh getattr shows
+  // a changed size or mtime, e.g. after another client's change has been picked up.
+  connection->want |= (connection->capable & FUSE_CAP_AUTO_INVAL_DATA);
+#endif
+  connection->max_readahead =
+      std::min(connection->max_readahead, static_cast<unsigned>(kOptimalIoSize));
+  LOG(kInfo) << "Negotiated max_write " << connection->max_write << ", max_readahead "
+             << connection->max_readahead;
+}
+
+// Snapshot of a directory's entries, held in 'fuse_file_info::fh' by an open directory so that
+// concurrent listings of the same directory cannot disturb one another.
+typedef std::vector<std::pair<std::string, struct stat>> DirectoryListing;
+
+// Returns "." and ".." followed by the directory's children, gathered under a single acquisition
+// of the directory's lock.
+inline DirectoryListing ListDirectory(const Directory& directory,
+                                      const MetaData::Permissions base_permissions) {
+  const auto children(directory.GetChildren());
+  DirectoryListing listing;
+  listing.reserve(children.size() + 2);
+  struct stat attributes;
+  std::memset(&attributes, 0, sizeof(attributes));
+  attributes.st_mode = S_IFDIR;
+  listing.emplace_back(".", attributes);
+  listing.emplace_back("..", attributes);
+  for (const auto& child : children) {
+    const std::lock_guard<std::mutex> lock(child->meta_data_mutex);
+    listing.emplace_back(child->meta_data.name().string(),
+                         ToStat(child->meta_data, base_permissions));
+  }
+  return listing;
+}
+
+// Attributes gathered while listing directories, kept so that the getattr storm which usually
+// follows a listing ('ls -l', 'find', etc.) can be answered without walking each path again.
+// Entries expire after 'timeout' and must be erased by any operation which could change them.
+// Each erasure is also recorded for one timeout, so a listing snapshot taken before it can't
+// re-insert the attributes it invalidated.
+class AttributeCache {
+ public:
+  // Taken before a listing is read, and passed to the resulting inserts.
+  struct Epoch {
+    std::uint64_t generation;
+    std::chrono::steady_clock::time_point taken;
+  };
+
+  explicit AttributeCache(std::chrono::steady_clock::duration timeout)
+      : timeout_(timeout), mutex_(), entries_(), erasures_(), generation_(0),
+        oldest_generation_(0), hits_(0), misses_(0) {}
+
+  Epoch CurrentEpoch() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Epoch epoch = {generation_, std::chrono::steady_clock::now()};
+    return epoch;
+  }
+
+  // Dropped if 'relative_path', or a path above it, has been erased since 'epoch'.
+  void Insert(const boost::filesystem::path& relative_path, const struct stat& attributes,
+              const Epoch& epoch) {
+    if (timeout_ <= std::chrono::steady_clock::duration::zero())
+      return;
+    const auto now(std::chrono::steady_clock::now());
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (epoch.taken + timeout_ <= now || ErasedSince(relative_path, epoch.generation))
+      return;
+    if (entries_.size() >= kMaxEntries) {
+      for (auto itr(std::begin(entries_)); itr != std::end(entries_);)
+        itr = (itr->second.second <= now) ? entries_.erase(itr) : std::next(itr);
+      if (entries_.size() >= kMaxEntries)
+        entries_.clear();
+    }
+    entries_[relative_path.string()] = std::make_pair(attributes, now + timeout_);
+  }
+
+  bool Find(const boost::filesystem::path& relative_path, struct stat& attributes) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      const auto itr(entries_.find(relative_path.string()));
+      if (itr != std::end(entries_)) {
+        if (std::chrono::steady_clock::now() < itr->second.second) {
+          attributes = itr->second.first;
+          ++hits_;
+          return true;
+        }
+        entries_.erase(itr);
+      }
+    }
+    ++misses_;
+    return false;
+  }
+
+  // Erases 'relative_path' and everything below it, e.g. after a rename or removal.
+  void Erase(const boost::filesystem::path& relative_path) { DoErase(relative_path, true); }
+
+  // Erases 'relative_path' alone, e.g. a directory whose listing changed.
+  void EraseEntry(const boost::filesystem::path& relative_path) {
+    DoErase(relative_path, false);
+  }
+
+  std::uint64_t hits() const { return hits_; }
+  std::uint64_t misses() const { return misses_; }
+
+ private:
+  AttributeCache(const AttributeCache&);
+  AttributeCache& operator=(AttributeCache);
+
+  // The generations at which a path alone, and a path with its descendants, were last erased.
+  struct Erasure {
+    std::uint64_t generation, descendants_generation;
+    std::chrono::steady_clock::time_point expiry;
+  };
+
+  void DoErase(const boost::filesystem::path& relative_path, bool descendants) {
+    if (timeout_ <= std::chrono::steady_clock::duration::zero())
+      return;
+    std::string key(relative_path.string());
+    const auto now(std::chrono::steady_clock::now());
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (erasures_.size() >= kMaxEntries) {
+      for (auto itr(std::begin(erasures_)); itr != std::end(erasures_);)
+        itr = (itr->second.expiry <= now) ? erasures_.erase(itr) : std::next(itr);
+      // Forgetting unexpired erasures means rejecting every snapshot taken before them.
+      if (erasures_.size() >= kMaxEntries) {
+        erasures_.clear();
+        oldest_generation_ = generation_ + 1;
+      }
+    }
+    auto& erasure(erasures_[key]);
+    erasure.generation = ++generation_;
+    if (descendants)
+      erasure.descendants_generation = generation_;
+    erasure.expiry = now + timeout_;
+    if (entries_.empty())
+      return;
+    entries_.erase(key);
+    if (!descendants)
+      return;
+    if (key.empty() || key.back() != '/')
+      key += '/';
+    // '0' sorts immediately after '/'.
+    entries_.erase(entries_.lower_bound(key),
+                   entries_.lower_bound(key.substr(0, key.size() - 1) + '0'));
+  }
+
+  bool ErasedSince(const boost::filesystem::path& relative_path, std::uint64_t generation) const {
+    if (generation < oldest_generation_)
+      return true;
+    bool self(true);
+    for (auto path(relative_path); !path.empty(); path = path.parent_path(), self = false) {
+      const auto itr(erasures_.find(path.string()));
+      if (itr != std::end(erasures_) &&
+          (self ? itr->second.generation : itr->second.descendants_generation) > generation) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static const std::size_t kMaxEntries = 1 << 17;
+  const std::chrono::steady_clock::duration timeout_;
+  std::mutex mutex_;
+  std::map<std::string, std::pair<struct stat, std::chrono::steady_clock::time_point>> entries_;
+  std::map<std::string, Erasure> erasures_;
+  std::uint64_t generation_, oldest_generation_;
+  std::atomic<std::uint64_t> hits_, misses_;
+};
+
+// Per-opendir state for the path-based frontend.
+struct DirectoryHandle {
+  explicit DirectoryHandle(DirectoryListing listing_in)
+      : listing(std::move(listing_in)), served(false) {}
+  DirectoryListing listing;
+  // Set once entries have been handed out; a further read from offset 0 (i.e. after rewinddir())
+  // takes a fresh snapshot.
+  bool served;
+};
+
+// Equivalent of fuse_session_loop(), but safe to run concurrently on several threads sharing the
+// one session.  Returns once the session has exited or the channel has been closed by an unmount.
+inline void ProcessRequests(struct fuse_session* session) {
+  struct fuse_chan* const channel(fuse_session_next_chan(session, nullptr));
+  std::vector<char> buffer(fuse_chan_bufsize(channel));
+  while (!fuse_session_exited(session)) {
+    struct fuse_chan* receiving_channel(channel);
+    const int result(fuse_chan_recv(&receiving_channel, &buffer[0], buffer.size()));
+    if (result == -EINTR)
+      continue;
+    if (result <= 0) {
+      if (result < 0 && result != -ENODEV)
+        LOG(kError) << "Failed to receive FUSE request: " << -result;
+      break;
+    }
+    fuse_session_process(session, &buffer[0], result, receiving_channel);
+  }
+  fuse_session_exit(session);
+}
+
+// Services requests on 'worker_count' threads, including the calling one.  The extra threads are
+// appended to 'workers' and must be joined once the channel has been unmounted.
+inline void RunWorkers(struct fuse_session* session, unsigned worker_count,
+                       std::vector<std::thread>& workers) {
+  LOG(kInfo) << "Servicing requests on " << worker_count << " threads.";
+  {
+    // Keep the signals handled by fuse_set_signal_handlers() off the extra workers, so they reach
+    // this thread and interrupt its receive.
+    sigset_t signals, original_signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &original_signals);
+    on_scope_exit restore_signals(
+        [&] { pthread_sigmask(SIG_SETMASK, &original_signals, nullptr); });
+    for (unsigned i(1); i < worker_count; ++i)
+      workers.emplace_back([session] { ProcessRequests(session); });
+  }
+  ProcessRequests(session);
+}
+
 }  // namespace detail
 
+// How long, in seconds, the kernel may cache names, attributes and failed lookups.  Longer timeouts
+// save round trips into the drive at the cost of noticing changes made elsewhere later.
+struct FuseCacheTimeouts {
+  FuseCacheTimeouts() : entry(1.0), attr(1.0), negative(0.0) {}
+  FuseCacheTimeouts(double entry_in, double attr_in, double negative_in)
+      : entry(entry_in), attr(attr_in), negative(negative_in) {}
+  double entry, attr, negative;
+};
+
+// Chooses the files opened with 'direct_io', which bypasses the kernel page cache.  This suits
+// very large files streamed once, such as media or backups, whose pages would otherwise be held in
+// both the page cache and the drive's own buffers.  Such files can't be shared-mmap'd on older
+// kernels.  A file opened with O_DIRECT is always selected.
+struct DirectIoPolicy {
+  DirectIoPolicy() : min_size(0), patterns() {}
+  // 'patterns_in' is a comma-separated list.
+  DirectIoPolicy(std::uint64_t min_size_in, const std::string& patterns_in)
+      : min_size(min_size_in), patterns() {
+    std::istringstream stream(patterns_in);
+    std::string pattern;
+    while (std::getline(stream, pattern, ','))
+      if (!pattern.empty())
+        patterns.push_back(pattern);
+  }
+
+  bool Selects(const boost::filesystem::path& name, std::uint64_t size, int open_flags) const {
+#ifdef O_DIRECT
+    if (open_flags & O_DIRECT)
+      return true;
+#else
+    static_cast<void>(open_flags);
+#endif
+    if (min_size != 0 && size >= min_size)
+      return true;
+    const std::string filename(name.filename().string());
+    return std::any_of(std::begin(patterns), std::end(patterns), [&](const std::string& pattern) {
+      return fnmatch(pattern.c_str(), filename.c_str(), 0) == 0;
+    });
+  }
+
+  // Files at least this large when opened are selected; 0 disables this rule.
+  std::uint64_t min_size;
+  // Shell wildcard patterns (see fnmatch(3)) matched against the file's name.
+  std::vector<std::string> patterns;
+};
+
 template <typename Storage>
 class FuseDrive : public Drive<Storage> {
  public:
   FuseDrive(std::shared_ptr<Storage> storage, const Identity& unique_user_id,
             const Identity& root_parent_id, const boost::filesystem::path& mount_dir,
             const boost::filesystem::path& user_app_dir, const boost::filesystem::path& drive_name,
-            std::string mount_status_shared_object_name, bool create);
+            std::string mount_status_shared_object_name, bool create, unsigned worker_count = 1,
+            const FuseCacheTimeouts& cache_timeouts = FuseCacheTimeouts(),
+            const DirectIoPolicy& direct_io_policy = DirectIoPolicy(),
+            std::uint64_t chunk_cache_size = detail::kDefaultChunkCacheSize,
+            bool write_behind = false);
 
   virtual ~FuseDrive();
 
+  const detail::AttributeCache& attribute_cache() const { return attribute_cache_; }
+
  private:
   FuseDrive(const FuseDrive&);
   FuseDrive(FuseDrive&&);
@@ -204,6 +610,7 @@ class FuseDrive : public Drive<Storage> {
 
   virtual void DoMount() override;
   virtual void DoUnmount() override;
+  virtual void InvalidateRemoteChanges(const std::vector<detail::RemoteChange>& changes) override;
 
   static int OpsAccess(const char* path, int mask);
   static int OpsChmod(const char* path, mode_t mode);
@@ -240,6 +647,10 @@ class FuseDrive : public Drive<Storage> {
   static int OpsUtimens(const char* path, const struct timespec ts[2]);
   static int OpsWrite(const char* path, const char* buf, size_t size, off_t offset,
                       struct fuse_file_info* file_info);
+#if FUSE_VERSION >= 29
+  static int OpsWriteBuf(const char* path, struct fuse_bufvec* buf, off_t offset,
+                         struct fuse_file_info* file_info);
+#endif
 
 // We can set extended attribute for our own purposes, i.e. if we wanted to store extra info
 // (revisions for instance) then we can do it here.
@@ -251,17 +662,27 @@ class FuseDrive : public Drive<Storage> {
 //                         int flags);
 #endif  // HAVE_SETXATTR
 
-  static int CreateFile(const fs::path& target, mode_t);
+  static int CreateFile(const fs::path& target, mode_t,
+                        struct fuse_file_info* file_info = nullptr);
   static int CreateDirectory(const fs::path& target, mode_t);
   static int CreateSymlink(const fs::path& target, const fs::path& source);
   static int GetAttributes(const char* path, struct stat* stbuf);
-  static int Truncate(const char* path, off_t size);
+  static detail::DirectoryListing ListDirectory(const char* path);
+  static void InvalidateAttributes(const fs::path& relative_path, bool include_parent);
+  static int Truncate(const char* path, off_t size, struct fuse_file_info* file_info = nullptr);
+  static std::shared_ptr<detail::File> GetOpenFile(const char* path,
+                                                   struct fuse_file_info* file_info);
 
   static struct fuse_operations maidsafe_ops_;
   struct fuse* fuse_;
   fuse_chan* fuse_channel_;
   fs::path fuse_mountpoint_;
   std::string drive_name_;
+  const unsigned worker_count_;
+  const FuseCacheTimeouts cache_timeouts_;
+  const DirectIoPolicy direct_io_policy_;
+  detail::AttributeCache attribute_cache_;
+  std::vector<std::thread> workers_;
   std::once_flag mounted_once_flag_;
   std::thread unmount_ipc_waiter_;
 };
@@ -280,13 +701,23 @@ FuseDrive<Storage>::FuseDrive(std::shared_ptr<Storage> storage, const Identity&
                               const boost::filesystem::path& mount_dir,
                               const boost::filesystem::path& user_app_dir,
                               const boost::filesystem::path& drive_name,
-                              std::string mount_status_shared_object_name, bool create)
+                              std::string mount_status_shared_object_name, bool create,
+                              unsigned worker_count, const FuseCacheTimeouts& cache_timeouts,
+                              const DirectIoPolicy& direct_io_policy,
+                              std::uint64_t chunk_cache_size, bool write_behind)
     : Drive<Storage>(storage, unique_user_id, root_parent_id, mount_dir, user_app_dir,
-                     std::move(mount_status_shared_object_name), create),
+                     std::move(mount_status_shared_object_name), create, chunk_cache_size,
+                     write_behind),
       fuse_(nullptr),
       fuse_channel_(nullptr),
       fuse_mountpoint_(mount_dir),
       drive_name_(drive_name.string()),
+      worker_count_(std::max(worker_count, 1U)),
+      cache_timeouts_(cache_timeouts),
+      direct_io_policy_(direct_io_policy),
+      attribute_cache_(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<double>(cache_timeouts.attr))),
+      workers_(),
       mounted_once_flag_(),
       unmount_ipc_waiter_() {
   fs::create_directory(fuse_mountpoint_);
@@ -311,8 +742,8 @@ void FuseDrive<Storage>::Init() {
   maidsafe_ops_.destroy = OpsDestroy;
   maidsafe_ops_.fgetattr = OpsFgetattr;
   maidsafe_ops_.flush = OpsFlush;
-  //  maidsafe_ops_.fsync = OpsFsync;
-  //  maidsafe_ops_.fsyncdir = OpsFsyncDir;
+  maidsafe_ops_.fsync = OpsFsync;
+  maidsafe_ops_.fsyncdir = OpsFsyncDir;
   maidsafe_ops_.ftruncate = OpsFtruncate;
   maidsafe_ops_.getattr = OpsGetattr;
   maidsafe_ops_.init = OpsInit;
@@ -335,6 +766,9 @@ void FuseDrive<Storage>::Init() {
   maidsafe_ops_.unlink = OpsUnlink;
   maidsafe_ops_.utimens = OpsUtimens;
   maidsafe_ops_.write = OpsWrite;
+#if FUSE_VERSION >= 29
+  maidsafe_ops_.write_buf = OpsWriteBuf;
+#endif
 
 #ifdef HAVE_SETXATTR
   maidsafe_ops_.getxattr = OpsGetxattr;
@@ -374,13 +808,20 @@ void FuseDrive<Storage>::DoMount() {
   // NB - If we remove -odefault_permissions, we must check in OpsOpen, etc. that the operation is
   //      permitted for the given flags.  We also need to implement OpsAccess.
   fuse_opt_add_arg(&args, "-odefault_permissions,kernel_cache");
+  std::ostringstream timeouts_arg;
+  timeouts_arg.imbue(std::locale::classic());
+  timeouts_arg << "-oentry_timeout=" << cache_timeouts_.entry
+               << ",attr_timeout=" << cache_timeouts_.attr
+               << ",negative_timeout=" << cache_timeouts_.negative;
+  fuse_opt_add_arg(&args, timeouts_arg.str().c_str());
 #ifndef NDEBUG
 // fuse_opt_add_arg(&args, "-d");  // print debug info
 // fuse_opt_add_arg(&args, "-f");  // run in foreground
 #endif
   // TODO(Fraser#5#): 2014-01-08 - BEFORE_RELEASE Avoid running in foreground.
   fuse_opt_add_arg(&args, "-f");  // run in foreground
-  fuse_opt_add_arg(&args, "-s");  // run single threaded
+  if (worker_count_ == 1)
+    fuse_opt_add_arg(&args, "-s");  // run single threaded
 
   // tag the volume as "local" to make it appear on the Desktop and in Finder's sidebar.
   // fuse_opt_add_arg(&args, "-olocal");
@@ -411,8 +852,8 @@ void FuseDrive<Storage>::DoMount() {
     BOOST_THROW_EXCEPTION(MakeError(DriveErrors::failed_to_mount));
 
   if (multithreaded) {
-    if (fuse_loop_mt(fuse_) == -1)
-      BOOST_THROW_EXCEPTION(MakeError(DriveErrors::failed_to_mount));
+    // fuse_loop_mt() gives no control over the number of threads it spawns, so run our own pool.
+    detail::RunWorkers(fuse_get_session(fuse_), worker_count_, workers_);
   } else {
     if (fuse_loop(fuse_) == -1)
       BOOST_THROW_EXCEPTION(MakeError(DriveErrors::failed_to_mount));
@@ -428,9 +869,17 @@ void FuseDrive<Storage>::DoUnmount() {
     std::call_once(this->unmounted_once_flag_, [&] {
       if (fuse_) {
         fuse_remove_signal_handlers(fuse_get_session(fuse_));
-        fuse_unmount(fuse_mountpoint_.c_str(), fuse_channel_);
+        fuse_session_exit(fuse_get_session(fuse_));
+        // The channel is left for fuse_destroy() to release, since workers may still be using it.
+        // Unmounting wakes any of them blocked on it; none may run once fuse_ is gone.
+        fuse_unmount(fuse_mountpoint_.c_str(), nullptr);
+        for (auto& worker : workers_)
+          worker.join();
+        workers_.clear();
         fuse_destroy(fuse_);
         this->directory_handler_->StoreAll();
+        LOG(kInfo) << "Attribute cache: " << attribute_cache_.hits() << " hits, "
+                   << attribute_cache_.misses() << " misses.";
       }
     });
   } catch (const std::exception& e) {
@@ -483,7 +932,7 @@ int FuseDrive<Storage>::OpsChown(const char* path, uid_t, gid_t) {
 // and open() methods will be called instead.
 template <typename Storage>
 int FuseDrive<Storage>::OpsCreate(const char* path, mode_t mode,
-                                  struct fuse_file_info* /*file_info*/) {
+                                  struct fuse_file_info* file_info) {
   LOG(kInfo) << "OpsCreate: " << path << " (" << detail::GetFileType(mode)
              << "), mode: " << std::oct << mode;
   switch (detail::ToFileType(mode)) {
@@ -493,7 +942,7 @@ int FuseDrive<Storage>::OpsCreate(const char* path, mode_t mode,
     case fs::directory_file:
       return Global<Storage>::g_fuse_drive->CreateDirectory(path, mode);
     case fs::regular_file:
-      return Global<Storage>::g_fuse_drive->CreateFile(path, mode);
+      return Global<Storage>::g_fuse_drive->CreateFile(path, mode, file_info);
     default:
       return -EPERM;
   }
@@ -519,9 +968,14 @@ void FuseDrive<Storage>::OpsDestroy(void* /*fuse*/) {
 // it may be called for invocations of fstat() too.
 template <typename Storage>
 int FuseDrive<Storage>::OpsFgetattr(const char* path, struct stat* stbuf,
-                                    struct fuse_file_info* /*file_info*/) {
+                                    struct fuse_file_info* file_info) {
   LOG(kInfo) << "OpsFgetattr: " << path;
-  return GetAttributes(path, stbuf);
+  const auto handle(detail::GetFileHandle(file_info));
+  if (handle == nullptr)
+    return GetAttributes(path, stbuf);
+  *stbuf =
+      detail::ToStat(*handle->file, Global<Storage>::g_fuse_drive->get_base_file_permissions());
+  return 0;
 }
 
 // Quote from FUSE documentation:
@@ -545,7 +999,15 @@ template <typename Storage>
 int FuseDrive<Storage>::OpsFlush(const char* path, struct fuse_file_info* file_info) {
   LOG(kInfo) << "OpsFlush: " << path << ", flags: " << file_info->flags;
   try {
-    Global<Storage>::g_fuse_drive->GetMutableContext(path)->ScheduleForStoring();
+    const auto file(GetOpenFile(path, file_info));
+    file->ScheduleForStoring();
+    try {
+      file->Flush();
+    } catch (const std::exception& e) {
+      // A write acknowledged in write-behind mode never reached the encryptor.
+      LOG(kError) << "OpsFlush: " << fs::path(path) << ": " << e.what();
+      return -EIO;
+    }
   } catch (const drive_error& error) {
     LOG(kError) << "OpsFlush: " << fs::path(path) << ": " << error.what();
     return (error.code() == make_error_code(DriveErrors::no_such_file)) ? -EINVAL : -EBADF;
@@ -556,37 +1018,32 @@ int FuseDrive<Storage>::OpsFlush(const char* path, struct fuse_file_info* file_i
   return 0;
 }
 
-/*
 // Quote from FUSE documentation:
 //
 // Synchronize file contents
 //
 // If the datasync parameter is non-zero, then only the user data should be flushed, not the meta
 // data.
+//
+// The data map is the metadata which makes the user data reachable, so datasync is treated as a
+// full sync.
 template <typename Storage>
 int FuseDrive<Storage>::OpsFsync(const char* path, int isdatasync,
                                  struct fuse_file_info* file_info) {
-  LOG(kInfo) << "OpsFsync: " << path;
-  detail::File<Storage>* file_context(detail::RecoverFile<Storage>(file_info));
-  if (!file_context)
-    return -EINVAL;
-
-  // if (!detail::ForceFlush(Global<Storage>::g_fuse_drive->directory_handler_, file_context)) {
-  //   //    int result(Update(Global<Storage>::g_fuse_drive->directory_handler_,
-  //   //                      file_context,
-  //   //                      false,
-  //   //                      (isdatasync == 0)));
-  //   //    if (result != kSuccess) {
-  //   //      LOG(kError) << "OpsFsync: " << path << ", failed to update "
-  //   //                  << "metadata.  Result: " << result;
-  //   //      return -EIO;
-  //   //    }
-  // }
+  LOG(kInfo) << "OpsFsync: " << path << ", datasync: " << isdatasync;
+  try {
+    const auto file(GetOpenFile(path, file_info));
+    Global<Storage>::g_fuse_drive->SyncFile(*file);
+  } catch (const drive_error& error) {
+    LOG(kError) << "OpsFsync: " << fs::path(path) << ": " << error.what();
+    return (error.code() == make_error_code(DriveErrors::no_such_file)) ? -ENOENT : -EIO;
+  } catch (const std::exception& e) {
+    LOG(kError) << "OpsFsync: " << fs::path(path) << ": " << e.what();
+    return -EIO;
+  }
   return 0;
 }
-*/
 
-/*
 // Quote from FUSE documentation:
 //
 // Synchronize directory contents.
@@ -595,24 +1052,19 @@ int FuseDrive<Storage>::OpsFsync(const char* path, int isdatasync,
 // data
 template <typename Storage>
 int FuseDrive<Storage>::OpsFsyncDir(const char* path, int isdatasync,
-                                    struct fuse_file_info* file_info) {
-  LOG(kInfo) << "OpsFsyncDir: " << path;
-  detail::File<Storage>* file_context(detail::RecoverFile<Storage>(file_info));
-  if (!file_context)
-    return -EINVAL;
-
-  //  int result(Update(Global<Storage>::g_fuse_drive->directory_handler_,
-  //                    file_context,
-  //                    false,
-  //                    (isdatasync == 0)));
-  //  if (result != kSuccess) {
-  //    LOG(kError) << "OpsFsyncDir: " << path << ", failed to update "
-  //                << "metadata.  Result: " << result;
-  //    return -EIO;
-  //  }
+                                    struct fuse_file_info* /*file_info*/) {
+  LOG(kInfo) << "OpsFsyncDir: " << path << ", datasync: " << isdatasync;
+  try {
+    Global<Storage>::g_fuse_drive->SyncDirectory(path);
+  } catch (const drive_error& error) {
+    LOG(kError) << "OpsFsyncDir: " << fs::path(path) << ": " << error.what();
+    return (error.code() == make_error_code(DriveErrors::no_such_file)) ? -ENOENT : -EIO;
+  } catch (const std::exception& e) {
+    LOG(kError) << "OpsFsyncDir: " << fs::path(path) << ": " << e.what();
+    return -EIO;
+  }
   return 0;
 }
-*/
 
 // Quote from FUSE documentation:
 //
@@ -625,9 +1077,9 @@ int FuseDrive<Storage>::OpsFsyncDir(const char* path, int isdatasync,
 // truncate() method will be called instead.
 template <typename Storage>
 int FuseDrive<Storage>::OpsFtruncate(const char* path, off_t size,
-                                     struct fuse_file_info* /*file_info*/) {
+                                     struct fuse_file_info* file_info) {
   LOG(kInfo) << "OpsFtruncate: " << path << ", size: " << size;
-  return Truncate(path, size);
+  return Truncate(path, size, file_info);
 }
 
 // Quote from FUSE documentation:
@@ -639,6 +1091,8 @@ int FuseDrive<Storage>::OpsFtruncate(const char* path, off_t size,
 template <typename Storage>
 int FuseDrive<Storage>::OpsGetattr(const char* path, struct stat* stbuf) {
   LOG(kInfo) << "OpsGetattr: " << path;
+  if (Global<Storage>::g_fuse_drive->attribute_cache_.Find(path, *stbuf))
+    return 0;
   return GetAttributes(path, stbuf);
 }
 
@@ -649,7 +1103,8 @@ int FuseDrive<Storage>::OpsGetattr(const char* path, struct stat* stbuf) {
 // The return value will passed in the private_data field of fuse_context to all file operations and
 // as a parameter to the destroy() method.
 template <typename Storage>
-void* FuseDrive<Storage>::OpsInit(struct fuse_conn_info* /*conn*/) {
+void* FuseDrive<Storage>::OpsInit(struct fuse_conn_info* conn) {
+  detail::NegotiateConnection(conn);
   Global<Storage>::g_fuse_drive->SetMounted();
   return nullptr;
 }
@@ -752,21 +1207,23 @@ int FuseDrive<Storage>::OpsOpen(const char* path, struct fuse_file_info* file_in
     return -ELOOP;
   }
 
-  // TODO(Fraser#5#): 2013-11-26 - Investigate option to use direct IO for some/all files.
-
   assert(!(file_info->flags & O_DIRECTORY));
   try {
     auto file = Global<Storage>::g_fuse_drive->template GetMutableContext<detail::File>(path);
     if (file != nullptr) {
+      std::uint64_t size(0);
+      {
+        const std::lock_guard<std::mutex> lock(file->meta_data_mutex);
+        size = file->meta_data.size();
+      }
+      file_info->direct_io =
+          Global<Storage>::g_fuse_drive->direct_io_policy_.Selects(path, size, file_info->flags);
       Global<Storage>::g_fuse_drive->Open(*file);
+      detail::SetFileHandle(file_info, file);
 
-      // Safe to allow the kernel to cache the file assuming it doesn't change "spontaneously".  For
-      // us,
-      // that presumably can happen on files which are part of a share, or if a user has >1 client
-      // instance, each with this file open.  To handle this, we need to either avoid allowing the
-      // kernel caching (set 'file_info->keep_cache' to 0), or preferrably use the low-level FUSE
-      // interface and if a file changes in the background, call fuse_lowlevel_notify_inval_inode().
-      // See http://fuse.996288.n3.nabble.com/fuse-file-info-keep-cache-usage-guidelines-td5130.html
+      // Safe to allow the kernel to cache the file: changes by other clients are picked up by the
+      // drive's remote change watcher, after which the kernel drops stale pages (see
+      // NegotiateConnection() and InvalidateRemoteChanges()).
       file_info->keep_cache = 1;
       return 0;
     }
@@ -798,6 +1255,8 @@ int FuseDrive<Storage>::OpsOpendir(const char* path, struct fuse_file_info* file
     const auto context = Global<Storage>::g_fuse_drive->GetContext(path);
     assert(context != nullptr);
     if (context->meta_data.file_type() == detail::MetaData::FileType::directory_file) {
+      file_info->fh = reinterpret_cast<std::uint64_t>(
+          new detail::DirectoryHandle(ListDirectory(path)));
       return 0;
     }
   } catch (const std::exception& e) {
@@ -821,13 +1280,17 @@ int FuseDrive<Storage>::OpsRead(const char* path, char* buf, size_t size, off_t
   LOG(kInfo) << "OpsRead: " << path << ", flags: 0x" << std::hex << file_info->flags << std::dec
              << " Size : " << size << " Offset : " << offset;
   try {
-    const auto file = Global<Storage>::g_fuse_drive->template GetMutableContext<detail::File>(path);
+    const auto file(GetOpenFile(path, file_info));
     if (file != nullptr) {
       static_assert(unsigned(std::numeric_limits<int>::max()) <=
                         std::numeric_limits<std::size_t>::max(),
                     "expected size_t::max to be greater than int max");
       const std::size_t read_size = std::min<std::size_t>(std::numeric_limits<int>::max(), size);
-      return int(file->Read(buf, read_size, offset));
+      const auto handle(detail::GetFileHandle(file_info));
+      const auto bytes_read(handle != nullptr && handle->direct_io
+                                ? detail::StreamRead(*handle, buf, read_size, offset)
+                                : file->Read(buf, read_size, offset));
+      return int(bytes_read);
     }
   } catch (const std::exception& e) {
     LOG(kWarning) << "Failed to read " << path << ": " << e.what();
@@ -851,38 +1314,32 @@ int FuseDrive<Storage>::OpsRead(const char* path, char* buf, size_t size, off_t
 // full (or an error happens) the filler function will return '1'.
 template <typename Storage>
 int FuseDrive<Storage>::OpsReaddir(const char* path, void* buf, fuse_fill_dir_t filler,
-                                   off_t offset, struct fuse_file_info* /*file_info*/) {
+                                   off_t offset, struct fuse_file_info* file_info) {
   LOG(kInfo) << "OpsReaddir: " << path << "; offset = " << offset;
-
-  filler(buf, ".", nullptr, 0);
-  filler(buf, "..", nullptr, 0);
-  std::shared_ptr<detail::Directory> directory;
-  try {
-    directory =
-        Global<Storage>::g_fuse_drive->directory_handler_->template Get<detail::Directory>(path);
-  } catch (const std::exception& e) {
-    LOG(kError) << "OpsReaddir: " << path << ", can't get directory: " << e.what();
+  if (offset < 0)
+    return -EINVAL;
+  auto handle(reinterpret_cast<detail::DirectoryHandle*>(file_info->fh));
+  if (handle == nullptr)
     return -EBADF;
-  }
-  assert(directory);
 
-  // TODO(Fraser#5#): 2011-05-18 - Handle offset properly.
-  if (offset == 0)
-    directory->ResetChildrenCounter();
+  if (offset == 0 && handle->served) {
+    try {
+      handle->listing = ListDirectory(path);
+    } catch (const std::exception& e) {
+      LOG(kError) << "OpsReaddir: " << path << ", can't get directory: " << e.what();
+      return -EBADF;
+    }
+  }
+  handle->served = true;
 
-  auto file(directory->GetChildAndIncrementCounter());
-  while (file) {
-    struct stat attributes =
-        ToStat(file->meta_data, Global<Storage>::g_fuse_drive->get_base_file_permissions());
-    if (filler(buf, file->meta_data.name().c_str(), &attributes, 0))
+  // Each entry's offset is that of the one following it, so the kernel resumes from there.
+  const auto& listing(handle->listing);
+  for (auto index(static_cast<std::size_t>(offset)); index < listing.size(); ++index) {
+    if (filler(buf, listing[index].first.c_str(), &listing[index].second,
+               static_cast<off_t>(index + 1))) {
       break;
-    file = directory->GetChildAndIncrementCounter();
+    }
   }
-
-  //  if (file_context) {
-  //    file_context->content_changed = true;
-  //    time(&file_context->meta_data->attributes.st_atime);
-  //  }
   return 0;
 }
 
@@ -935,7 +1392,8 @@ template <typename Storage>
 int FuseDrive<Storage>::OpsRelease(const char* path, struct fuse_file_info* file_info) {
   LOG(kInfo) << "OpsRelease: " << path << ", flags: " << file_info->flags;
   try {
-    const auto file = Global<Storage>::g_fuse_drive->template GetMutableContext<detail::File>(path);
+    const auto file(GetOpenFile(path, file_info));
+    detail::TakeFileHandle(file_info);
     if (file != nullptr) {
       file->Close();
       return 0;
@@ -953,12 +1411,8 @@ int FuseDrive<Storage>::OpsRelease(const char* path, struct fuse_file_info* file
 template <typename Storage>
 int FuseDrive<Storage>::OpsReleasedir(const char* path, struct fuse_file_info* file_info) {
   LOG(kInfo) << "OpsReleasedir: " << path << ", flags: " << file_info->flags;
-  try {
-    Global<Storage>::g_fuse_drive->ReleaseDir(path);
-  } catch (const std::exception& e) {
-    LOG(kError) << "OpsReleasedir: " << path << ": " << e.what();
-    return -EBADF;
-  }
+  delete reinterpret_cast<detail::DirectoryHandle*>(file_info->fh);
+  file_info->fh = 0;
   return 0;
 }
 
@@ -970,6 +1424,8 @@ int FuseDrive<Storage>::OpsRename(const char* old_name, const char* new_name) {
   LOG(kInfo) << "OpsRename: " << old_name << " to " << new_name;
   try {
     Global<Storage>::g_fuse_drive->Rename(old_name, new_name);
+    InvalidateAttributes(old_name, true);
+    InvalidateAttributes(new_name, true);
   } catch (const std::exception& e) {
     LOG(kError) << "Failed to rename " << old_name << " to " << new_name << ": " << e.what();
     //     switch (result) {
@@ -996,6 +1452,7 @@ int FuseDrive<Storage>::OpsRmdir(const char* path) {
   LOG(kInfo) << "OpsRmdir: " << path;
   try {
     Global<Storage>::g_fuse_drive->Delete(path);
+    InvalidateAttributes(path, true);
   } catch (const std::exception&) {
     return -EIO;
   }
@@ -1012,11 +1469,11 @@ int FuseDrive<Storage>::OpsStatfs(const char* path, struct statvfs* stbuf) {
   LOG(kInfo) << "OpsStatfs: " << path;
 
   // Although POSIX states that there is no correspondence between st_blksize and
-  // f_bsize, we set them the the same value for convenience.
-  stbuf->f_bsize = detail::kFileBlockSize;
+  // f_bsize, we set them the the same value for convenience.  Block counts are in f_frsize units.
+  stbuf->f_bsize = detail::kOptimalIoSize;
   stbuf->f_frsize = detail::kFileBlockSize;
   stbuf->f_blocks = (std::numeric_limits<int64_t>::max() - 10000) / stbuf->f_frsize;
-  stbuf->f_bfree = (std::numeric_limits<int64_t>::max() - 10000) / stbuf->f_bsize;
+  stbuf->f_bfree = (std::numeric_limits<int64_t>::max() - 10000) / stbuf->f_frsize;
   stbuf->f_bavail = stbuf->f_bfree;
   /*
   stbuf->f_files = 0;    // # inodes
@@ -1057,6 +1514,7 @@ int FuseDrive<Storage>::OpsUnlink(const char* path) {
   LOG(kInfo) << "OpsUnlink: " << path;
   try {
     Global<Storage>::g_fuse_drive->Delete(path);
+    InvalidateAttributes(path, true);
   } catch (const std::exception&) {
     return -EIO;
   }
@@ -1076,6 +1534,7 @@ int FuseDrive<Storage>::OpsUtimens(const char* path, const struct timespec ts[2]
   try {
     file = Global<Storage>::g_fuse_drive->GetMutableContext(path);
 
+    const std::lock_guard<std::mutex> lock(file->meta_data_mutex);
     file->meta_data.set_last_access_time(detail::ToTimePoint(ts[0]));
     file->meta_data.set_last_write_time(detail::ToTimePoint(ts[1]));
     file->meta_data.set_status_time(common::Clock::now());
@@ -1083,6 +1542,7 @@ int FuseDrive<Storage>::OpsUtimens(const char* path, const struct timespec ts[2]
     LOG(kWarning) << "Failed to change times for " << path << ": " << e.what();
     return -ENOENT;
   }
+  InvalidateAttributes(path, false);
 
   file->ScheduleForStoring();
   return 0;
@@ -1104,14 +1564,17 @@ int FuseDrive<Storage>::OpsWrite(const char* path, const char* buf, size_t size,
     return -EINVAL;
   }
 
+  const detail::ScopedLatency latency(Global<Storage>::g_fuse_drive->write_latency_);
   try {
-    const auto file = Global<Storage>::g_fuse_drive->template GetMutableContext<detail::File>(path);
+    const auto file(GetOpenFile(path, file_info));
     if (file != nullptr) {
       static_assert(unsigned(std::numeric_limits<int>::max()) <=
                         std::numeric_limits<std::size_t>::max(),
                     "expected size_t::max to be greater than int max");
       const unsigned write_length = std::min<std::size_t>(std::numeric_limits<int>::max(), size);
-      return int(file->Write(buf, write_length, offset));
+      const auto bytes_written(file->Write(buf, write_length, offset));
+      InvalidateAttributes(path, false);
+      return int(bytes_written);
     }
   } catch (const std::exception& e) {
     LOG(kWarning) << "Failed to write " << path << ": " << e.what();
@@ -1119,6 +1582,38 @@ int FuseDrive<Storage>::OpsWrite(const char* path, const char* buf, size_t size,
   return -EINVAL;
 }
 
+#if FUSE_VERSION >= 29
+// Quote from FUSE documentation:
+//
+// Write contents of buffer to an open file.
+//
+// Similar to the write() method, but data is supplied in a generic buffer.  Use fuse_buf_copy() to
+// transfer data to the destination.
+template <typename Storage>
+int FuseDrive<Storage>::OpsWriteBuf(const char* path, struct fuse_bufvec* buf, off_t offset,
+                                    struct fuse_file_info* file_info) {
+  LOG(kInfo) << "OpsWriteBuf: " << path << ", flags: 0x" << std::hex << file_info->flags
+             << std::dec << " Size : " << fuse_buf_size(buf) << " Offset : " << offset;
+
+  if (offset < 0) {
+    return -EINVAL;
+  }
+
+  const detail::ScopedLatency latency(Global<Storage>::g_fuse_drive->write_latency_);
+  try {
+    const auto file(GetOpenFile(path, file_info));
+    if (file != nullptr) {
+      const auto bytes_written(detail::WriteBuffers(*file, *buf, offset));
+      InvalidateAttributes(path, false);
+      return int(bytes_written);
+    }
+  } catch (const std::exception& e) {
+    LOG(kWarning) << "Failed to write " << path << ": " << e.what();
+  }
+  return -EINVAL;
+}
+#endif
+
 #ifdef HAVE_SETXATTR
 int FuseDrive<Storage>::OpsGetxattr(const char* path, const char* name, char* value, size_t size) {
   LOG(kInfo) << "OpsGetxattr: " << path;
@@ -1175,6 +1670,7 @@ int FuseDrive<Storage>::CreateSymlink(const fs::path& target, const fs::path& so
   try {
     auto symlink = detail::Symlink::Create(target.filename(), source.filename());
     Global<Storage>::g_fuse_drive->Create(target, symlink);
+    InvalidateAttributes(target, true);
   } catch (const std::exception& e) {
     LOG(kError) << "CreateSymlink: " << source << " -> " << target << ": " << e.what();
     return -EIO;
@@ -1192,6 +1688,7 @@ int FuseDrive<Storage>::CreateDirectory(const fs::path& target, mode_t mode) {
     auto fuse = Global<Storage>::g_fuse_drive;
     auto directory = detail::File::Create(fuse->asio_service_.service(), target.filename(), true);
     fuse->Create(target, directory);
+    InvalidateAttributes(target, true);
   } catch (const std::exception& e) {
     LOG(kError) << "CreateDirectory: " << target << ": " << e.what();
     return -EIO;
@@ -1200,7 +1697,8 @@ int FuseDrive<Storage>::CreateDirectory(const fs::path& target, mode_t mode) {
 }
 
 template <typename Storage>
-int FuseDrive<Storage>::CreateFile(const fs::path& target, mode_t mode) {
+int FuseDrive<Storage>::CreateFile(const fs::path& target, mode_t mode,
+                                   struct fuse_file_info* file_info) {
   if (detail::ExcludedFilename(target.filename().stem().string())) {
     LOG(kError) << "Invalid name: " << target;
     return -EINVAL;
@@ -1212,6 +1710,11 @@ int FuseDrive<Storage>::CreateFile(const fs::path& target, mode_t mode) {
     auto fuse = Global<Storage>::g_fuse_drive;
     const auto file = detail::File::Create(fuse->asio_service_.service(), target.filename(), false);
     fuse->Create(target, file);
+    InvalidateAttributes(target, true);
+    if (file_info != nullptr) {
+      file_info->direct_io = fuse->direct_io_policy_.Selects(target, 0, file_info->flags);
+      detail::SetFileHandle(file_info, file);
+    }
   } catch (const std::exception& e) {
     LOG(kError) << "CreateFile: " << target << ": " << e.what();
     return -EIO;
@@ -1223,7 +1726,7 @@ template <typename Storage>
 int FuseDrive<Storage>::GetAttributes(const char* path, struct stat* stbuf) {
   try {
     const auto file(Global<Storage>::g_fuse_drive->GetContext(path));
-    *stbuf = ToStat(file->meta_data, Global<Storage>::g_fuse_drive->get_base_file_permissions());
+    *stbuf = detail::ToStat(*file, Global<Storage>::g_fuse_drive->get_base_file_permissions());
     LOG(kVerbose) << " meta_data info  = ";
     LOG(kVerbose) << "     name =  " << file->meta_data.name().c_str();
     LOG(kVerbose) << "     st_dev = " << stbuf->st_dev;
@@ -1251,15 +1754,17 @@ int FuseDrive<Storage>::GetAttributes(const char* path, struct stat* stbuf) {
 }
 
 template <typename Storage>
-int FuseDrive<Storage>::Truncate(const char* path, off_t size) {
+int FuseDrive<Storage>::Truncate(const char* path, off_t size,
+                                 struct fuse_file_info* file_info) {
   try {
     if (size < 0) {
       return -EINVAL;
     }
 
-    const auto file(Global<Storage>::g_fuse_drive->template GetMutableContext<detail::File>(path));
+    const auto file(GetOpenFile(path, file_info));
     if (file != nullptr) {
       file->Truncate(size);
+      InvalidateAttributes(path, false);
       return 0;
     }
   } catch (const std::exception& e) {
@@ -1268,6 +1773,51 @@ int FuseDrive<Storage>::Truncate(const char* path, off_t size) {
   return -ENOENT;
 }
 
+template <typename Storage>
+detail::DirectoryListing FuseDrive<Storage>::ListDirectory(const char* path) {
+  auto& attribute_cache(Global<Storage>::g_fuse_drive->attribute_cache_);
+  const auto epoch(attribute_cache.CurrentEpoch());
+  const auto directory(
+      Global<Storage>::g_fuse_drive->directory_handler_->template Get<detail::Directory>(path));
+  auto listing(detail::ListDirectory(*directory,
+                                     Global<Storage>::g_fuse_drive->get_base_file_permissions()));
+  // Prime the attribute cache for the getattr calls which typically follow a listing.
+  const fs::path parent(path);
+  for (std::size_t index(2); index < listing.size(); ++index)
+    attribute_cache.Insert(parent / listing[index].first, listing[index].second, epoch);
+  return listing;
+}
+
+template <typename Storage>
+void FuseDrive<Storage>::InvalidateAttributes(const fs::path& relative_path,
+                                              bool include_parent) {
+  auto& attribute_cache(Global<Storage>::g_fuse_drive->attribute_cache_);
+  attribute_cache.Erase(relative_path);
+  if (include_parent)
+    attribute_cache.EraseEntry(relative_path.parent_path());
+}
+
+// The high-level API offers no way to invalidate kernel caches by path, so this only drops the
+// userspace attributes; with FUSE_CAP_AUTO_INVAL_DATA the kernel then discards stale pages itself
+// once it sees the new attributes.
+template <typename Storage>
+void FuseDrive<Storage>::InvalidateRemoteChanges(
+    const std::vector<detail::RemoteChange>& changes) {
+  for (const auto& change : changes) {
+    for (const auto& name : change.changed_children)
+      attribute_cache_.Erase(change.relative_path / name);
+  }
+}
+
+template <typename Storage>
+std::shared_ptr<detail::File> FuseDrive<Storage>::GetOpenFile(const char* path,
+                                                              struct fuse_file_info* file_info) {
+  const auto handle(detail::GetFileHandle(file_info));
+  if (handle != nullptr)
+    return handle->file;
+  return Global<Storage>::g_fuse_drive->template GetMutableContext<detail::File>(path);
+}
+
 }  // namespace drive
 
 }  // namespace maidsafe
@@ -0,0 +1,1371 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#ifndef MAIDSAFE_DRIVE_UNIX_LOW_LEVEL_DRIVE_H_
+#define MAIDSAFE_DRIVE_UNIX_LOW_LEVEL_DRIVE_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "boost/filesystem/path.hpp"
+
+#include "fuse/fuse_lowlevel.h"
+#include "fuse/fuse_opt.h"
+
+#include "maidsafe/common/error.h"
+#include "maidsafe/common/log.h"
+
+#include "maidsafe/drive/directory.h"
+#include "maidsafe/drive/drive.h"
+#include "maidsafe/drive/file.h"
+#include "maidsafe/drive/symlink.h"
+#include "maidsafe/drive/unix_drive.h"
+#include "maidsafe/drive/utils.h"
+
+namespace maidsafe {
+
+namespace drive {
+
+namespace detail {
+
+// Maps the errors raised beneath the callbacks to the errno reported to the kernel, falling back to
+// EIO for anything unrecognised.
+inline int ToErrorNumber(const std::exception& exception) {
+  const auto error(dynamic_cast<const maidsafe_error*>(&exception));
+  if (error == nullptr)
+    return EIO;
+  const auto code(error->code());
+  if (code == make_error_code(DriveErrors::no_such_file))
+    return ENOENT;
+  if (code == make_error_code(DriveErrors::file_exists))
+    return EEXIST;
+  if (code == make_error_code(CommonErrors::file_too_large))
+    return EFBIG;
+  if (code == make_error_code(CommonErrors::cannot_exceed_limit))
+    return ENOSPC;
+  if (code == make_error_code(CommonErrors::invalid_parameter))
+    return EINVAL;
+  return EIO;
+}
+
+inline struct timespec AccessTime(const struct stat& attributes) {
+#ifdef MAIDSAFE_APPLE
+  return attributes.st_atimespec;
+#else
+  return attributes.st_atim;
+#endif
+}
+
+inline struct timespec ModificationTime(const struct stat& attributes) {
+#ifdef MAIDSAFE_APPLE
+  return attributes.st_mtimespec;
+#else
+  return attributes.st_mtim;
+#endif
+}
+
+// The nodes the kernel has looked up, each mapping straight to its Path.  A node also records its
+// entry in its parent, indexed by (parent id, name), from which its path is rebuilt for the Drive
+// operations which are still addressed by path.
+class NodeTable {
+ public:
+  explicit NodeTable(std::shared_ptr<Path> root);
+
+  std::shared_ptr<Path> GetPath(fuse_ino_t node_id) const;
+  boost::filesystem::path GetRelativePath(fuse_ino_t node_id) const;
+  fuse_ino_t FindNodeId(const Path* path) const;
+  fuse_ino_t FindNodeId(const boost::filesystem::path& relative_path) const;
+  // Counts a lookup of 'path' at 'name' in 'parent_id', giving it a node if it has none.
+  fuse_ino_t AddLookup(fuse_ino_t parent_id, const std::string& name, std::shared_ptr<Path> path);
+  // Drops 'count' lookups, and the node itself once none are left.
+  void Forget(fuse_ino_t node_id, std::uint64_t count);
+  // Moves the node at 'name' in 'parent_id' to 'new_name' in 'new_parent_id', unlinking any node
+  // already there.  Nodes below it follow without being touched.
+  void MoveNode(fuse_ino_t parent_id, const std::string& name, fuse_ino_t new_parent_id,
+                const std::string& new_name);
+  // Unlinks the node at 'name' in 'parent_id', if any, leaving the nodes below it unreachable.
+  void UnlinkNode(fuse_ino_t parent_id, const std::string& name);
+  // Re-points the node at 'relative_path' to 'path', or unlinks it if 'path' is null.  Returns the
+  // node's id, or 0 if there is no such node.
+  fuse_ino_t ReplaceNode(const boost::filesystem::path& relative_path, std::shared_ptr<Path> path);
+  std::size_t size() const;
+
+ private:
+  struct Node {
+    explicit Node(std::shared_ptr<Path> path_in)
+        : path(std::move(path_in)), parent_id(0), name(), lookup_count(0) {}
+    std::shared_ptr<Path> path;
+    // 'parent_id' is 0 for the root, and once the node has been unlinked or replaced by a rename.
+    fuse_ino_t parent_id;
+    std::string name;
+    std::uint64_t lookup_count;
+  };
+
+  NodeTable(const NodeTable&);
+  NodeTable(NodeTable&&);
+  NodeTable& operator=(NodeTable);
+
+  // These require 'mutex_' to be held.
+  fuse_ino_t DoFindNodeId(const boost::filesystem::path& relative_path) const;
+  void Link(fuse_ino_t node_id, fuse_ino_t parent_id, const std::string& name);
+  void Unlink(fuse_ino_t node_id);
+
+  mutable std::mutex mutex_;
+  std::unordered_map<fuse_ino_t, Node> nodes_;
+  std::unordered_map<const Path*, fuse_ino_t> node_ids_;
+  std::map<std::pair<fuse_ino_t, std::string>, fuse_ino_t> children_;
+  fuse_ino_t next_node_id_;
+};
+
+// The root node is never forgotten by the kernel, so it is never removed from the table.
+inline NodeTable::NodeTable(std::shared_ptr<Path> root)
+    : mutex_(), nodes_(), node_ids_(), children_(), next_node_id_(FUSE_ROOT_ID + 1) {
+  node_ids_.emplace(root.get(), FUSE_ROOT_ID);
+  nodes_.emplace(FUSE_ROOT_ID, Node(std::move(root)));
+}
+
+inline std::shared_ptr<Path> NodeTable::GetPath(fuse_ino_t node_id) const {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  const auto itr(nodes_.find(node_id));
+  if (itr == std::end(nodes_))
+    BOOST_THROW_EXCEPTION(MakeError(DriveErrors::no_such_file));
+  return itr->second.path;
+}
+
+inline boost::filesystem::path NodeTable::GetRelativePath(fuse_ino_t node_id) const {
+  std::vector<const std::string*> names;
+  const std::lock_guard<std::mutex> lock(mutex_);
+  while (node_id != FUSE_ROOT_ID) {
+    const auto itr(nodes_.find(node_id));
+    if (itr == std::end(nodes_) || itr->second.parent_id == 0)
+      BOOST_THROW_EXCEPTION(MakeError(DriveErrors::no_such_file));
+    names.push_back(&itr->second.name);
+    node_id = itr->second.parent_id;
+  }
+  boost::filesystem::path relative_path(kRoot);
+  for (auto itr(names.rbegin()); itr != names.rend(); ++itr)
+    relative_path /= **itr;
+  return relative_path;
+}
+
+inline fuse_ino_t NodeTable::FindNodeId(const Path* path) const {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  const auto itr(node_ids_.find(path));
+  return itr == std::end(node_ids_) ? 0 : itr->second;
+}
+
+inline fuse_ino_t NodeTable::FindNodeId(const boost::filesystem::path& relative_path) const {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  return DoFindNodeId(relative_path);
+}
+
+inline fuse_ino_t NodeTable::DoFindNodeId(const boost::filesystem::path& relative_path) const {
+  fuse_ino_t node_id(FUSE_ROOT_ID);
+  for (const auto& name : relative_path.relative_path()) {
+    const auto itr(children_.find(std::make_pair(node_id, name.string())));
+    if (itr == std::end(children_))
+      return 0;
+    node_id = itr->second;
+  }
+  return node_id;
+}
+
+inline fuse_ino_t NodeTable::AddLookup(fuse_ino_t parent_id, const std::string& name,
+                                       std::shared_ptr<Path> path) {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  auto id_itr(node_ids_.find(path.get()));
+  if (id_itr == std::end(node_ids_)) {
+    id_itr = node_ids_.emplace(path.get(), next_node_id_++).first;
+    nodes_.emplace(id_itr->second, Node(std::move(path)));
+  }
+  Link(id_itr->second, parent_id, name);
+  ++nodes_.at(id_itr->second).lookup_count;
+  return id_itr->second;
+}
+
+inline void NodeTable::Forget(fuse_ino_t node_id, std::uint64_t count) {
+  std::shared_ptr<Path> released;  // destroyed outside the lock
+  const std::lock_guard<std::mutex> lock(mutex_);
+  const auto itr(nodes_.find(node_id));
+  if (itr == std::end(nodes_) || node_id == FUSE_ROOT_ID)
+    return;
+  itr->second.lookup_count -= std::min(itr->second.lookup_count, count);
+  if (itr->second.lookup_count == 0) {
+    Unlink(node_id);
+    released = std::move(itr->second.path);
+    const auto id_itr(node_ids_.find(released.get()));
+    if (id_itr != std::end(node_ids_) && id_itr->second == node_id)
+      node_ids_.erase(id_itr);
+    nodes_.erase(itr);
+  }
+}
+
+inline void NodeTable::MoveNode(fuse_ino_t parent_id, const std::string& name,
+                                fuse_ino_t new_parent_id, const std::string& new_name) {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  const auto itr(children_.find(std::make_pair(parent_id, name)));
+  if (itr != std::end(children_)) {
+    Link(itr->second, new_parent_id, new_name);
+    return;
+  }
+  const auto replaced_itr(children_.find(std::make_pair(new_parent_id, new_name)));
+  if (replaced_itr != std::end(children_))
+    Unlink(replaced_itr->second);
+}
+
+inline void NodeTable::UnlinkNode(fuse_ino_t parent_id, const std::string& name) {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  const auto itr(children_.find(std::make_pair(parent_id, name)));
+  if (itr != std::end(children_))
+    Unlink(itr->second);
+}
+
+inline fuse_ino_t NodeTable::ReplaceNode(const boost::filesystem::path& relative_path,
+                                         std::shared_ptr<Path> path) {
+  std::shared_ptr<Path> released;  // destroyed outside the lock
+  const std::lock_guard<std::mutex> lock(mutex_);
+  const fuse_ino_t node_id(DoFindNodeId(relative_path));
+  if (node_id == 0 || node_id == FUSE_ROOT_ID)
+    return node_id;
+  auto& node(nodes_.at(node_id));
+  if (path == nullptr) {
+    Unlink(node_id);
+    return node_id;
+  }
+  if (path == node.path)
+    return node_id;
+  const auto id_itr(node_ids_.find(node.path.get()));
+  if (id_itr != std::end(node_ids_) && id_itr->second == node_id)
+    node_ids_.erase(id_itr);
+  // Should the new object somehow have a node of its own already, this one takes over its
+  // mapping, and the other keeps only the lookups the kernel has yet to forget.
+  node_ids_[path.get()] = node_id;
+  released = std::move(node.path);
+  node.path = std::move(path);
+  return node_id;
+}
+
+inline void NodeTable::Link(fuse_ino_t node_id, fuse_ino_t parent_id, const std::string& name) {
+  auto& node(nodes_.at(node_id));
+  if (node_id == FUSE_ROOT_ID || (node.parent_id == parent_id && node.name == name))
+    return;
+  Unlink(node_id);
+  auto& linked_id(children_[std::make_pair(parent_id, name)]);
+  if (linked_id != 0) {
+    // The name now refers to another object, e.g. one reloaded after a remote change, or the source
+    // of a rename.
+    auto& replaced(nodes_.at(linked_id));
+    replaced.parent_id = 0;
+    replaced.name.clear();
+  }
+  linked_id = node_id;
+  node.parent_id = parent_id;
+  node.name = name;
+}
+
+inline void NodeTable::Unlink(fuse_ino_t node_id) {
+  auto& node(nodes_.at(node_id));
+  if (node.parent_id == 0)
+    return;
+  children_.erase(std::make_pair(node.parent_id, node.name));
+  node.parent_id = 0;
+  node.name.clear();
+}
+
+inline std::size_t NodeTable::size() const {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  return nodes_.size();
+}
+
+}  // namespace detail
+
+// Alternative to FuseDrive built on the inode-based FUSE low-level API.  Each file the kernel has
+// looked up is given a node id which maps straight to its detail::Path, so operations on it cost a
+// single hash lookup rather than resolving its path from the root.
+template <typename Storage>
+class FuseLowLevelDrive : public Drive<Storage> {
+ public:
+  FuseLowLevelDrive(std::shared_ptr<Storage> storage, const Identity& unique_user_id,
+                    const Identity& root_parent_id, const boost::filesystem::path& mount_dir,
+                    const boost::filesystem::path& user_app_dir,
+                    const boost::filesystem::path& drive_name,
+                    std::string mount_status_shared_object_name, bool create,
+                    unsigned worker_count = 1,
+                    const FuseCacheTimeouts& cache_timeouts = FuseCacheTimeouts(),
+                    const DirectIoPolicy& direct_io_policy = DirectIoPolicy(),
+                    std::uint64_t chunk_cache_size = detail::kDefaultChunkCacheSize,
+                    bool write_behind = false);
+
+  virtual ~FuseLowLevelDrive();
+
+ private:
+  FuseLowLevelDrive(const FuseLowLevelDrive&);
+  FuseLowLevelDrive(FuseLowLevelDrive&&);
+  FuseLowLevelDrive& operator=(FuseLowLevelDrive);
+
+  void Init();
+  void SetMounted();
+
+  virtual void DoMount() override;
+  virtual void DoUnmount() override;
+  virtual void InvalidateRemoteChanges(const std::vector<detail::RemoteChange>& changes) override;
+
+  std::shared_ptr<detail::File> GetFile(fuse_ino_t node_id) const;
+  // Prefers the handle set by open/create, falling back to the node table.
+  std::shared_ptr<detail::File> GetOpenFile(fuse_ino_t node_id,
+                                            const struct fuse_file_info* file_info) const;
+
+  std::shared_ptr<detail::Directory> GetDirectory(const boost::filesystem::path& relative_path);
+  struct stat GetAttributes(fuse_ino_t node_id, const detail::Path& path) const;
+  fuse_entry_param MakeEntry(fuse_ino_t parent_id, const std::string& name,
+                             std::shared_ptr<detail::Path> path);
+  void ReplyEntry(fuse_req_t request, fuse_ino_t parent_id, const std::string& name,
+                  std::shared_ptr<detail::Path> path);
+
+  static FuseLowLevelDrive& GetDrive(fuse_req_t request);
+
+  static void OpsCreate(fuse_req_t request, fuse_ino_t parent_id, const char* name, mode_t mode,
+                        struct fuse_file_info* file_info);
+  static void OpsDestroy(void* user_data);
+  static void OpsFlush(fuse_req_t request, fuse_ino_t node_id, struct fuse_file_info* file_info);
+  static void OpsForget(fuse_req_t request, fuse_ino_t node_id,
+                        unsigned long lookup_count);  // NOLINT
+  static void OpsFsync(fuse_req_t request, fuse_ino_t node_id, int datasync,
+                       struct fuse_file_info* file_info);
+  static void OpsFsyncdir(fuse_req_t request, fuse_ino_t node_id, int datasync,
+                          struct fuse_file_info* file_info);
+  static void OpsGetattr(fuse_req_t request, fuse_ino_t node_id, struct fuse_file_info* file_info);
+  static void OpsInit(void* user_data, struct fuse_conn_info* conn);
+  static void OpsLookup(fuse_req_t request, fuse_ino_t parent_id, const char* name);
+  static void OpsMkdir(fuse_req_t request, fuse_ino_t parent_id, const char* name, mode_t mode);
+  static void OpsMknod(fuse_req_t request, fuse_ino_t parent_id, const char* name, mode_t mode,
+                       dev_t rdev);
+  static void OpsOpen(fuse_req_t request, fuse_ino_t node_id, struct fuse_file_info* file_info);
+  static void OpsOpendir(fuse_req_t request, fuse_ino_t node_id,
+                         struct fuse_file_info* file_info);
+  static void OpsRead(fuse_req_t request, fuse_ino_t node_id, size_t size, off_t offset,
+                      struct fuse_file_info* file_info);
+  static void OpsReaddir(fuse_req_t request, fuse_ino_t node_id, size_t size, off_t offset,
+                         struct fuse_file_info* file_info);
+  static void OpsReadlink(fuse_req_t request, fuse_ino_t node_id);
+  static void OpsRelease(fuse_req_t request, fuse_ino_t node_id, struct fuse_file_info* file_info);
+  static void OpsReleasedir(fuse_req_t request, fuse_ino_t node_id,
+                            struct fuse_file_info* file_info);
+  static void OpsRename(fuse_req_t request, fuse_ino_t parent_id, const char* name,
+                        fuse_ino_t new_parent_id, const char* new_name);
+  static void OpsRmdir(fuse_req_t request, fuse_ino_t parent_id, const char* name);
+  static void OpsSetattr(fuse_req_t request, fuse_ino_t node_id, struct stat* attributes,
+                         int to_set, struct fuse_file_info* file_info);
+  static void OpsStatfs(fuse_req_t request, fuse_ino_t node_id);
+  static void OpsSymlink(fuse_req_t request, const char* link, fuse_ino_t parent_id,
+                         const char* name);
+  static void OpsUnlink(fuse_req_t request, fuse_ino_t parent_id, const char* name);
+  static void OpsWrite(fuse_req_t request, fuse_ino_t node_id, const char* buf, size_t size,
+                       off_t offset, struct fuse_file_info* file_info);
+#if FUSE_VERSION >= 29
+  static void OpsWriteBuf(fuse_req_t request, fuse_ino_t node_id, struct fuse_bufvec* buffers,
+                          off_t offset, struct fuse_file_info* file_info);
+#endif
+
+  static struct fuse_lowlevel_ops maidsafe_ops_;
+  struct fuse_session* fuse_session_;
+  struct fuse_chan* fuse_channel_;
+  fs::path fuse_mountpoint_;
+  std::string drive_name_;
+  const unsigned worker_count_;
+  const FuseCacheTimeouts cache_timeouts_;
+  const DirectIoPolicy direct_io_policy_;
+  std::vector<std::thread> workers_;
+  detail::NodeTable nodes_;
+  std::once_flag mounted_once_flag_;
+  std::thread unmount_ipc_waiter_;
+};
+
+template <typename Storage>
+struct fuse_lowlevel_ops FuseLowLevelDrive<Storage>::maidsafe_ops_;
+
+template <typename Storage>
+FuseLowLevelDrive<Storage>::FuseLowLevelDrive(std::shared_ptr<Storage> storage,
+                                              const Identity& unique_user_id,
+                                              const Identity& root_parent_id,
+                                              const boost::filesystem::path& mount_dir,
+                                              const boost::filesystem::path& user_app_dir,
+                                              const boost::filesystem::path& drive_name,
+                                              std::string mount_status_shared_object_name,
+                                              bool create, unsigned worker_count,
+                                              const FuseCacheTimeouts& cache_timeouts,
+                                              const DirectIoPolicy& direct_io_policy,
+                                              std::uint64_t chunk_cache_size, bool write_behind)
+    : Drive<Storage>(storage, unique_user_id, root_parent_id, mount_dir, user_app_dir,
+                     std::move(mount_status_shared_object_name), create, chunk_cache_size,
+                     write_behind),
+      fuse_session_(nullptr),
+      fuse_channel_(nullptr),
+      fuse_mountpoint_(mount_dir),
+      drive_name_(drive_name.string()),
+      worker_count_(std::max(worker_count, 1U)),
+      cache_timeouts_(cache_timeouts),
+      direct_io_policy_(direct_io_policy),
+      workers_(),
+      nodes_(this->GetMutableContext(detail::kRoot)),
+      mounted_once_flag_(),
+      unmount_ipc_waiter_() {
+  fs::create_directory(fuse_mountpoint_);
+  Init();
+}
+
+template <typename Storage>
+FuseLowLevelDrive<Storage>::~FuseLowLevelDrive() {
+  this->Unmount();
+  if (unmount_ipc_waiter_.joinable())
+    unmount_ipc_waiter_.join();
+  log::Logging::Instance().Flush();
+}
+
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::Init() {
+  maidsafe_ops_.create = OpsCreate;
+  maidsafe_ops_.destroy = OpsDestroy;
+  maidsafe_ops_.flush = OpsFlush;
+  maidsafe_ops_.forget = OpsForget;
+  maidsafe_ops_.fsync = OpsFsync;
+  maidsafe_ops_.fsyncdir = OpsFsyncdir;
+  maidsafe_ops_.getattr = OpsGetattr;
+  maidsafe_ops_.init = OpsInit;
+  maidsafe_ops_.lookup = OpsLookup;
+  maidsafe_ops_.mkdir = OpsMkdir;
+  maidsafe_ops_.mknod = OpsMknod;
+  maidsafe_ops_.open = OpsOpen;
+  maidsafe_ops_.opendir = OpsOpendir;
+  maidsafe_ops_.read = OpsRead;
+  maidsafe_ops_.readdir = OpsReaddir;
+  maidsafe_ops_.readlink = OpsReadlink;
+  maidsafe_ops_.release = OpsRelease;
+  maidsafe_ops_.releasedir = OpsReleasedir;
+  maidsafe_ops_.rename = OpsRename;
+  maidsafe_ops_.rmdir = OpsRmdir;
+  maidsafe_ops_.setattr = OpsSetattr;
+  maidsafe_ops_.statfs = OpsStatfs;
+  maidsafe_ops_.symlink = OpsSymlink;
+  maidsafe_ops_.unlink = OpsUnlink;
+  maidsafe_ops_.write = OpsWrite;
+#if FUSE_VERSION >= 29
+  maidsafe_ops_.write_buf = OpsWriteBuf;
+#endif
+}
+
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::SetMounted() {
+  std::call_once(mounted_once_flag_, [&] {
+    if (!this->kMountStatusSharedObjectName_.empty()) {
+      LOG(kVerbose) << "FuseLowLevelDrive<Storage>::SetMounted() kMountStatusSharedObjectName_ : "
+                    << this->kMountStatusSharedObjectName_;
+      unmount_ipc_waiter_ = std::thread([&] {
+        NotifyMountedAndWaitForUnmountRequest(this->kMountStatusSharedObjectName_);
+        this->Unmount();
+      });
+    }
+    this->mount_promise_.set_value();
+  });
+}
+
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::DoMount() {
+  fuse_args args = FUSE_ARGS_INIT(0, nullptr);
+  fuse_opt_add_arg(&args, (drive_name_.c_str()));
+  fuse_opt_add_arg(&args, (fuse_mountpoint_.c_str()));
+  std::string fsname_arg("-ofsname=" + drive_name_);
+  fuse_opt_add_arg(&args, (fsname_arg.c_str()));
+#ifdef MAIDSAFE_APPLE
+  std::string volname_arg("-ovolname=" + drive_name_);
+  fuse_opt_add_arg(&args, (volname_arg.c_str()));
+#endif
+  // See FuseDrive::DoMount() regarding -odefault_permissions.  The low-level API has no
+  // 'kernel_cache' option; OpsOpen sets 'keep_cache' on each file instead.
+  fuse_opt_add_arg(&args, "-odefault_permissions");
+  fuse_opt_add_arg(&args, "-f");  // run in foreground
+  if (worker_count_ == 1)
+    fuse_opt_add_arg(&args, "-s");  // run single threaded
+
+  int multithreaded, foreground;
+  char* mountpoint(nullptr);
+  if (fuse_parse_cmdline(&args, &mountpoint, &multithreaded, &foreground) == -1) {
+    fuse_opt_free_args(&args);
+    BOOST_THROW_EXCEPTION(MakeError(DriveErrors::failed_to_mount));
+  }
+  on_scope_exit free_mountpoint([&] { free(mountpoint); });
+
+  fuse_channel_ = fuse_mount(mountpoint, &args);
+  if (!fuse_channel_) {
+    fuse_opt_free_args(&args);
+    BOOST_THROW_EXCEPTION(MakeError(DriveErrors::failed_to_mount));
+  }
+
+  fuse_session_ = fuse_lowlevel_new(&args, &maidsafe_ops_, sizeof(maidsafe_ops_), this);
+  fuse_opt_free_args(&args);
+  on_scope_exit cleanup_on_error([&]() -> void { this->Unmount(); });
+  if (!fuse_session_)
+    BOOST_THROW_EXCEPTION(MakeError(DriveErrors::failed_to_mount));
+  fuse_session_add_chan(fuse_session_, fuse_channel_);
+
+  if (fuse_daemonize(foreground) == -1)
+    BOOST_THROW_EXCEPTION(MakeError(DriveErrors::failed_to_mount));
+
+  if (fuse_set_signal_handlers(fuse_session_) == -1)
+    BOOST_THROW_EXCEPTION(MakeError(DriveErrors::failed_to_mount));
+
+  if (multithreaded) {
+    detail::RunWorkers(fuse_session_, worker_count_, workers_);
+  } else {
+    if (fuse_session_loop(fuse_session_) == -1)
+      BOOST_THROW_EXCEPTION(MakeError(DriveErrors::failed_to_mount));
+  }
+
+  cleanup_on_error.Release();
+}
+
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::DoUnmount() {
+  try {
+    std::call_once(this->unmounted_once_flag_, [&] {
+      if (fuse_session_) {
+        fuse_remove_signal_handlers(fuse_session_);
+        fuse_session_exit(fuse_session_);
+      }
+      if (fuse_channel_) {
+        // As in FuseDrive::DoUnmount(), the channel must outlive the workers.
+        fuse_unmount(fuse_mountpoint_.c_str(), nullptr);
+        for (auto& worker : workers_)
+          worker.join();
+        workers_.clear();
+        if (fuse_session_)
+          fuse_session_destroy(fuse_session_);  // also destroys the channel
+        else
+          fuse_chan_destroy(fuse_channel_);
+        this->directory_handler_->StoreAll();
+      }
+    });
+  } catch (const std::exception& e) {
+    LOG(kError) << "Exception in Unmount: " << e.what();
+  } catch (...) {
+    LOG(kError) << "Unknown exception in Unmount";
+  }
+  if (!this->kMountStatusSharedObjectName_.empty())
+    NotifyUnmounted(this->kMountStatusSharedObjectName_);
+}
+
+// =============================== Node table ======================================================
+
+template <typename Storage>
+std::shared_ptr<detail::File> FuseLowLevelDrive<Storage>::GetFile(fuse_ino_t node_id) const {
+  auto file(std::dynamic_pointer_cast<detail::File>(nodes_.GetPath(node_id)));
+  if (file == nullptr ||
+      file->meta_data.file_type() != detail::MetaData::FileType::regular_file) {
+    BOOST_THROW_EXCEPTION(MakeError(CommonErrors::invalid_parameter));
+  }
+  return file;
+}
+
+template <typename Storage>
+std::shared_ptr<detail::File> FuseLowLevelDrive<Storage>::GetOpenFile(
+    fuse_ino_t node_id, const struct fuse_file_info* file_info) const {
+  const auto handle(detail::GetFileHandle(file_info));
+  return handle != nullptr ? handle->file : GetFile(node_id);
+}
+
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::InvalidateRemoteChanges(
+    const std::vector<detail::RemoteChange>& changes) {
+  for (const auto& change : changes) {
+    const fuse_ino_t parent_id(nodes_.FindNodeId(change.relative_path));
+    for (const auto& name : change.changed_children) {
+      const auto relative_path(change.relative_path / name);
+      std::shared_ptr<detail::Path> path;
+      try {
+        path = this->GetMutableContext(relative_path);
+      } catch (const std::exception&) {
+        // Removed by the other client.
+      }
+      const fuse_ino_t node_id(nodes_.ReplaceNode(relative_path, std::move(path)));
+#if FUSE_VERSION >= 28
+      // Drops the cached pages and attributes of the node, and the dentry (positive or negative)
+      // for the name, so the kernel asks again.
+      if (fuse_channel_ == nullptr)
+        continue;
+      if (node_id != 0)
+        fuse_lowlevel_notify_inval_inode(fuse_channel_, node_id, 0, 0);
+      if (parent_id != 0) {
+        const std::string name_string(name.string());
+        fuse_lowlevel_notify_inval_entry(fuse_channel_, parent_id, name_string.c_str(),
+                                         name_string.size());
+      }
+#else
+      static_cast<void>(node_id);
+      static_cast<void>(parent_id);
+#endif
+    }
+  }
+}
+
+template <typename Storage>
+std::shared_ptr<detail::Directory> FuseLowLevelDrive<Storage>::GetDirectory(
+    const boost::filesystem::path& relative_path) {
+  if (relative_path.empty())
+    BOOST_THROW_EXCEPTION(MakeError(DriveErrors::no_such_file));
+  auto directory(this->directory_handler_->template Get<detail::Directory>(relative_path));
+  if (directory == nullptr)
+    BOOST_THROW_EXCEPTION(MakeError(CommonErrors::invalid_parameter));
+  return directory;
+}
+
+template <typename Storage>
+struct stat FuseLowLevelDrive<Storage>::GetAttributes(fuse_ino_t node_id,
+                                                      const detail::Path& path) const {
+  struct stat attributes(detail::ToStat(path, this->get_base_file_permissions()));
+  attributes.st_ino = node_id;
+  return attributes;
+}
+
+template <typename Storage>
+fuse_entry_param FuseLowLevelDrive<Storage>::MakeEntry(fuse_ino_t parent_id,
+                                                       const std::string& name,
+                                                       std::shared_ptr<detail::Path> path) {
+  fuse_entry_param entry;
+  std::memset(&entry, 0, sizeof(entry));
+  entry.attr = detail::ToStat(*path, this->get_base_file_permissions());
+  entry.ino = nodes_.AddLookup(parent_id, name, std::move(path));
+  entry.attr.st_ino = entry.ino;
+  entry.attr_timeout = cache_timeouts_.attr;
+  entry.entry_timeout = cache_timeouts_.entry;
+  return entry;
+}
+
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::ReplyEntry(fuse_req_t request, fuse_ino_t parent_id,
+                                            const std::string& name,
+                                            std::shared_ptr<detail::Path> path) {
+  const auto entry(MakeEntry(parent_id, name, std::move(path)));
+  // The kernel only counts the lookup if it received the reply.
+  if (fuse_reply_entry(request, &entry) != 0)
+    nodes_.Forget(entry.ino, 1);
+}
+
+template <typename Storage>
+FuseLowLevelDrive<Storage>& FuseLowLevelDrive<Storage>::GetDrive(fuse_req_t request) {
+  return *static_cast<FuseLowLevelDrive<Storage>*>(fuse_req_userdata(request));
+}
+
+// =============================== Callbacks =======================================================
+
+// Quote from FUSE documentation:
+//
+// Create and open a file.
+//
+// If the file does not exist, first create it with the specified mode, and then open it.
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::OpsCreate(fuse_req_t request, fuse_ino_t parent_id,
+                                           const char* name, mode_t mode,
+                                           struct fuse_file_info* file_info) {
+  LOG(kInfo) << "OpsCreate: " << parent_id << " / " << name << " (" << detail::GetFileType(mode)
+             << "), mode: " << std::oct << mode;
+  if (detail::ToFileType(mode) != detail::MetaData::FileType::regular_file) {
+    fuse_reply_err(request, EPERM);
+    return;
+  }
+  if (detail::ExcludedFilename(fs::path(name).stem().string())) {
+    LOG(kError) << "Invalid name: " << name;
+    fuse_reply_err(request, EINVAL);
+    return;
+  }
+  auto& drive(GetDrive(request));
+  try {
+    const auto relative_path(drive.nodes_.GetRelativePath(parent_id) / name);
+    const auto file(detail::File::Create(drive.asio_service_.service(), name, false));
+    // Drive::Create() leaves the new file open on behalf of this call.
+    drive.Create(relative_path, file);
+    file_info->keep_cache = 1;
+    file_info->direct_io = drive.direct_io_policy_.Selects(name, 0, file_info->flags);
+    const auto entry(drive.MakeEntry(parent_id, name, file));
+    detail::SetFileHandle(file_info, file);
+    if (fuse_reply_create(request, &entry, file_info) != 0) {
+      detail::TakeFileHandle(file_info);
+      drive.nodes_.Forget(entry.ino, 1);
+      file->Close();
+    }
+  } catch (const std::exception& e) {
+    LOG(kError) << "OpsCreate: " << parent_id << " / " << name << ": " << e.what();
+    fuse_reply_err(request, detail::ToErrorNumber(e));
+  }
+}
+
+// Quote from FUSE documentation:
+//
+// Clean up filesystem.
+//
+// Called on filesystem exit.
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::OpsDestroy(void* /*user_data*/) {
+  LOG(kInfo) << "OpsDestroy";
+}
+
+// Quote from FUSE documentation:
+//
+// Flush method.
+//
+// This is called on each close() of the opened file.  Since file descriptors can be duplicated
+// (dup, dup2, fork), for one open call there may be many flush calls.
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::OpsFlush(fuse_req_t request, fuse_ino_t node_id,
+                                          struct fuse_file_info* file_info) {
+  LOG(kInfo) << "OpsFlush: " << node_id << ", flags: " << file_info->flags;
+  std::shared_ptr<detail::File> file;
+  try {
+    file = GetDrive(request).GetOpenFile(node_id, file_info);
+    file->ScheduleForStoring();
+  } catch (const std::exception& e) {
+    LOG(kError) << "OpsFlush: " << node_id << ": " << e.what();
+    fuse_reply_err(request, EBADF);
+    return;
+  }
+  try {
+    file->Flush();
+  } catch (const std::exception& e) {
+    // A write acknowledged in write-behind mode never reached the encryptor.
+    LOG(kError) << "OpsFlush: " << node_id << ": " << e.what();
+    fuse_reply_err(request, detail::ToErrorNumber(e));
+    return;
+  }
+  fuse_reply_err(request, 0);
+}
+
+// Quote from FUSE documentation:
+//
+// Forget about an inode.
+//
+// The nlookup parameter indicates the number of lookups previously performed on this inode.  The
+// filesystem may ignore forget calls, if the inodes don't need to have a limited lifetime.
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::OpsForget(fuse_req_t request, fuse_ino_t node_id,
+                                           unsigned long lookup_count) {  // NOLINT
+  LOG(kVerbose) << "OpsForget: " << node_id << ", count: " << lookup_count;
+  GetDrive(request).nodes_.Forget(node_id, lookup_count);
+  fuse_reply_none(request);
+}
+
+// Quote from FUSE documentation:
+//
+// Synchronize file contents.
+//
+// If the datasync parameter is non-zero, then only the user data should be flushed, not the meta
+// data.
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::OpsFsync(fuse_req_t request, fuse_ino_t node_id, int datasync,
+                                          struct fuse_file_info* file_info) {
+  LOG(kInfo) << "OpsFsync: " << node_id << ", datasync: " << datasync;
+  try {
+    auto& drive(GetDrive(request));
+    drive.SyncFile(*drive.GetOpenFile(node_id, file_info));
+  } catch (const std::exception& e) {
+    LOG(kError) << "OpsFsync: " << node_id << ": " << e.what();
+    fuse_reply_err(request, detail::ToErrorNumber(e));
+    return;
+  }
+  fuse_reply_err(request, 0);
+}
+
+// Quote from FUSE documentation:
+//
+// Synchronize directory contents.
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::OpsFsyncdir(fuse_req_t request, fuse_ino_t node_id,
+                                             int datasync, struct fuse_file_info* /*file_info*/) {
+  LOG(kInfo) << "OpsFsyncdir: " << node_id << ", datasync: " << datasync;
+  try {
+    auto& drive(GetDrive(request));
+    drive.SyncDirectory(drive.nodes_.GetRelativePath(node_id));
+  } catch (const std::exception& e) {
+    LOG(kError) << "OpsFsyncdir: " << node_id << ": " << e.what();
+    fuse_reply_err(request, detail::ToErrorNumber(e));
+    return;
+  }
+  fuse_reply_err(request, 0);
+}
+
+// Quote from FUSE documentation:
+//
+// Get file attributes.
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::OpsGetattr(fuse_req_t request, fuse_ino_t node_id,
+                                            struct fuse_file_info* /*file_info*/) {
+  LOG(kInfo) << "OpsGetattr: " << node_id;
+  auto& drive(GetDrive(request));
+  try {
+    const auto attributes(drive.GetAttributes(node_id, *drive.nodes_.GetPath(node_id)));
+    fuse_reply_attr(request, &attributes, GetDrive(request).cache_timeouts_.attr);
+  } catch (const std::exception& e) {
+    LOG(kWarning) << "OpsGetattr: " << node_id << ": " << e.what();
+    fuse_reply_err(request, ENOENT);
+  }
+}
+
+// Quote from FUSE documentation:
+//
+// Initialize filesystem.
+//
+// Called before any other filesystem method.
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::OpsInit(void* user_data, struct fuse_conn_info* conn) {
+  detail::NegotiateConnection(conn);
+  static_cast<FuseLowLevelDrive<Storage>*>(user_data)->SetMounted();
+}
+
+// Quote from FUSE documentation:
+//
+// Look up a directory entry by name and get its attributes.
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::OpsLookup(fuse_req_t request, fuse_ino_t parent_id,
+                                           const char* name) {
+  LOG(kInfo) << "OpsLookup: " << parent_id << " / " << name;
+  auto& drive(GetDrive(request));
+  try {
+    const auto relative_path(drive.nodes_.GetRelativePath(parent_id) / name);
+    auto path(drive.GetDirectory(relative_path.parent_path())->GetMutableChild(name));
+    drive.ReplyEntry(request, parent_id, name, std::move(path));
+  } catch (const std::exception& e) {
+    LOG(kVerbose) << "OpsLookup: " << parent_id << " / " << name << ": " << e.what();
+    const int error(detail::ToErrorNumber(e));
+    if (error == ENOENT && drive.cache_timeouts_.negative > 0) {
+      // A zero node id lets the kernel cache the name's absence.
+      fuse_entry_param entry;
+      std::memset(&entry, 0, sizeof(entry));
+      entry.entry_timeout = drive.cache_timeouts_.negative;
+      fuse_reply_entry(request, &entry);
+      return;
+    }
+    fuse_reply_err(request, error);
+  }
+}
+
+// Quote from FUSE documentation:
+//
+// Create a directory.
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::OpsMkdir(fuse_req_t request, fuse_ino_t parent_id,
+                                          const char* name, mode_t mode) {
+  LOG(kInfo) << "OpsMkdir: " << parent_id << " / " << name << ", mode: " << std::oct << mode;
+  auto& drive(GetDrive(request));
+  try {
+    const auto relative_path(drive.nodes_.GetRelativePath(parent_id) / name);
+    // FIXME: Replace with detail::Directory::Create
+    const auto directory(detail::File::Create(drive.asio_service_.service(), name, true));
+    drive.Create(relative_path, directory);
+    drive.ReplyEntry(request, parent_id, name, directory);
+  } catch (const std::exception& e) {
+    LOG(kError) << "OpsMkdir: " << parent_id << " / " << name << ": " << e.what();
+    fuse_reply_err(request, detail::ToErrorNumber(e));
+  }
+}
+
+// Quote from FUSE documentation:
+//
+// Create file node.
+//
+// Create a regular file, character device, block device, fifo or socket node.
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::OpsMknod(fuse_req_t request, fuse_ino_t parent_id,
+                                          const char* name, mode_t mode, dev_t /*rdev*/) {
+  LOG(kInfo) << "OpsMknod: " << parent_id << " / " << name << " (" << detail::GetFileType(mode)
+             << "), mode: " << std::oct << mode;
+  if (detail::ToFileType(mode) != detail::MetaData::FileType::regular_file) {
+    fuse_reply_err(request, EPERM);
+    return;
+  }
+  if (detail::ExcludedFilename(fs::path(name).stem().string())) {
+    LOG(kError) << "Invalid name: " << name;
+    fuse_reply_err(request, EINVAL);
+    return;
+  }
+  auto& drive(GetDrive(request));
+  try {
+    const auto relative_path(drive.nodes_.GetRelativePath(parent_id) / name);
+    const auto file(detail::File::Create(drive.asio_service_.service(), name, false));
+    drive.Create(relative_path, file);
+    // Unlike create(), mknod() isn't followed by a matching release().
+    file->Close();
+    drive.ReplyEntry(request, parent_id, name, file);
+  } catch (const std::exception& e) {
+    LOG(kError) << "OpsMknod: " << parent_id << " / " << name << ": " << e.what();
+    fuse_reply_err(request, detail::ToErrorNumber(e));
+  }
+}
+
+// Quote from FUSE documentation:
+//
+// Open a file.
+//
+// Open flags (with the exception of O_CREAT, O_EXCL, O_NOCTTY and O_TRUNC) are available in
+// fi->flags.
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::OpsOpen(fuse_req_t request, fuse_ino_t node_id,
+                                         struct fuse_file_info* file_info) {
+  LOG(kInfo) << "OpsOpen: " << node_id << ", flags: " << file_info->flags;
+  auto& drive(GetDrive(request));
+  std::shared_ptr<detail::File> file;
+  try {
+    file = drive.GetFile(node_id);
+    {
+      const std::lock_guard<std::mutex> lock(file->meta_data_mutex);
+      file_info->direct_io = drive.direct_io_policy_.Selects(
+          file->meta_data.name(), file->meta_data.size(), file_info->flags);
+    }
+    // See FuseDrive::OpsOpen() regarding 'keep_cache'.
+    file_info->keep_cache = 1;
+    drive.Open(*file);
+    detail::SetFileHandle(file_info, file);
+  } catch (const std::exception& e) {
+    LOG(kError) << "OpsOpen: " << node_id << ": " << e.what();
+    fuse_reply_err(request, detail::ToErrorNumber(e));
+    return;
+  }
+  if (fuse_reply_open(request, file_info) != 0) {
+    detail::TakeFileHandle(file_info);
+    file->Close();
+  }
+}
+
+// Quote from FUSE documentation:
+//
+// Open a directory.
+//
+// Filesystem may store an arbitrary file handle (pointer, index, etc) in fi->fh, and use this in
+// other all other directory stream operations (readdir, releasedir, fsyncdir).
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::OpsOpendir(fuse_req_t request, fuse_ino_t node_id,
+                                            struct fuse_file_info* file_info) {
+  LOG(kInfo) << "OpsOpendir: " << node_id << ", flags: " << file_info->flags;
+  auto& drive(GetDrive(request));
+  std::unique_ptr<detail::DirectoryListing> listing(new detail::DirectoryListing);
+  try {
+    const auto children(drive.GetDirectory(drive.nodes_.GetRelativePath(node_id))->GetChildren());
+    listing->reserve(children.size() + 2);
+    struct stat attributes;
+    std::memset(&attributes, 0, sizeof(attributes));
+    attributes.st_ino = node_id;
+    attributes.st_mode = S_IFDIR;
+    listing->emplace_back(".", attributes);
+    listing->emplace_back("..", attributes);
+    for (const auto& child : children) {
+      {
+        const std::lock_guard<std::mutex> lock(child->meta_data_mutex);
+        listing->emplace_back(child->meta_data.name().string(),
+                              detail::ToStat(child->meta_data, drive.get_base_file_permissions()));
+      }
+      // Report the node id where the kernel already knows the child.
+      const auto child_node_id(drive.nodes_.FindNodeId(child.get()));
+      if (child_node_id != 0)
+        listing->back().second.st_ino = child_node_id;
+    }
+  } catch (const std::exception& e) {
+    LOG(kError) << "OpsOpendir: " << node_id << ": " << e.what();
+    fuse_reply_err(request, detail::ToErrorNumber(e));
+    return;
+  }
+  file_info->fh = reinterpret_cast<std::uint64_t>(listing.get());
+  if (fuse_reply_open(request, file_info) == 0)
+    listing.release();
+}
+
+// Quote from FUSE documentation:
+//
+// Read data.
+//
+// Read should send exactly the number of bytes requested except on EOF or error, otherwise the rest
+// of the data will be substituted with zeroes.
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::OpsRead(fuse_req_t request, fuse_ino_t node_id, size_t size,
+                                         off_t offset, struct fuse_file_info* file_info) {
+  LOG(kInfo) << "OpsRead: " << node_id << ", flags: 0x" << std::hex << file_info->flags << std::dec
+             << " Size : " << size << " Offset : " << offset;
+  if (offset < 0) {
+    fuse_reply_err(request, EINVAL);
+    return;
+  }
+  try {
+    const auto file(GetDrive(request).GetOpenFile(node_id, file_info));
+    const std::uint32_t read_size(
+        static_cast<std::uint32_t>(std::min<std::size_t>(std::numeric_limits<int>::max(), size)));
+    std::unique_ptr<char[]> buffer(new char[read_size]);
+    const auto handle(detail::GetFileHandle(file_info));
+    const auto result(handle != nullptr && handle->direct_io
+                          ? detail::StreamRead(*handle, buffer.get(), read_size, offset)
+                          : file->Read(buffer.get(), read_size, offset));
+    fuse_reply_buf(request, buffer.get(), result);
+  } catch (const std::exception& e) {
+    LOG(kWarning) << "Failed to read " << node_id << ": " << e.what();
+    fuse_reply_err(request, EIO);
+  }
+}
+
+// Quote from FUSE documentation:
+//
+// Read directory.
+//
+// Send a buffer filled using fuse_add_direntry(), with size not exceeding the requested size.
+// Send an empty buffer on end of stream.
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::OpsReaddir(fuse_req_t request, fuse_ino_t node_id, size_t size,
+                                            off_t offset, struct fuse_file_info* file_info) {
+  LOG(kInfo) << "OpsReaddir: " << node_id << "; offset = " << offset;
+  const auto& listing(*reinterpret_cast<const detail::DirectoryListing*>(file_info->fh));
+  if (offset < 0) {
+    fuse_reply_err(request, EINVAL);
+    return;
+  }
+  std::vector<char> buffer(size);
+  std::size_t used(0);
+  // Each entry's offset is that of the one following it.
+  for (auto index(static_cast<std::size_t>(offset)); index < listing.size(); ++index) {
+    const std::size_t entry_size(fuse_add_direntry(
+        request, &buffer[0] + used, size - used, listing[index].first.c_str(),
+        &listing[index].second, static_cast<off_t>(index + 1)));
+    if (entry_size > size - used)
+      break;
+    used += entry_size;
+  }
+  fuse_reply_buf(request, &buffer[0], used);
+}
+
+// Quote from FUSE documentation:
+//
+// Read symbolic link.
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::OpsReadlink(fuse_req_t request, fuse_ino_t node_id) {
+  LOG(kInfo) << "OpsReadlink: " << node_id;
+  try {
+    const auto symlink(std::dynamic_pointer_cast<detail::Symlink>(GetDrive(request).nodes_.GetPath(
+        node_id)));
+    if (symlink == nullptr) {
+      LOG(kError) << "OpsReadlink " << node_id << ", no link returned.";
+      fuse_reply_err(request, EINVAL);
+      return;
+    }
+    fuse_reply_readlink(request, symlink->Target().c_str());
+  } catch (const std::exception& e) {
+    LOG(kWarning) << "OpsReadlink: " << node_id << ": " << e.what();
+    fuse_reply_err(request, ENOENT);
+  }
+}
+
+// Quote from FUSE documentation:
+//
+// Release an open file.
+//
+// Release is called when there are no more references to an open file: all file descriptors are
+// closed and all memory mappings are unmapped.  For every open call there will be exactly one
+// release call.
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::OpsRelease(fuse_req_t request, fuse_ino_t node_id,
+                                            struct fuse_file_info* file_info) {
+  LOG(kInfo) << "OpsRelease: " << node_id << ", flags: " << file_info->flags;
+  try {
+    const auto handle(detail::TakeFileHandle(file_info));
+    (handle != nullptr ? handle->file : GetDrive(request).GetFile(node_id))->Close();
+  } catch (const std::exception& e) {
+    LOG(kError) << "OpsRelease: " << node_id << ": " << e.what();
+    fuse_reply_err(request, EBADF);
+    return;
+  }
+  fuse_reply_err(request, 0);
+}
+
+// Quote from FUSE documentation:
+//
+// Release an open directory.
+//
+// For every opendir call there will be exactly one releasedir call.
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::OpsReleasedir(fuse_req_t request, fuse_ino_t node_id,
+                                               struct fuse_file_info* file_info) {
+  LOG(kInfo) << "OpsReleasedir: " << node_id << ", flags: " << file_info->flags;
+  delete reinterpret_cast<detail::DirectoryListing*>(file_info->fh);
+  fuse_reply_err(request, 0);
+}
+
+// Quote from FUSE documentation:
+//
+// Rename a file.
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::OpsRename(fuse_req_t request, fuse_ino_t parent_id,
+                                           const char* name, fuse_ino_t new_parent_id,
+                                           const char* new_name) {
+  LOG(kInfo) << "OpsRename: " << parent_id << " / " << name << " to " << new_parent_id << " / "
+             << new_name;
+  auto& drive(GetDrive(request));
+  try {
+    const auto old_relative_path(drive.nodes_.GetRelativePath(parent_id) / name);
+    const auto new_relative_path(drive.nodes_.GetRelativePath(new_parent_id) / new_name);
+    if (old_relative_path != new_relative_path) {
+      drive.Rename(old_relative_path, new_relative_path);
+      drive.nodes_.MoveNode(parent_id, name, new_parent_id, new_name);
+    }
+  } catch (const std::exception& e) {
+    LOG(kError) << "Failed to rename " << name << " to " << new_name << ": " << e.what();
+    fuse_reply_err(request, detail::ToErrorNumber(e));
+    return;
+  }
+  fuse_reply_err(request, 0);
+}
+
+// Quote from FUSE documentation:
+//
+// Remove a directory.
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::OpsRmdir(fuse_req_t request, fuse_ino_t parent_id,
+                                          const char* name) {
+  LOG(kInfo) << "OpsRmdir: " << parent_id << " / " << name;
+  auto& drive(GetDrive(request));
+  try {
+    const auto relative_path(drive.nodes_.GetRelativePath(parent_id) / name);
+    if (!drive.GetDirectory(relative_path)->empty()) {
+      fuse_reply_err(request, ENOTEMPTY);
+      return;
+    }
+    drive.Delete(relative_path);
+    drive.nodes_.UnlinkNode(parent_id, name);
+  } catch (const std::exception& e) {
+    LOG(kError) << "OpsRmdir: " << parent_id << " / " << name << ": " << e.what();
+    fuse_reply_err(request, detail::ToErrorNumber(e));
+    return;
+  }
+  fuse_reply_err(request, 0);
+}
+
+// Quote from FUSE documentation:
+//
+// Set file attributes.
+//
+// In the 'attr' argument only members indicated by the 'to_set' bitmask contain valid values.
+// Other members contain undefined values.
+//
+// If the setattr was invoked from the ftruncate() system call under Linux kernel versions 2.6.15 or
+// later, the fi->fh will contain the value set by the open method or will be undefined if the open
+// method didn't set any value.  Otherwise (not ftruncate call, or kernel version earlier than
+// 2.6.15) the fi parameter will be NULL.
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::OpsSetattr(fuse_req_t request, fuse_ino_t node_id,
+                                            struct stat* attributes, int to_set,
+                                            struct fuse_file_info* file_info) {
+  LOG(kInfo) << "OpsSetattr: " << node_id << ", to_set: 0x" << std::hex << to_set;
+  // Permissions and ownership cannot be changed at the moment
+  if (to_set & (FUSE_SET_ATTR_MODE | FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)) {
+    fuse_reply_err(request, EPERM);
+    return;
+  }
+  auto& drive(GetDrive(request));
+  try {
+    const auto path(drive.nodes_.GetPath(node_id));
+    if (to_set & FUSE_SET_ATTR_SIZE) {
+      if (attributes->st_size < 0) {
+        fuse_reply_err(request, EINVAL);
+        return;
+      }
+      const auto file(drive.GetOpenFile(node_id, file_info));
+      if (file_info != nullptr) {
+        file->Truncate(attributes->st_size);
+      } else {
+        // truncate() on a file which isn't open
+        drive.Open(*file);
+        try {
+          file->Truncate(attributes->st_size);
+        } catch (...) {
+          file->Close();
+          throw;
+        }
+        file->Close();
+      }
+    }
+
+    int times_to_set(FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME);
+#ifdef FUSE_SET_ATTR_ATIME_NOW
+    times_to_set |= FUSE_SET_ATTR_ATIME_NOW | FUSE_SET_ATTR_MTIME_NOW;
+#endif
+    if (to_set & times_to_set) {
+      {
+        const auto now(common::Clock::now());
+        const std::lock_guard<std::mutex> lock(path->meta_data_mutex);
+        if (to_set & FUSE_SET_ATTR_ATIME)
+          path->meta_data.set_last_access_time(
+              detail::ToTimePoint(detail::AccessTime(*attributes)));
+        if (to_set & FUSE_SET_ATTR_MTIME)
+          path->meta_data.set_last_write_time(
+              detail::ToTimePoint(detail::ModificationTime(*attributes)));
+#ifdef FUSE_SET_ATTR_ATIME_NOW
+        if (to_set & FUSE_SET_ATTR_ATIME_NOW)
+          path->meta_data.set_last_access_time(now);
+        if (to_set & FUSE_SET_ATTR_MTIME_NOW)
+          path->meta_data.set_last_write_time(now);
+#endif
+        path->meta_data.set_status_time(now);
+      }
+      path->ScheduleForStoring();
+    }
+
+    const auto result(drive.GetAttributes(node_id, *path));
+    fuse_reply_attr(request, &result, GetDrive(request).cache_timeouts_.attr);
+  } catch (const std::exception& e) {
+    LOG(kWarning) << "Failed to set attributes of " << node_id << ": " << e.what();
+    fuse_reply_err(request, detail::ToErrorNumber(e));
+  }
+}
+
+// Quote from FUSE documentation:
+//
+// Get file system statistics.
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::OpsStatfs(fuse_req_t request, fuse_ino_t node_id) {
+  LOG(kInfo) << "OpsStatfs: " << node_id;
+  struct statvfs stbuf;
+  std::memset(&stbuf, 0, sizeof(stbuf));
+  // Although POSIX states that there is no correspondence between st_blksize and
+  // f_bsize, we set them the the same value for convenience.  Block counts are in f_frsize units.
+  stbuf.f_bsize = detail::kOptimalIoSize;
+  stbuf.f_frsize = detail::kFileBlockSize;
+  stbuf.f_blocks = (std::numeric_limits<int64_t>::max() - 10000) / stbuf.f_frsize;
+  stbuf.f_bfree = (std::numeric_limits<int64_t>::max() - 10000) / stbuf.f_frsize;
+  stbuf.f_bavail = stbuf.f_bfree;
+  fuse_reply_statfs(request, &stbuf);
+}
+
+// Quote from FUSE documentation:
+//
+// Create a symbolic link.
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::OpsSymlink(fuse_req_t request, const char* link,
+                                            fuse_ino_t parent_id, const char* name) {
+  LOG(kInfo) << "OpsSymlink: " << parent_id << " / " << name << " --> " << link;
+  if (detail::ExcludedFilename(fs::path(name).stem().string())) {
+    LOG(kError) << "Invalid name: " << name;
+    fuse_reply_err(request, EINVAL);
+    return;
+  }
+  auto& drive(GetDrive(request));
+  try {
+    const auto relative_path(drive.nodes_.GetRelativePath(parent_id) / name);
+    const auto symlink(detail::Symlink::Create(fs::path(name), fs::path(link)));
+    drive.Create(relative_path, symlink);
+    drive.ReplyEntry(request, parent_id, name, symlink);
+  } catch (const std::exception& e) {
+    LOG(kError) << "OpsSymlink: " << name << " -> " << link << ": " << e.what();
+    fuse_reply_err(request, detail::ToErrorNumber(e));
+  }
+}
+
+// Quote from FUSE documentation:
+//
+// Remove a file.
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::OpsUnlink(fuse_req_t request, fuse_ino_t parent_id,
+                                           const char* name) {
+  LOG(kInfo) << "OpsUnlink: " << parent_id << " / " << name;
+  auto& drive(GetDrive(request));
+  try {
+    const auto relative_path(drive.nodes_.GetRelativePath(parent_id) / name);
+    drive.Delete(relative_path);
+    // Any node for the file stays valid (e.g. for open handles) until the kernel forgets it.
+    drive.nodes_.UnlinkNode(parent_id, name);
+  } catch (const std::exception& e) {
+    LOG(kError) << "OpsUnlink: " << parent_id << " / " << name << ": " << e.what();
+    fuse_reply_err(request, detail::ToErrorNumber(e));
+    return;
+  }
+  fuse_reply_err(request, 0);
+}
+
+// Quote from FUSE documentation:
+//
+// Write data.
+//
+// Write should return exactly the number of bytes requested except on error.
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::OpsWrite(fuse_req_t request, fuse_ino_t node_id, const char* buf,
+                                          size_t size, off_t offset,
+                                          struct fuse_file_info* file_info) {
+  LOG(kInfo) << "OpsWrite: " << node_id << ", flags: 0x" << std::hex << file_info->flags
+             << std::dec << " Size : " << size << " Offset : " << offset;
+  if (offset < 0) {
+    fuse_reply_err(request, EINVAL);
+    return;
+  }
+  auto& drive(GetDrive(request));
+  const detail::ScopedLatency latency(drive.write_latency_);
+  try {
+    const auto file(drive.GetOpenFile(node_id, file_info));
+    const std::uint32_t write_size(
+        static_cast<std::uint32_t>(std::min<std::size_t>(std::numeric_limits<int>::max(), size)));
+    fuse_reply_write(request, file->Write(buf, write_size, offset));
+  } catch (const std::exception& e) {
+    LOG(kWarning) << "Failed to write " << node_id << ": " << e.what();
+    fuse_reply_err(request, detail::ToErrorNumber(e));
+  }
+}
+
+#if FUSE_VERSION >= 29
+// Quote from FUSE documentation:
+//
+// Write data made available in a buffer.
+//
+// This is a more generic version of the ->write() method.  If FUSE_CAP_SPLICE_READ is set in
+// fuse_conn_info.want and the kernel supports splicing from the fuse device, then the data will be
+// made available in pipe for supporting zero copy data transfer.
+template <typename Storage>
+void FuseLowLevelDrive<Storage>::OpsWriteBuf(fuse_req_t request, fuse_ino_t node_id,
+                                             struct fuse_bufvec* buffers, off_t offset,
+                                             struct fuse_file_info* file_info) {
+  LOG(kInfo) << "OpsWriteBuf: " << node_id << ", flags: 0x" << std::hex << file_info->flags
+             << std::dec << " Size : " << fuse_buf_size(buffers) << " Offset : " << offset;
+  if (offset < 0) {
+    fuse_reply_err(request, EINVAL);
+    return;
+  }
+  auto& drive(GetDrive(request));
+  const detail::ScopedLatency latency(drive.write_latency_);
+  try {
+    const auto file(drive.GetOpenFile(node_id, file_info));
+    fuse_reply_write(request, detail::WriteBuffers(*file, *buffers, offset));
+  } catch (const std::exception& e) {
+    LOG(kWarning) << "Failed to write " << node_id << ": " << e.what();
+    fuse_reply_err(request, detail::ToErrorNumber(e));
+  }
+}
+#endif
+
+}  // namespace drive
+
+}  // namespace maidsafe
+
+#endif  // MAIDSAFE_DRIVE_UNIX_LOW_LEVEL_DRIVE_H_
@@ -108,7 +108,9 @@ class CbfsDrive : public Drive<Storage> {
   CbfsDrive(std::shared_ptr<Storage> storage, const Identity& unique_user_id,
             const Identity& root_parent_id, const boost::filesystem::path& mount_dir,
             const boost::filesystem::path& user_app_dir, const boost::filesystem::path& drive_name,
-            std::string mount_status_shared_object_name, bool create, std::string guid);
+            std::string mount_status_shared_object_name, bool create, std::string guid,
+            std::uint64_t chunk_cache_size = detail::kDefaultChunkCacheSize,
+            bool write_behind = false);
 
   virtual ~CbfsDrive();
 
@@ -214,9 +216,10 @@ CbfsDrive<Storage>::CbfsDrive(std::shared_ptr<Storage> storage, const Identity&
                               const boost::filesystem::path& user_app_dir,
                               const boost::filesystem::path& drive_name,
                               std::string mount_status_shared_object_name, bool create,
-                              std::string guid)
+                              std::string guid, std::uint64_t chunk_cache_size,
+                              bool write_behind)
     : Drive(storage, unique_user_id, root_parent_id, mount_dir, user_app_dir,
-            std::move(mount_status_shared_object_name), create),
+            std::move(mount_status_shared_object_name), create, chunk_cache_size, write_behind),
       process_owner_(),
       callback_filesystem_(),
       icon_id_(L"MaidSafeDriveIcon"),
@@ -1217,6 +1220,7 @@ void CbfsDrive<Storage>::CbFsWriteFile(CallbackFileSystem* sender, CbFsFileInfo*
   const auto relative_path(detail::GetRelativePath<Storage>(cbfs_drive, file_info));
   LOG(kInfo) << "CbFsWriteFile- " << relative_path << " writing " << bytes_to_write
              << " bytes at position " << position;
+  const detail::ScopedLatency latency(cbfs_drive->write_latency_);
   try {
     const auto write_file = cbfs_drive->template GetMutableContext<detail::File>(relative_path);
     if (write_file == nullptr) {
@@ -1344,8 +1348,11 @@ void CbfsDrive<Storage>::CbFsFlushFile(CallbackFileSystem* sender, CbFsFileInfo*
   assert(file_info != nullptr);
   const auto relative_path(detail::GetRelativePath<Storage>(cbfs_drive, file_info));
   LOG(kInfo) << "CbFsFlushFile - " << relative_path;
+  std::shared_ptr<detail::File> file;
   try {
-    cbfs_drive->GetMutableContext(relative_path)->ScheduleForStoring();
+    const auto context(cbfs_drive->GetMutableContext(relative_path));
+    context->ScheduleForStoring();
+    file = std::dynamic_pointer_cast<detail::File>(context);
   } catch (const maidsafe_error& error) {
     LOG(kWarning) << "CbFsFlushFile " << relative_path << ": " << error.what();
     if (error.code() == make_error_code(DriveErrors::no_such_file)) {
@@ -1353,6 +1360,14 @@ void CbfsDrive<Storage>::CbFsFlushFile(CallbackFileSystem* sender, CbFsFileInfo*
     }
     throw ECBFSError(ERROR_FUNCTION_FAILED);
   }
+  try {
+    if (file != nullptr)
+      file->Flush();
+  } catch (const std::exception& e) {
+    // A write acknowledged in write-behind mode never reached the encryptor.
+    LOG(kError) << "CbFsFlushFile " << relative_path << ": " << e.what();
+    throw ECBFSError(ERROR_WRITE_FAULT);
+  }
 }
 
 // Quote from CBFS documentation:
@@ -0,0 +1,165 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#include "maidsafe/drive/buffer_budget.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace maidsafe {
+
+namespace drive {
+
+namespace detail {
+
+BufferBudget::BufferBudget(std::uint64_t max_memory, std::uint64_t max_disk,
+                           std::uint64_t max_memory_per_buffer, std::uint64_t max_disk_per_buffer,
+                           std::shared_ptr<SpillStore> spill_store, std::uint64_t min_per_buffer,
+                           std::chrono::steady_clock::duration release_wait)
+    : max_memory_(max_memory),
+      max_disk_(max_disk),
+      max_memory_per_buffer_(max_memory_per_buffer),
+      max_disk_per_buffer_(max_disk_per_buffer),
+      spill_store_(std::move(spill_store)),
+      min_memory_per_buffer_(std::min(min_per_buffer, max_memory_per_buffer)),
+      min_disk_per_buffer_(std::min(min_per_buffer, max_disk_per_buffer)),
+      release_wait_(release_wait),
+      mutex_(),
+      returned_(),
+      memory_granted_(0),
+      disk_granted_(0),
+      shortfalls_(0),
+      overcommits_(0),
+      grants_() {}
+
+std::unique_ptr<BufferBudget::Grant> BufferBudget::Acquire(ReleaseFunctor release) {
+  std::vector<ReleaseFunctor> releases;
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (MemoryLeft() < max_memory_per_buffer_ || DiskLeft() < max_disk_per_buffer_) {
+    ++shortfalls_;
+    // Ask enough of the coldest idle buffers to cover the shortfall to give theirs back.
+    std::uint64_t memory_wanted(max_memory_per_buffer_ - MemoryLeft()),
+        disk_wanted(max_disk_per_buffer_ - DiskLeft());
+    for (auto itr(std::begin(grants_));
+         itr != std::end(grants_) && (memory_wanted != 0 || disk_wanted != 0); ++itr) {
+      if (!(*itr)->idle_ || (*itr)->release_requested_ || !(*itr)->release_)
+        continue;
+      (*itr)->release_requested_ = true;
+      releases.push_back((*itr)->release_);
+      memory_wanted -= std::min(memory_wanted, (*itr)->memory_);
+      disk_wanted -= std::min(disk_wanted, (*itr)->disk_);
+    }
+  }
+
+  const auto minimum_left([this] {
+    return MemoryLeft() >= min_memory_per_buffer_ && DiskLeft() >= min_disk_per_buffer_;
+  });
+  if (!minimum_left()) {
+    lock.unlock();
+    for (const auto& release_functor : releases)
+      release_functor();
+    releases.clear();
+    lock.lock();
+    if (!returned_.wait_for(lock, release_wait_, minimum_left))
+      ++overcommits_;
+  }
+
+  const std::uint64_t memory(std::max(MemoryLeft(), min_memory_per_buffer_));
+  const std::uint64_t disk(std::max(DiskLeft(), min_disk_per_buffer_));
+  std::unique_ptr<Grant> grant(new Grant(shared_from_this(), memory, disk, std::move(release)));
+  memory_granted_ += memory;
+  disk_granted_ += disk;
+  grant->position_ = grants_.insert(std::end(grants_), grant.get());
+  lock.unlock();
+
+  for (const auto& release_functor : releases)
+    release_functor();
+  return grant;
+}
+
+std::uint64_t BufferBudget::MemoryLeft() const {
+  return memory_granted_ >= max_memory_
+             ? 0
+             : std::min(max_memory_per_buffer_, max_memory_ - memory_granted_);
+}
+
+std::uint64_t BufferBudget::DiskLeft() const {
+  return disk_granted_ >= max_disk_ ? 0
+                                    : std::min(max_disk_per_buffer_, max_disk_ - disk_granted_);
+}
+
+std::uint64_t BufferBudget::memory_granted() const {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  return memory_granted_;
+}
+
+std::uint64_t BufferBudget::disk_granted() const {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  return disk_granted_;
+}
+
+std::size_t BufferBudget::buffer_count() const {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  return grants_.size();
+}
+
+std::uint64_t BufferBudget::shortfalls() const {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  return shortfalls_;
+}
+
+std::uint64_t BufferBudget::overcommits() const {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  return overcommits_;
+}
+
+BufferBudget::Grant::Grant(std::shared_ptr<BufferBudget> budget, std::uint64_t memory,
+                           std::uint64_t disk, ReleaseFunctor release)
+    : budget_(std::move(budget)),
+      memory_(memory),
+      disk_(disk),
+      release_(std::move(release)),
+      idle_(false),
+      release_requested_(false),
+      position_() {}
+
+BufferBudget::Grant::~Grant() {
+  {
+    const std::lock_guard<std::mutex> lock(budget_->mutex_);
+    budget_->memory_granted_ -= memory_;
+    budget_->disk_granted_ -= disk_;
+    budget_->grants_.erase(position_);
+  }
+  budget_->returned_.notify_all();
+}
+
+void BufferBudget::Grant::SetIdle(bool idle) {
+  const std::lock_guard<std::mutex> lock(budget_->mutex_);
+  idle_ = idle;
+  if (!idle) {
+    release_requested_ = false;
+    budget_->grants_.splice(std::end(budget_->grants_), budget_->grants_, position_);
+  }
+}
+
+}  // namespace detail
+
+}  // namespace drive
+
+}  // namespace maidsafe
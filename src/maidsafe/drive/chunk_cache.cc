@@ -0,0 +1,102 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#include "maidsafe/drive/chunk_cache.h"
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+
+namespace maidsafe {
+
+namespace drive {
+
+namespace detail {
+
+ChunkCache::ChunkCache(std::uint64_t capacity, std::size_t shard_count)
+    : capacity_(capacity),
+      shard_capacity_(capacity / std::max<std::size_t>(shard_count, 1)),
+      shards_(new Shard[std::max<std::size_t>(shard_count, 1)]),
+      shard_count_(std::max<std::size_t>(shard_count, 1)),
+      hits_(0),
+      misses_(0),
+      evictions_(0) {}
+
+bool ChunkCache::Get(const std::string& name, NonEmptyString& content) {
+  Shard& shard(GetShard(name));
+  const std::lock_guard<std::mutex> lock(shard.mutex);
+  const auto itr(shard.index.find(name));
+  if (itr == std::end(shard.index)) {
+    ++misses_;
+    return false;
+  }
+  shard.entries.splice(std::begin(shard.entries), shard.entries, itr->second);
+  content = itr->second->second;
+  ++hits_;
+  return true;
+}
+
+bool ChunkCache::Contains(const std::string& name) const {
+  const Shard& shard(GetShard(name));
+  const std::lock_guard<std::mutex> lock(shard.mutex);
+  return shard.index.count(name) != 0;
+}
+
+void ChunkCache::Put(const std::string& name, const NonEmptyString& content) {
+  const std::uint64_t content_size(content.string().size());
+  if (content_size > shard_capacity_)
+    return;
+
+  Shard& shard(GetShard(name));
+  const std::lock_guard<std::mutex> lock(shard.mutex);
+  const auto itr(shard.index.find(name));
+  if (itr != std::end(shard.index)) {
+    shard.entries.splice(std::begin(shard.entries), shard.entries, itr->second);
+    return;
+  }
+
+  while (shard.size + content_size > shard_capacity_) {
+    assert(!shard.entries.empty());
+    shard.size -= shard.entries.back().second.string().size();
+    shard.index.erase(shard.entries.back().first);
+    shard.entries.pop_back();
+    ++evictions_;
+  }
+  shard.entries.emplace_front(name, content);
+  shard.index.emplace(name, std::begin(shard.entries));
+  shard.size += content_size;
+}
+
+std::uint64_t ChunkCache::size() const {
+  std::uint64_t total(0);
+  for (std::size_t i(0); i != shard_count_; ++i) {
+    const std::lock_guard<std::mutex> lock(shards_[i].mutex);
+    total += shards_[i].size;
+  }
+  return total;
+}
+
+ChunkCache::Shard& ChunkCache::GetShard(const std::string& name) const {
+  return shards_[std::hash<std::string>()(name) % shard_count_];
+}
+
+}  // namespace detail
+
+}  // namespace drive
+
+}  // namespace maidsafe
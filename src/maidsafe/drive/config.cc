@@ -29,7 +29,9 @@ const boost::filesystem::path kRoot(boost::filesystem::path("/").make_preferred(
 const MaxVersions kMaxVersions(1);
 
 const std::chrono::steady_clock::duration kDirectoryInactivityDelay(std::chrono::seconds(3));
-const std::chrono::steady_clock::duration kFileInactivityDelay(std::chrono::seconds(2));
+const std::chrono::steady_clock::duration kFileInactivityDelay(std::chrono::seconds(10));
+const std::chrono::steady_clock::duration kBufferGrantWait(std::chrono::seconds(1));
+const std::chrono::steady_clock::duration kRemoteChangePollInterval(std::chrono::seconds(10));
 
 }  // namespace detail
 
@@ -20,9 +20,11 @@
 
 #include <algorithm>
 #include <iterator>
+#include <map>
 
 #include "boost/asio/placeholders.hpp"
 
+#include "maidsafe/common/on_scope_exit.h"
 #include "maidsafe/common/profiler.h"
 
 #include "maidsafe/drive/meta_data.h"
@@ -37,6 +39,28 @@ namespace drive {
 
 namespace detail {
 
+namespace {
+
+// Everything about a child which is persisted in its parent's listing.
+std::string Fingerprint(const Path& path) {
+  protobuf::Attributes attributes;
+  const std::lock_guard<std::mutex> lock(path.meta_data_mutex);
+  path.meta_data.ToProtobuf(attributes);
+  std::string fingerprint(attributes.SerializeAsString());
+  if (path.meta_data.directory_id()) {
+    fingerprint += path.meta_data.directory_id()->string();
+  } else if (path.meta_data.inline_content()) {
+    fingerprint += *path.meta_data.inline_content();
+  } else if (path.meta_data.data_map()) {
+    std::string serialised_data_map;
+    encrypt::SerialiseDataMap(*path.meta_data.data_map(), serialised_data_map);
+    fingerprint += serialised_data_map;
+  }
+  return fingerprint;
+}
+
+}  // unnamed namespace
+
 Directory::Directory(ParentId parent_id, DirectoryId directory_id,
                      boost::asio::io_service& io_service,
                      std::weak_ptr<Directory::Listener> listener,
@@ -54,7 +78,13 @@ Directory::Directory(ParentId parent_id, DirectoryId directory_id,
       listener_(listener),
       newParent_(),
       pending_count_(0),
-      mutex_() {}
+      sync_started_(0),
+      sync_completed_(0),
+      sync_in_progress_(false),
+      sync_error_(),
+      sync_condition_(),
+      mutex_(),
+      store_mutex_() {}
 
 Directory::Directory(ParentId parent_id, const std::string&,
                      const std::vector<StructuredDataVersions::VersionName>& versions,
@@ -74,7 +104,13 @@ Directory::Directory(ParentId parent_id, const std::string&,
       listener_(listener),
       newParent_(),
       pending_count_(0),
-      mutex_() {}
+      sync_started_(0),
+      sync_completed_(0),
+      sync_in_progress_(false),
+      sync_error_(),
+      sync_condition_(),
+      mutex_(),
+      store_mutex_() {}
 
 Directory::~Directory() {
   try {
@@ -137,11 +173,17 @@ void Directory::Serialise(protobuf::Directory& proto_directory,
     listener->IncrementChunks(chunks);
   }
   chunks.clear();
+  const std::lock_guard<std::mutex> lock(mutex_);
   store_state_ = StoreState::kOngoing;
 }
 
 size_t Directory::VersionsCount() const { return versions_.size(); }
 
+StructuredDataVersions::VersionName Directory::CurrentVersion() const {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  return versions_.empty() ? StructuredDataVersions::VersionName() : versions_.front();
+}
+
 std::tuple<DirectoryId, StructuredDataVersions::VersionName> Directory::InitialiseVersions(
     ImmutableData::Name version_id) {
   std::tuple<DirectoryId, StructuredDataVersions::VersionName> result;
@@ -216,6 +258,26 @@ void Directory::DoScheduleForStoring() {
 }
 
 void Directory::ProcessTimer(const boost::system::error_code& ec) {
+  try {
+    Store(ec);
+  } catch (const std::exception& e) {
+    const std::lock_guard<std::mutex> lock(mutex_);
+    LOG(kError) << "Failed to store " << path_ << ": " << e.what();
+  }
+}
+
+void Directory::Store(const boost::system::error_code& ec) {
+  const on_scope_exit finished([this] {
+    const std::lock_guard<std::mutex> lock(mutex_);
+    // Update pending parent change
+    if (newParent_) {
+      parent_id_ = newParent_->parent_id_;
+      path_ = newParent_->path_;
+      newParent_ = nullptr;
+    }
+    --pending_count_;
+  });
+
   std::shared_ptr<Listener> listener;
   {
     const std::unique_lock<std::mutex> lock(mutex_);
@@ -235,19 +297,9 @@ void Directory::ProcessTimer(const boost::system::error_code& ec) {
   }
 
   if (listener) {
+    const std::lock_guard<std::mutex> store_lock(store_mutex_);
     listener->Put(shared_from_this());
   }
-
-  {
-    const std::lock_guard<std::mutex> lock(mutex_);
-    // Update pending parent change
-    if (newParent_) {
-      parent_id_ = newParent_->parent_id_;
-      path_ = newParent_->path_;
-      newParent_ = nullptr;
-    }
-    --pending_count_;
-  }
 }
 
 std::shared_ptr<Directory::Listener> Directory::GetListener() const { return listener_.lock(); }
@@ -269,6 +321,11 @@ std::shared_ptr<const Path> Directory::GetChildAndIncrementCounter() {
   return std::shared_ptr<const File>();
 }
 
+std::vector<std::shared_ptr<const Path>> Directory::GetChildren() const {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  return std::vector<std::shared_ptr<const Path>>(std::begin(children_), std::end(children_));
+}
+
 void Directory::AddChild(std::shared_ptr<Path> child) {
   const std::lock_guard<std::mutex> lock(mutex_);
   auto itr(Find(child->meta_data.name()));
@@ -298,7 +355,10 @@ void Directory::RenameChild(const fs::path& old_name, const fs::path& new_name)
   auto itr(Find(old_name));
   if (itr == std::end(children_))
     BOOST_THROW_EXCEPTION(MakeError(DriveErrors::no_such_file));
-  (*itr)->meta_data.set_name(new_name);
+  {
+    const std::lock_guard<std::mutex> meta_data_lock((*itr)->meta_data_mutex);
+    (*itr)->meta_data.set_name(new_name);
+  }
   SortAndResetChildrenCounter();
   DoScheduleForStoring();
 }
@@ -360,6 +420,95 @@ void Directory::StoreImmediatelyIfPending() {
   ProcessTimer(boost::system::error_code());
 }
 
+void Directory::Sync() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  // Any store which starts after this point includes everything done before the call.
+  const std::uint64_t generation(sync_started_ + 1);
+  sync_condition_.wait(lock, [&] { return !sync_in_progress_ || sync_completed_ >= generation; });
+  if (sync_completed_ >= generation) {
+    LOG(kInfo) << "Sync of " << path_ << " satisfied by group commit " << sync_completed_;
+    if (sync_completed_ == generation && sync_error_)
+      std::rethrow_exception(sync_error_);
+    return;
+  }
+
+  sync_in_progress_ = true;
+  sync_started_ = generation;
+  lock.unlock();
+  std::exception_ptr error;
+  try {
+    StoreNow();
+  } catch (...) {
+    error = std::current_exception();
+  }
+  lock.lock();
+  sync_in_progress_ = false;
+  sync_completed_ = generation;
+  sync_error_ = error;
+  lock.unlock();
+  sync_condition_.notify_all();
+  if (error)
+    std::rethrow_exception(error);
+}
+
+void Directory::StoreNow() {
+  bool pending(false);
+  {
+    const std::lock_guard<std::mutex> lock(mutex_);
+    if (store_state_ == StoreState::kPending) {
+      // If the timer has already fired its handler will store again; that store is redundant but
+      // harmless since stores are serialised.
+      timer_.cancel();
+      ++pending_count_;
+      pending = true;
+    } else {
+      LOG(kInfo) << "No store pending for " << path_ << ", waiting for any ongoing store.";
+    }
+  }
+
+  if (pending) {
+    Store(boost::system::error_code());
+  } else {
+    const std::lock_guard<std::mutex> store_lock(store_mutex_);
+  }
+}
+
+bool Directory::HasBufferedFiles() const {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  return std::any_of(std::begin(children_), std::end(children_),
+                     [](const Children::value_type& child) {
+    const auto file(std::dynamic_pointer_cast<File>(child));
+    return file != nullptr && file->IsBuffered();
+  });
+}
+
+std::vector<fs::path> Directory::ChangedChildren(const Directory& other) const {
+  std::map<fs::path, std::string> fingerprints;
+  {
+    const std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& child : children_)
+      fingerprints.emplace(child->meta_data.name(), Fingerprint(*child));
+  }
+
+  std::vector<fs::path> changed;
+  {
+    const std::lock_guard<std::mutex> lock(other.mutex_);
+    for (const auto& child : other.children_) {
+      const auto itr(fingerprints.find(child->meta_data.name()));
+      if (itr == std::end(fingerprints)) {
+        changed.push_back(child->meta_data.name());
+      } else {
+        if (itr->second != Fingerprint(*child))
+          changed.push_back(child->meta_data.name());
+        fingerprints.erase(itr);
+      }
+    }
+  }
+  for (const auto& removed : fingerprints)
+    changed.push_back(removed.first);
+  return changed;
+}
+
 bool Directory::HasPending() const {
   const std::lock_guard<std::mutex> lock(mutex_);
   return (pending_count_ != 0);
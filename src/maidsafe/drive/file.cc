@@ -18,6 +18,11 @@
 
 #include "maidsafe/drive/file.h"
 
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <string>
+#include <unordered_set>
 #include <utility>
 
 #include "maidsafe/common/make_unique.h"
@@ -40,27 +45,77 @@ std::shared_ptr<Directory::Listener> GetDirectoryListener(
   }
   return nullptr;
 }
+
+// Stores the parent of a file which was stored while the file's chunks were pending.
+void StoreDeferred(const std::weak_ptr<File>& file) {
+  const std::shared_ptr<File> file_shared(file.lock());
+  if (file_shared)
+    file_shared->ScheduleForStoring();
+}
+
+void PutChunks(const std::shared_ptr<Directory::Listener>& listener,
+               const std::vector<std::pair<std::string, NonEmptyString>>& chunks) {
+  if (!listener)
+    return;
+  std::vector<boost::future<void>> put_requests;
+  put_requests.reserve(chunks.size());
+  for (const auto& chunk : chunks)
+    put_requests.push_back(listener->PutChunk(ImmutableData(chunk.second)));
+  boost::wait_for_all(put_requests.begin(), put_requests.end());
+}
 }
 
 File::File(boost::asio::io_service& asio_service, MetaData meta_data_in,
            std::shared_ptr<Directory> parent_in)
     : Path(parent_in, meta_data_in.file_type()),
       file_data_(),
-      close_timer_(asio_service),
+      open_buffer_(),
+      inline_open_count_(0),
+      readahead_(),
+      pending_chunks_(std::make_shared<PendingChunks>()),
+      upload_service_(nullptr),
+      buffer_grant_(),
+      write_queue_(),
+      write_behind_service_(nullptr),
+      io_service_(asio_service),
+      keep_alive_cache_(),
       data_mutex_(),
-      skip_chunk_incrementing_(false) {
+      encryptor_mutex_(),
+      write_count_(0),
+      skip_chunk_incrementing_(false),
+      published_(),
+      unpublished_(),
+      unpublished_chunks_() {
   meta_data = std::move(meta_data_in);
+  if (meta_data.file_type() == MetaData::FileType::regular_file)
+    Serialise(published_);
 }
 
 File::File(boost::asio::io_service& asio_service, const boost::filesystem::path& name,
            bool is_directory)
     : Path(is_directory ? MetaData::FileType::directory_file : MetaData::FileType::regular_file),
       file_data_(),
-      close_timer_(asio_service),
+      open_buffer_(),
+      inline_open_count_(0),
+      readahead_(),
+      pending_chunks_(std::make_shared<PendingChunks>()),
+      upload_service_(nullptr),
+      buffer_grant_(),
+      write_queue_(),
+      write_behind_service_(nullptr),
+      io_service_(asio_service),
+      keep_alive_cache_(),
       data_mutex_(),
-      skip_chunk_incrementing_(false) {
+      encryptor_mutex_(),
+      write_count_(0),
+      skip_chunk_incrementing_(false),
+      published_(),
+      unpublished_(),
+      unpublished_chunks_() {
   meta_data = MetaData(name, is_directory ? MetaData::FileType::directory_file
                                           : MetaData::FileType::regular_file);
+  if (!is_directory)
+    Serialise(published_);
 }
 
 File::~File() {
@@ -73,12 +128,15 @@ File::~File() {
      flushing/serialisation before destructing the files. However, a file can be
      created, closed, and deleted before cleanup timers execute. */
   try {
-    close_timer_.cancel();
+    if (keep_alive_cache_)
+      keep_alive_cache_->Remove(this);
     if (HasBuffer()) {
       assert(!file_data_->IsOpen());
+      FlushCoalescedWrites();
       file_data_->self_encryptor_.Close();
       file_data_.reset();
     }
+    buffer_grant_.reset();
   } catch (...) {
   }
 }
@@ -87,20 +145,20 @@ std::string File::Serialise() { return std::string(); }
 
 void File::Serialise(protobuf::Directory& proto_directory,
                      std::vector<ImmutableData::Name>& chunks) {
-  const std::lock_guard<std::mutex> lock(data_mutex_);
-
+  const boost::unique_lock<boost::shared_mutex> lock(data_mutex_);
   if (HasBuffer()) {
     assert(meta_data.data_map() != nullptr);
-
-    auto original_parameters = std::move(file_data_->original_parameters_);
-    const unsigned current_open_count = file_data_->open_count_;
-    CloseEncryptor(chunks);
-
-    // If the above throws, leave the current object. SelfEncryptor will only
-    // throw if someone tries to write (reads and closes are NOP).
-    file_data_ = maidsafe::make_unique<Data>(std::move(original_parameters), meta_data.name(),
-                                             *(meta_data.data_map()));
-    file_data_->open_count_ = current_open_count;
+    if (!CheckpointEncryptor(chunks)) {
+      // Only this file is held back: its last published entry is serialised, and the parent is
+      // stored again once the application has been told and writes or closes the file.
+      LOG(kWarning) << "Keeping the last stored data map of " << meta_data.name()
+                    << " until its failed writes are reported";
+      auto child = proto_directory.add_children();
+      child->CopyFrom(published_);
+      const std::lock_guard<std::mutex> meta_data_lock(meta_data_mutex);
+      child->set_name(meta_data.name().string());
+      return;
+    }
   } else if (meta_data.data_map()) {  // still have directories being created as file objects
     if (!skip_chunk_incrementing_) {
       chunks.reserve(chunks.size() + meta_data.data_map()->chunks.size());
@@ -115,10 +173,32 @@ void File::Serialise(protobuf::Directory& proto_directory,
   // Flushing encryptor updates data map, so serialise after flush
   auto child = proto_directory.add_children();
   Serialise(*child);
+  if (meta_data.file_type() != MetaData::FileType::regular_file)
+    return;
+
+  // The data map mustn't be published until all the chunks it refers to have been stored.
+  // Rather than wait for them here, under the parent's lock, the last entry whose chunks were all
+  // stored is serialised instead, and the parent stored again once the uploads complete.
+  const std::unordered_set<std::string> pending(pending_chunks_->DeferStore());
+  if (pending.empty()) {
+    published_.CopyFrom(*child);
+    unpublished_chunks_.clear();
+    return;
+  }
+  if (!unpublished_chunks_.empty() &&
+      std::none_of(std::begin(unpublished_chunks_), std::end(unpublished_chunks_),
+                   [&pending](const std::string& name) { return pending.count(name) != 0; })) {
+    published_.Swap(&unpublished_);
+  }
+  unpublished_.CopyFrom(*child);
+  unpublished_chunks_.assign(std::begin(pending), std::end(pending));
+  child->CopyFrom(published_);
+  child->set_name(unpublished_.name());
 }
 
 void File::Serialise(protobuf::Path& proto_path) {
   assert(proto_path.mutable_attributes() != nullptr);
+  const std::lock_guard<std::mutex> lock(meta_data_mutex);
   meta_data.ToProtobuf(*(proto_path.mutable_attributes()));
   proto_path.set_name(meta_data.name().string());
   switch (meta_data.file_type()) {
@@ -126,6 +206,10 @@ void File::Serialise(protobuf::Path& proto_path) {
       proto_path.set_directory_id(meta_data.directory_id()->string());
       break;
     case fs::regular_file: {
+      if (meta_data.inline_content()) {
+        proto_path.set_inline_content(*meta_data.inline_content());
+        break;
+      }
       std::string serialised_data_map;
       encrypt::SerialiseDataMap(*meta_data.data_map(), serialised_data_map);
       proto_path.set_serialised_data_map(serialised_data_map);
@@ -140,89 +224,297 @@ void File::Serialise(protobuf::Path& proto_path) {
 
 void File::Open(const std::function<NonEmptyString(const std::string&)>& get_chunk_from_store,
                 const MemoryUsage max_memory_usage, const DiskUsage max_disk_usage,
-                const boost::filesystem::path& disk_buffer_location) {
-  const std::lock_guard<std::mutex> lock(data_mutex_);
+                const boost::filesystem::path& disk_buffer_location,
+                const Readahead::PrefetchFunctor& prefetch_chunk_from_store,
+                std::shared_ptr<ChunkCache> chunk_cache,
+                boost::asio::io_service* upload_service,
+                const std::shared_ptr<BufferBudget>& buffer_budget,
+                const std::shared_ptr<KeepAliveCache>& keep_alive_cache,
+                boost::asio::io_service* write_behind_service) {
+  const boost::unique_lock<boost::shared_mutex> lock(data_mutex_);
 
   if (meta_data.file_type() == MetaData::FileType::regular_file) {
-    assert(meta_data.data_map() != nullptr);
-    if (!HasBuffer()) {
-      file_data_ = maidsafe::make_unique<Data>(
-          Data::OriginalParameters(max_memory_usage, max_disk_usage, disk_buffer_location,
-                                   get_chunk_from_store),
-          meta_data.name(), *meta_data.data_map());
+    keep_alive_cache_ = keep_alive_cache;
+    if (!IsInline()) {
+      OpenBuffer(get_chunk_from_store, max_memory_usage, max_disk_usage, disk_buffer_location,
+                 prefetch_chunk_from_store, std::move(chunk_cache), upload_service, buffer_budget,
+                 write_behind_service);
+      return;
     }
-
-    LOG(kInfo) << "Opened " << meta_data.name() << " with open count " << file_data_->open_count_;
-
-    assert(HasBuffer());
-    close_timer_.cancel();
-    ++(file_data_->open_count_);
-    assert(file_data_->IsOpen());
+    // The buffer is only created if the file outgrows kMaxInlineFileSize.
+    open_buffer_ = [=] {
+      OpenBuffer(get_chunk_from_store, max_memory_usage, max_disk_usage, disk_buffer_location,
+                 prefetch_chunk_from_store, chunk_cache, upload_service, buffer_budget,
+                 write_behind_service);
+    };
+    ++inline_open_count_;
+    LOG(kInfo) << "Opened inline " << meta_data.name() << " with open count "
+               << inline_open_count_;
   }
 }
 
-std::uint32_t File::Read(char* data, std::uint32_t length, std::uint64_t offset) {
-  const std::lock_guard<std::mutex> lock(data_mutex_);
-  VerifyHasBuffer();
+void File::OpenBuffer(const std::function<NonEmptyString(const std::string&)>& get_chunk_from_store,
+                      const MemoryUsage max_memory_usage, const DiskUsage max_disk_usage,
+                      const boost::filesystem::path& disk_buffer_location,
+                      const Readahead::PrefetchFunctor& prefetch_chunk_from_store,
+                      std::shared_ptr<ChunkCache> chunk_cache,
+                      boost::asio::io_service* upload_service,
+                      const std::shared_ptr<BufferBudget>& buffer_budget,
+                      boost::asio::io_service* write_behind_service) {
+  assert(meta_data.data_map() != nullptr);
+  if (!readahead_)
+    readahead_ = std::make_shared<Readahead>(get_chunk_from_store, prefetch_chunk_from_store,
+                                             std::move(chunk_cache));
+  upload_service_ = upload_service;
+  if (!HasBuffer()) {
+    MemoryUsage memory_usage(max_memory_usage);
+    DiskUsage disk_usage(max_disk_usage);
+    if (buffer_budget) {
+      buffer_grant_ = buffer_budget->Acquire(MakeBufferReleaseFunctor());
+      memory_usage = MemoryUsage(std::min(memory_usage.data, buffer_grant_->memory()));
+      disk_usage = DiskUsage(std::min(disk_usage.data, buffer_grant_->disk()));
+    }
+    const std::shared_ptr<SpillStore> spill_store(
+        buffer_budget ? buffer_budget->spill_store() : nullptr);
+    // DataBuffer copies all it holds in memory to disk, so won't take less disk than memory.  With
+    // a spill store, that's all the disk it's given: the chunks it pushes out go to the store, up
+    // to the disk this buffer was allowed.
+    DiskUsage spill_usage(0);
+    if (spill_store) {
+      spill_usage = disk_usage;
+      disk_usage = DiskUsage(memory_usage.data);
+    } else {
+      disk_usage = DiskUsage(std::max(disk_usage.data, memory_usage.data));
+    }
+    const std::shared_ptr<Readahead> readahead(readahead_);
+    const std::shared_ptr<PendingChunks> pending_chunks(pending_chunks_);
+    file_data_ = maidsafe::make_unique<Data>(
+        Data::OriginalParameters(
+            memory_usage, disk_usage, disk_buffer_location,
+            [readahead, pending_chunks, spill_store](const std::string& name) {
+              NonEmptyString content;
+              if (spill_store && spill_store->Get(name, content))
+                return content;
+              if (pending_chunks->Get(name, content))
+                return content;
+              return readahead->GetChunk(name);
+            },
+            spill_store, spill_usage, MakeCanStreamFunctor()),
+        meta_data.name(), *meta_data.data_map());
+  }
 
-  LOG(kInfo) << "For " << meta_data.name() << ", reading " << length << " of "
-             << file_data_->self_encryptor_.size() << " bytes at offset " << offset;
+  LOG(kInfo) << "Opened " << meta_data.name() << " with open count " << file_data_->open_count_;
 
-  if (offset > file_data_->self_encryptor_.size()) {
-    return 0;
-  }
+  assert(HasBuffer());
+  if (keep_alive_cache_)
+    keep_alive_cache_->Remove(this);
+  if (buffer_grant_)
+    buffer_grant_->SetIdle(false);
+  ++(file_data_->open_count_);
+  assert(file_data_->IsOpen());
 
-  length =
-      std::uint32_t(std::min<std::uint64_t>(length, file_data_->self_encryptor_.size() - offset));
+  write_behind_service_ = write_behind_service;
+  const std::lock_guard<std::mutex> queue_lock(write_queue_.mutex);
+  write_queue_.enabled = (write_behind_service_ != nullptr);
+}
 
-  if (length > 0 && !file_data_->self_encryptor_.Read(data, length, offset)) {
-    BOOST_THROW_EXCEPTION(MakeError(EncryptErrors::failed_to_read));
+std::uint32_t File::Read(char* data, std::uint32_t length, std::uint64_t offset) {
+  boost::shared_lock<boost::shared_mutex> lock(data_mutex_);
+  if (IsInline()) {
+    VerifyInlineIsOpen();
+    const std::lock_guard<std::mutex> meta_data_lock(meta_data_mutex);
+    length = ReadInline(data, length, offset);
+    meta_data.UpdateLastAccessTime();
+    return length;
+  }
+  FlushCoalescedWrites(lock);
+  VerifyHasBuffer();
+  // Requesting the chunks before taking encryptor_mutex_ lets concurrent readers' fetches overlap.
+  const auto demanded(readahead_->Notify(file_data_->self_encryptor_.data_map(), offset, length));
+  const on_scope_exit release_chunks([&] { readahead_->Release(demanded); });
+  {
+    const std::lock_guard<std::mutex> encryptor_lock(encryptor_mutex_);
+    length = DoRead(data, length, offset);
   }
 
+  const std::lock_guard<std::mutex> meta_data_lock(meta_data_mutex);
   meta_data.UpdateLastAccessTime();
   return length;
 }
 
 std::uint32_t File::Write(const char* data, std::uint32_t length, std::uint64_t offset) {
-  {
-    const std::lock_guard<std::mutex> lock(data_mutex_);
-    VerifyHasBuffer();
+  // Hold the writer back, before taking the lock, while earlier streams are stored.
+  pending_chunks_->WaitUntilFewerStreaming(kMaxChunksStreaming);
+  const WriteSegment segment(data, length);
+  if (QueueWrite(&segment, 1, offset))
+    return length;
 
-    LOG(kInfo) << "For " << meta_data.name() << ", writing " << length << " bytes at offset "
-               << offset;
+  bool schedule_for_storing(true);
+  {
+    const boost::unique_lock<boost::shared_mutex> lock(data_mutex_);
+    if (KeepInline(offset + length)) {
+      ++write_count_;
+      WriteInline(data, length, offset);
+    } else {
+      VerifyHasBuffer();
+      // Anything queued before write-behind was turned off comes first.
+      DrainWriteQueue();
+      ThrowWriteBehindError();
+      ++write_count_;
+      schedule_for_storing = CoalesceWrite(data, length, offset, true);
+    }
+  }
+  // Once per extent is enough, since storing the parent flushes the extent.
+  if (schedule_for_storing)
+    ScheduleForStoring();
+  return length;
+}
 
-    if (!file_data_->self_encryptor_.Write(data, length, offset)) {
-      BOOST_THROW_EXCEPTION(MakeError(EncryptErrors::failed_to_write));
+std::uint64_t File::ReadV(const std::vector<ReadSegment>& segments, std::uint64_t offset) {
+  boost::shared_lock<boost::shared_mutex> lock(data_mutex_);
+  if (IsInline()) {
+    VerifyInlineIsOpen();
+    const std::lock_guard<std::mutex> meta_data_lock(meta_data_mutex);
+    std::uint64_t total(0);
+    for (const auto& segment : segments) {
+      const auto segment_length(ReadInline(segment.data, segment.length, offset + total));
+      total += segment_length;
+      if (segment_length < segment.length)
+        break;
+    }
+    meta_data.UpdateLastAccessTime();
+    return total;
+  }
+  FlushCoalescedWrites(lock);
+  VerifyHasBuffer();
+  std::uint64_t length(0);
+  for (const auto& segment : segments)
+    length += segment.length;
+  const auto demanded(readahead_->Notify(file_data_->self_encryptor_.data_map(), offset,
+                                         static_cast<std::uint32_t>(std::min<std::uint64_t>(
+                                             length, std::numeric_limits<std::uint32_t>::max()))));
+  const on_scope_exit release_chunks([&] { readahead_->Release(demanded); });
+  std::uint64_t total(0);
+  {
+    const std::lock_guard<std::mutex> encryptor_lock(encryptor_mutex_);
+    for (const auto& segment : segments) {
+      const auto segment_length(DoRead(segment.data, segment.length, offset + total));
+      total += segment_length;
+      if (segment_length < segment.length)
+        break;
     }
+  }
 
-    meta_data.UpdateSize(file_data_->self_encryptor_.size());
+  const std::lock_guard<std::mutex> meta_data_lock(meta_data_mutex);
+  meta_data.UpdateLastAccessTime();
+  return total;
+}
+
+std::uint64_t File::WriteV(const std::vector<WriteSegment>& segments, std::uint64_t offset) {
+  pending_chunks_->WaitUntilFewerStreaming(kMaxChunksStreaming);
+  std::uint64_t total(0);
+  if (QueueWrite(segments.data(), segments.size(), offset)) {
+    for (const auto& segment : segments)
+      total += segment.length;
+    return total;
+  }
+  {
+    const boost::unique_lock<boost::shared_mutex> lock(data_mutex_);
+    std::uint64_t length(0);
+    for (const auto& segment : segments)
+      length += segment.length;
+    if (KeepInline(offset + length)) {
+      ++write_count_;
+      for (const auto& segment : segments) {
+        WriteInline(segment.data, segment.length, offset + total);
+        total += segment.length;
+      }
+    } else {
+      VerifyHasBuffer();
+      FlushCoalescedWrites();
+      ThrowWriteBehindError();
+      ++write_count_;
+      for (const auto& segment : segments) {
+        if (segment.length == 0)
+          continue;
+        DoWrite(segment.data, segment.length, offset + total);
+        total += segment.length;
+      }
+
+      const std::lock_guard<std::mutex> meta_data_lock(meta_data_mutex);
+      SetSize(std::max(meta_data.size(), file_data_->self_encryptor_.size()), true);
+    }
   }
   ScheduleForStoring();
-  return length;
+  return total;
 }
 
 void File::Truncate(std::uint64_t offset) {
   {
-    const std::lock_guard<std::mutex> lock(data_mutex_);
-    VerifyHasBuffer();
+    const boost::unique_lock<boost::shared_mutex> lock(data_mutex_);
+    if (IsInline())
+      TruncateInline(offset);
+    else
+      TruncateBuffer(offset);
+  }
+  ScheduleForStoring();
+}
+
+void File::TruncateInline(std::uint64_t offset) {
+  VerifyInlineIsOpen();
+  ++write_count_;
+  // As for an encrypted file, growing it only lengthens the hole past the content.
+  const std::lock_guard<std::mutex> meta_data_lock(meta_data_mutex);
+  std::string& content(*meta_data.inline_content());
+  content.resize(std::min<std::uint64_t>(content.size(), offset));
+  meta_data.UpdateSize(offset);
+  meta_data.set_allocation_size(content.size());
+}
+
+void File::TruncateBuffer(std::uint64_t offset) {
+  VerifyHasBuffer();
 
-    LOG(kInfo) << "Truncating file " << meta_data.name() << " from " << meta_data.size() << " to "
-               << offset;
+  FlushCoalescedWrites();
+  ThrowWriteBehindError();
+  LOG(kInfo) << "Truncating file " << meta_data.name() << " from " << meta_data.size() << " to "
+             << offset;
+  ++write_count_;
+  // Growing the file only lengthens the hole past the encrypted data, which reads as zeros.
+  const std::uint64_t old_size(file_data_->self_encryptor_.size());
+  if (offset < old_size) {
     if (!file_data_->self_encryptor_.Truncate(offset)) {
       BOOST_THROW_EXCEPTION(MakeError(EncryptErrors::failed_to_write));
     }
-
-    meta_data.UpdateSize(file_data_->self_encryptor_.size());
+    // The last byte kept is included, since the chunk holding it changes size
+    file_data_->MarkWritten(offset == 0 ? 0 : offset - 1, old_size - offset + 1);
   }
-  ScheduleForStoring();
+
+  const std::lock_guard<std::mutex> meta_data_lock(meta_data_mutex);
+  SetSize(offset, true);
 }
 
 void File::Close() {
-  const std::lock_guard<std::mutex> lock(data_mutex_);
+  const boost::unique_lock<boost::shared_mutex> lock(data_mutex_);
   if (meta_data.file_type() == MetaData::FileType::regular_file) {
+    if (IsInline()) {
+      VerifyInlineIsOpen();
+      LOG(kInfo) << "Closing inline " << meta_data.name() << " with open count "
+                 << inline_open_count_;
+      if (--inline_open_count_ == 0)
+        open_buffer_ = nullptr;
+      return;
+    }
     VerifyHasBuffer();
 
     LOG(kInfo) << "Closing " << meta_data.name() << " with open count " << file_data_->open_count_;
+    if (file_data_->open_count_ == 1) {
+      // Nothing may be queued once the buffer can be released.
+      const std::lock_guard<std::mutex> queue_lock(write_queue_.mutex);
+      write_queue_.enabled = false;
+      write_queue_.space.notify_all();
+    }
+    // Brings the size and modification time up to date for the caller.
+    FlushCoalescedWrites();
 
     assert(file_data_->IsOpen());
     if (file_data_->IsOpen()) {
@@ -230,35 +522,154 @@ void File::Close() {
     }
 
     if (!file_data_->IsOpen()) {
-      LOG(kInfo) << "Setting close timer for " << meta_data.name();
-      close_timer_.expires_from_now(detail::kFileInactivityDelay);
-
-      const std::weak_ptr<File> this_weak(std::static_pointer_cast<File>(shared_from_this()));
-      close_timer_.async_wait([this_weak](const boost::system::error_code& error) {
-        const std::shared_ptr<File> this_shared(this_weak.lock());
-        if (this_shared != nullptr && error != boost::asio::error::operation_aborted) {
-          std::vector<ImmutableData::Name> chunks_to_be_incremented;
-          {
-            const std::lock_guard<std::mutex> lock(this_shared->data_mutex_);
-            if (this_shared->HasBuffer() && !this_shared->file_data_->IsOpen()) {
-              const on_scope_exit destroy_buffer(
-                  [this_shared] { this_shared->file_data_.reset(); });
-              this_shared->CloseEncryptor(chunks_to_be_incremented);
-              LOG(kInfo) << "Deleting encryptor and buffer for " << this_shared->meta_data.name();
-            }
-          }
-
-          if (!chunks_to_be_incremented.empty()) {
-            const std::shared_ptr<Directory::Listener> listener(
-                GetDirectoryListener(this_shared->Parent()));
-            if (listener) {
-              listener->IncrementChunks(chunks_to_be_incremented);
-            }
-          }
-        }
-      });
+      LOG(kInfo) << "Keeping alive the buffer of " << meta_data.name();
+      if (buffer_grant_)
+        buffer_grant_->SetIdle(true);
+      KeepAlive();
     }
+    ThrowWriteBehindError();
+  }
+}
+
+void File::Flush() {
+  const boost::unique_lock<boost::shared_mutex> lock(data_mutex_);
+  if (!HasBuffer())
+    return;
+  FlushCoalescedWrites();
+  ThrowWriteBehindError();
+}
+
+bool File::WaitForUploads() const { return pending_chunks_->WaitUntilStored(); }
+
+void File::KeepAlive() {
+  const std::weak_ptr<File> this_weak(std::static_pointer_cast<File>(shared_from_this()));
+  KeepAliveCache::ReleaseFunctor release([this_weak] {
+    const std::shared_ptr<File> this_shared(this_weak.lock());
+    if (this_shared != nullptr)
+      this_shared->ReleaseIdleBuffer();
+  });
+  if (keep_alive_cache_)
+    keep_alive_cache_->Add(this, std::move(release));
+  else
+    io_service_.post(std::move(release));
+}
+
+void File::ReleaseIdleBuffer() {
+  std::vector<ImmutableData::Name> chunks_to_be_incremented, chunks_to_be_decremented;
+  NewChunks new_chunks;
+  {
+    const boost::unique_lock<boost::shared_mutex> lock(data_mutex_);
+    if (!HasBuffer() || file_data_->IsOpen())
+      return;
+    // Needed if the budget rather than the cache has asked for the buffer.
+    if (keep_alive_cache_)
+      keep_alive_cache_->Remove(this);
+    const on_scope_exit destroy_buffer([this] {
+      file_data_.reset();
+      buffer_grant_.reset();
+      readahead_->Reset();
+    });
+    new_chunks = CloseEncryptor(chunks_to_be_incremented, chunks_to_be_decremented);
+    pending_chunks_->Add(new_chunks);
+    LOG(kInfo) << "Deleting encryptor and buffer for " << meta_data.name();
+  }
+
+  if (!new_chunks.empty() || !chunks_to_be_incremented.empty() ||
+      !chunks_to_be_decremented.empty()) {
+    StoreClosedChunks(std::move(new_chunks), std::move(chunks_to_be_incremented),
+                      std::move(chunks_to_be_decremented));
+  }
+}
+
+std::function<bool()> File::MakeCanStreamFunctor() {
+  const std::weak_ptr<File> this_weak(std::static_pointer_cast<File>(shared_from_this()));
+  return [this_weak] {
+    const std::shared_ptr<File> this_shared(this_weak.lock());
+    return this_shared && GetDirectoryListener(this_shared->Parent()) != nullptr;
+  };
+}
+
+void File::StreamFinalChunks() {
+  if (!upload_service_ || !file_data_->HoldsChunks())
+    return;
+  const std::shared_ptr<Directory::Listener> listener(GetDirectoryListener(Parent()));
+  if (!listener)
+    return;  // the close stores them
+  const NewChunks chunks(file_data_->TakeFinalChunks());
+  if (chunks.empty())
+    return;
+
+  LOG(kInfo) << "Streaming " << chunks.size() << " chunks of " << meta_data.name()
+             << " to storage";
+  const std::weak_ptr<File> this_weak(std::static_pointer_cast<File>(shared_from_this()));
+  const std::shared_ptr<PendingChunks> pending_chunks(pending_chunks_);
+  pending_chunks->Add(chunks, true);
+  upload_service_->post([this_weak, listener, pending_chunks, chunks] {
+    const on_scope_exit remove_pending([&] {
+      if (pending_chunks->Remove(chunks, true))
+        StoreDeferred(this_weak);
+    });
+    PutChunks(listener, chunks);
+  });
+}
+
+BufferBudget::ReleaseFunctor File::MakeBufferReleaseFunctor() {
+  // Run later, as the budget calls this while another file's lock may be held.
+  const std::weak_ptr<File> this_weak(std::static_pointer_cast<File>(shared_from_this()));
+  boost::asio::io_service& io_service(io_service_);
+  return [this_weak, &io_service] {
+    io_service.post([this_weak] {
+      const std::shared_ptr<File> this_shared(this_weak.lock());
+      if (this_shared != nullptr)
+        this_shared->ReleaseIdleBuffer();
+    });
+  };
+}
+
+void File::StoreClosedChunks(NewChunks new_chunks,
+                             std::vector<ImmutableData::Name> chunks_to_be_incremented,
+                             std::vector<ImmutableData::Name> chunks_to_be_decremented) {
+  const auto store(MakeStoreFunctor(std::move(new_chunks), std::move(chunks_to_be_incremented),
+                                    std::move(chunks_to_be_decremented)));
+  boost::asio::io_service* upload_service(nullptr);
+  {
+    const boost::shared_lock<boost::shared_mutex> lock(data_mutex_);
+    upload_service = upload_service_;
   }
+  if (upload_service)
+    upload_service->post(store);
+  else
+    store();
+}
+
+std::function<void()> File::MakeStoreFunctor(
+    NewChunks new_chunks, std::vector<ImmutableData::Name> chunks_to_be_incremented,
+    std::vector<ImmutableData::Name> chunks_to_be_decremented) {
+  const std::weak_ptr<File> this_weak(std::static_pointer_cast<File>(shared_from_this()));
+  const std::shared_ptr<Directory::Listener> listener(GetDirectoryListener(Parent()));
+  const std::shared_ptr<PendingChunks> pending_chunks(pending_chunks_);
+  return [this_weak, listener, pending_chunks, new_chunks, chunks_to_be_incremented,
+          chunks_to_be_decremented] {
+    {
+      const on_scope_exit remove_pending([&] {
+        if (pending_chunks->Remove(new_chunks))
+          StoreDeferred(this_weak);
+      });
+      PutChunks(listener, new_chunks);
+    }
+    if (listener && !chunks_to_be_incremented.empty())
+      listener->IncrementChunks(chunks_to_be_incremented);
+    if (listener && !chunks_to_be_decremented.empty()) {
+      // Streams are posted before the encryptor is closed, so are already running or done.
+      pending_chunks->WaitUntilStored(chunks_to_be_decremented);
+      listener->DecrementChunks(chunks_to_be_decremented);
+    }
+  };
+}
+
+bool File::IsBuffered() {
+  const boost::shared_lock<boost::shared_mutex> lock(data_mutex_);
+  return HasBuffer() || inline_open_count_ != 0;
 }
 
 void File::ScheduleForStoring() {
@@ -270,6 +681,65 @@ void File::ScheduleForStoring() {
 
 bool File::HasBuffer() const { return file_data_ != nullptr; }
 
+bool File::IsInline() const { return meta_data.inline_content() != nullptr; }
+
+void File::VerifyInlineIsOpen() const {
+  assert(inline_open_count_ != 0);
+  if (inline_open_count_ == 0) {
+    BOOST_THROW_EXCEPTION(MakeError(CommonErrors::null_pointer));
+  }
+}
+
+bool File::KeepInline(std::uint64_t end) {
+  if (!IsInline())
+    return false;
+  VerifyInlineIsOpen();
+  if (end <= kMaxInlineFileSize)
+    return true;
+
+  LOG(kInfo) << "Moving content of " << meta_data.name() << " out of its parent's listing";
+  open_buffer_();
+  file_data_->open_count_ = inline_open_count_;
+  inline_open_count_ = 0;
+  open_buffer_ = nullptr;
+  std::string content;
+  {
+    const std::lock_guard<std::mutex> meta_data_lock(meta_data_mutex);
+    content.swap(*meta_data.inline_content());
+    meta_data.ClearInlineContent();
+  }
+  if (!content.empty())
+    DoWrite(content.data(), static_cast<std::uint32_t>(content.size()), 0);
+  return false;
+}
+
+std::uint32_t File::ReadInline(char* data, std::uint32_t length, std::uint64_t offset) const {
+  const std::uint64_t size(meta_data.size());
+  if (offset >= size)
+    return 0;
+  length = std::uint32_t(std::min<std::uint64_t>(length, size - offset));
+  const std::string& content(*meta_data.inline_content());
+  const std::uint32_t stored(
+      offset >= content.size()
+          ? 0
+          : std::uint32_t(std::min<std::uint64_t>(length, content.size() - offset)));
+  std::copy(content.data() + offset, content.data() + offset + stored, data);
+  std::fill(data + stored, data + length, 0);
+  return length;
+}
+
+void File::WriteInline(const char* data, std::uint32_t length, std::uint64_t offset) {
+  if (length == 0)
+    return;
+  const std::lock_guard<std::mutex> meta_data_lock(meta_data_mutex);
+  std::string& content(*meta_data.inline_content());
+  if (content.size() < offset + length)
+    content.resize(offset + length, '\0');
+  std::copy(data, data + length, content.begin() + offset);
+  meta_data.UpdateSize(std::max<std::uint64_t>(meta_data.size(), offset + length));
+  meta_data.set_allocation_size(content.size());
+}
+
 void File::VerifyHasBuffer() const {
   assert(HasBuffer());
   if (!HasBuffer()) {
@@ -277,80 +747,599 @@ void File::VerifyHasBuffer() const {
   }
 }
 
-void File::CloseEncryptor(std::vector<ImmutableData::Name>& chunks_to_be_incremented) {
+bool File::CheckpointEncryptor(std::vector<ImmutableData::Name>& chunks_to_be_incremented) {
   assert(HasBuffer());
+  FlushCoalescedWrites();
+  // No version is stored without the writes which were acknowledged but failed, until the
+  // application has been told of the failure by a write, truncate, flush or close.
+  if (HasWriteBehindError())
+    return false;
+  if (file_data_->written_.empty()) {
+    // The data map in meta_data is still the encryptor's, so the encryptor and the chunks it holds
+    // can be kept.  The new directory version refers to all of the chunks again.
+    const auto& chunks(meta_data.data_map()->chunks);
+    chunks_to_be_incremented.reserve(chunks_to_be_incremented.size() + chunks.size());
+    for (const auto& chunk : chunks) {
+      chunks_to_be_incremented.emplace_back(
+          Identity(std::string(std::begin(chunk.hash), std::end(chunk.hash))));
+    }
+    return true;
+  }
 
-  const std::shared_ptr<Directory::Listener> listener = GetDirectoryListener(Parent());
-  file_data_->self_encryptor_.Close();
+  auto original_parameters = std::move(file_data_->original_parameters_);
+  const unsigned current_open_count = file_data_->open_count_;
+  std::vector<ImmutableData::Name> chunks_to_be_decremented;
+  const NewChunks new_chunks(CloseEncryptor(chunks_to_be_incremented, chunks_to_be_decremented));
+  if (upload_service_) {
+    // Until stored, the chunks are read from pending_chunks_, and the parent keeps the last data
+    // map whose chunks all were (see Serialise()).
+    pending_chunks_->Add(new_chunks);
+    upload_service_->post(MakeStoreFunctor(new_chunks, std::vector<ImmutableData::Name>(),
+                                           std::move(chunks_to_be_decremented)));
+  } else {
+    // Nothing is streamed without upload_service_, so there's no stream to wait for.
+    const std::shared_ptr<Directory::Listener> listener(GetDirectoryListener(Parent()));
+    PutChunks(listener, new_chunks);
+    if (listener && !chunks_to_be_decremented.empty())
+      listener->DecrementChunks(chunks_to_be_decremented);
+  }
+
+  // The replacement encryptor starts with an empty buffer, so the chunks just stored are cached
+  // for it rather than being fetched back from storage when next read or rewritten.
+  const std::shared_ptr<ChunkCache> chunk_cache(readahead_->chunk_cache());
+  if (chunk_cache) {
+    for (const auto& chunk : new_chunks)
+      chunk_cache->Put(chunk.first, chunk.second);
+  }
+
+  // If the above throws, leave the current object. SelfEncryptor will only
+  // throw if someone tries to write (reads and closes are NOP).
+  file_data_ = maidsafe::make_unique<Data>(std::move(original_parameters), meta_data.name(),
+                                           *(meta_data.data_map()));
+  file_data_->open_count_ = current_open_count;
+  readahead_->Reset();
+  return true;
+}
 
-  if (file_data_->self_encryptor_.original_data_map().chunks.empty()) {
-    std::vector<boost::future<void>> put_requests;
-    put_requests.reserve(file_data_->self_encryptor_.data_map().chunks.size());
+std::uint32_t File::DoRead(char* data, std::uint32_t length, std::uint64_t offset) {
+  LOG(kInfo) << "For " << meta_data.name() << ", reading " << length << " of "
+             << file_data_->self_encryptor_.size() << " bytes at offset " << offset;
+
+  std::uint64_t size(0);
+  {
+    const std::lock_guard<std::mutex> meta_data_lock(meta_data_mutex);
+    size = meta_data.size();
+  }
+  if (offset > size) {
+    return 0;
+  }
+
+  length = std::uint32_t(std::min<std::uint64_t>(length, size - offset));
+
+  // Only the part before the hole at the end of the file comes from the encryptor.
+  const std::uint64_t encrypted_size(file_data_->self_encryptor_.size());
+  const std::uint32_t encrypted_length(
+      offset >= encrypted_size
+          ? 0
+          : std::uint32_t(std::min<std::uint64_t>(length, encrypted_size - offset)));
+  if (encrypted_length > 0 && !file_data_->self_encryptor_.Read(data, encrypted_length, offset)) {
+    BOOST_THROW_EXCEPTION(MakeError(EncryptErrors::failed_to_read));
+  }
+  std::fill(data + encrypted_length, data + length, 0);
+  return length;
+}
+
+void File::DoWrite(const char* data, std::uint32_t length, std::uint64_t offset) {
+  LOG(kInfo) << "For " << meta_data.name() << ", writing " << length << " bytes at offset "
+             << offset;
+
+  if (!file_data_->self_encryptor_.Write(data, length, offset)) {
+    BOOST_THROW_EXCEPTION(MakeError(EncryptErrors::failed_to_write));
+  }
+  file_data_->MarkWritten(offset, length);
+  StreamFinalChunks();
+}
+
+bool File::CoalesceWrite(const char* data, std::uint32_t length, std::uint64_t offset,
+                         bool update_times) {
+  std::string& extent(file_data_->coalesced_);
+  if (!extent.empty() && (offset != file_data_->coalesced_offset_ + extent.size() ||
+                          extent.size() + length > kWriteCoalescingSize)) {
+    FlushExtent();
+  }
+
+  if (length >= kWriteCoalescingSize) {
+    DoWrite(data, length, offset);
+    const std::lock_guard<std::mutex> meta_data_lock(meta_data_mutex);
+    SetSize(std::max(meta_data.size(), file_data_->self_encryptor_.size()), update_times);
+    return true;
+  }
+
+  const bool began_extent(extent.empty());
+  if (began_extent) {
+    extent.reserve(kWriteCoalescingSize);
+    file_data_->coalesced_offset_ = offset;
+  }
+  extent.append(data, length);
+  {
+    // Stats must still see the file's new size.  The times are only taken once per extent.
+    const std::lock_guard<std::mutex> meta_data_lock(meta_data_mutex);
+    SetSize(std::max<std::uint64_t>(meta_data.size(), offset + length),
+            update_times && began_extent);
+  }
+  if (extent.size() == kWriteCoalescingSize)
+    FlushExtent();
+  return began_extent;
+}
+
+void File::FlushCoalescedWrites() {
+  assert(HasBuffer());
+  DrainWriteQueue();
+  FlushExtent();
+}
+
+void File::FlushExtent() {
+  assert(HasBuffer());
+  std::string& extent(file_data_->coalesced_);
+  if (extent.empty())
+    return;
+  // Dropped even if the encryptor rejects it, so that later calls don't fail the same way.
+  const on_scope_exit clear_extent([&extent] { extent.clear(); });
+  DoWrite(extent.data(), static_cast<std::uint32_t>(extent.size()),
+          file_data_->coalesced_offset_);
+  // The times were updated when the extent was begun.
+  const std::lock_guard<std::mutex> meta_data_lock(meta_data_mutex);
+  SetSize(std::max(meta_data.size(), file_data_->self_encryptor_.size()), false);
+}
 
-    // If the original data map didn't contain any chunks, just store the new ones.
-    for (const auto& chunk : file_data_->self_encryptor_.data_map().chunks) {
-      auto content(
-          file_data_->buffer_.Get(std::string(std::begin(chunk.hash), std::end(chunk.hash))));
-      if (listener) {
-        put_requests.push_back(listener->PutChunk(ImmutableData(content)));
+void File::SetSize(std::uint64_t size, bool update_times) {
+  if (update_times)
+    meta_data.UpdateSize(size);
+  else
+    meta_data.ExtendSize(size);
+  std::uint64_t allocated(file_data_->self_encryptor_.size());
+  if (!file_data_->coalesced_.empty()) {
+    allocated = std::max<std::uint64_t>(
+        allocated, file_data_->coalesced_offset_ + file_data_->coalesced_.size());
+  }
+  meta_data.set_allocation_size(std::min(size, allocated));
+}
+
+void File::FlushCoalescedWrites(boost::shared_lock<boost::shared_mutex>& lock) {
+  // Only writes queued before the read began need draining, or a stream of them could starve it.
+  bool drain(HasBuffer() && HasQueuedWrites());
+  while (HasBuffer() && (drain || !file_data_->coalesced_.empty())) {
+    drain = false;
+    lock.unlock();
+    {
+      const boost::unique_lock<boost::shared_mutex> unique_lock(data_mutex_);
+      if (HasBuffer())
+        FlushCoalescedWrites();
+    }
+    lock.lock();
+  }
+}
+
+bool File::QueueWrite(const WriteSegment* segments, std::size_t count, std::uint64_t offset) {
+  std::uint64_t length(0);
+  for (std::size_t i(0); i != count; ++i)
+    length += segments[i].length;
+  if (length == 0)
+    return false;
+
+  boost::asio::io_service* drain_service(nullptr);
+  bool began_batch(false);
+  {
+    std::unique_lock<std::mutex> queue_lock(write_queue_.mutex);
+    // A write bigger than the whole queue is let in once the queue is empty.
+    write_queue_.space.wait(queue_lock, [&] {
+      return !write_queue_.enabled || write_queue_.bytes == 0 ||
+             write_queue_.bytes + length <= kWriteBehindQueueSize;
+    });
+    if (!write_queue_.enabled)
+      return false;
+    if (write_queue_.error) {
+      const std::exception_ptr error(write_queue_.error);
+      write_queue_.error = nullptr;
+      std::rethrow_exception(error);
+    }
+
+    began_batch = write_queue_.writes.empty();
+    std::string data;
+    data.reserve(static_cast<std::size_t>(length));
+    for (std::size_t i(0); i != count; ++i)
+      data.append(segments[i].data, segments[i].length);
+    write_queue_.writes.emplace_back(offset, std::move(data));
+    write_queue_.bytes += length;
+    ++write_count_;
+    if (!write_queue_.drain_posted) {
+      write_queue_.drain_posted = true;
+      drain_service = write_behind_service_;
+    }
+    // Updated under the queue's lock, so that a truncate can't come between the write being
+    // queued and the size taking account of it.  The times are only taken once per batch.
+    const std::lock_guard<std::mutex> meta_data_lock(meta_data_mutex);
+    const std::uint64_t size(std::max<std::uint64_t>(meta_data.size(), offset + length));
+    if (began_batch)
+      meta_data.UpdateSize(size);
+    else
+      meta_data.ExtendSize(size);
+  }
+
+  if (drain_service) {
+    const std::weak_ptr<File> this_weak(std::static_pointer_cast<File>(shared_from_this()));
+    drain_service->post([this_weak] {
+      const std::shared_ptr<File> this_shared(this_weak.lock());
+      if (this_shared == nullptr)
+        return;
+      const boost::unique_lock<boost::shared_mutex> lock(this_shared->data_mutex_);
+      if (this_shared->HasBuffer())
+        this_shared->DrainWriteQueue();
+    });
+  }
+  if (began_batch)
+    ScheduleForStoring();
+  return true;
+}
+
+void File::DrainWriteQueue() {
+  assert(HasBuffer());
+  std::vector<std::pair<std::uint64_t, std::string>> writes;
+  {
+    const std::lock_guard<std::mutex> queue_lock(write_queue_.mutex);
+    writes.swap(write_queue_.writes);
+    write_queue_.drain_posted = false;
+  }
+  if (writes.empty())
+    return;
+
+  std::exception_ptr error;
+  try {
+    // The times were updated when the writes were queued.
+    for (const auto& write : writes) {
+      // Those gathered by WriteV() may not fit in one call.
+      std::uint64_t done(0);
+      while (done != write.second.size()) {
+        const auto length(static_cast<std::uint32_t>(std::min<std::uint64_t>(
+            write.second.size() - done, std::numeric_limits<std::uint32_t>::max())));
+        CoalesceWrite(write.second.data() + done, length, write.first + done, false);
+        done += length;
       }
     }
-    boost::wait_for_all(put_requests.begin(), put_requests.end());
-  } else {
-    std::vector<boost::future<void>> put_requests;
-    put_requests.reserve(file_data_->self_encryptor_.data_map().chunks.size());
-
-    // Check each new chunk against the original data map's chunks.  Store the new ones and
-    // increment the reference count on the existing chunks.
-    for (const auto& chunk : file_data_->self_encryptor_.data_map().chunks) {
-      if (std::any_of(std::begin(file_data_->self_encryptor_.original_data_map().chunks),
-                      std::end(file_data_->self_encryptor_.original_data_map().chunks),
-                      [&chunk](const encrypt::ChunkDetails& original_chunk) {
-            return chunk.hash == original_chunk.hash;
-          })) {
-        chunks_to_be_incremented.emplace_back(
-            Identity(std::string(std::begin(chunk.hash), std::end(chunk.hash))));
-      } else {
-        auto content(
-            file_data_->buffer_.Get(std::string(std::begin(chunk.hash), std::end(chunk.hash))));
-        if (listener) {
-          put_requests.push_back(listener->PutChunk(ImmutableData(content)));
+  } catch (const std::exception& e) {
+    LOG(kError) << "Failed to drain queued writes of " << meta_data.name() << ": " << e.what();
+    error = std::current_exception();
+  }
+
+  std::uint64_t drained(0);
+  for (const auto& write : writes)
+    drained += write.second.size();
+  const std::lock_guard<std::mutex> queue_lock(write_queue_.mutex);
+  write_queue_.bytes -= drained;
+  if (error)
+    write_queue_.error = error;
+  write_queue_.space.notify_all();
+}
+
+bool File::HasQueuedWrites() {
+  const std::lock_guard<std::mutex> queue_lock(write_queue_.mutex);
+  return !write_queue_.writes.empty();
+}
+
+void File::ThrowWriteBehindError() {
+  std::exception_ptr error;
+  {
+    const std::lock_guard<std::mutex> queue_lock(write_queue_.mutex);
+    std::swap(error, write_queue_.error);
+  }
+  if (error)
+    std::rethrow_exception(error);
+}
+
+bool File::HasWriteBehindError() {
+  const std::lock_guard<std::mutex> queue_lock(write_queue_.mutex);
+  return write_queue_.error != nullptr;
+}
+
+File::NewChunks File::CloseEncryptor(std::vector<ImmutableData::Name>& chunks_to_be_incremented,
+                                     std::vector<ImmutableData::Name>& chunks_to_be_decremented) {
+  assert(HasBuffer());
+  FlushCoalescedWrites();
+
+  file_data_->self_encryptor_.Close();
+
+  const auto& chunks(file_data_->self_encryptor_.data_map().chunks);
+  const auto& original_chunks(file_data_->self_encryptor_.original_data_map().chunks);
+
+  // Self-encryption makes each chunk depend on the two before it (wrapping around at the start),
+  // so a chunk can only have changed if it or one of those was written.  The rest are expected to
+  // match the original chunk at the same index.
+  std::vector<bool> maybe_changed(chunks.size(), false);
+  std::uint64_t chunk_offset(0);
+  for (std::size_t i(0); i != chunks.size(); ++i) {
+    if (file_data_->IsWritten(chunk_offset, chunks[i].size)) {
+      for (std::size_t dependent(0); dependent != 3; ++dependent)
+        maybe_changed[(i + dependent) % chunks.size()] = true;
+    }
+    chunk_offset += chunks[i].size;
+  }
+
+  // Built only if a chunk isn't where it was in the original data map.
+  std::unordered_set<std::string> original_names;
+  // Left with the streamed chunks which have since been rewritten.
+  std::unordered_set<std::string> unreferenced(file_data_->StreamedChunks());
+  const std::size_t streamed_count(unreferenced.size());
+  NewChunks new_chunks;
+  for (std::size_t i(0); i != chunks.size(); ++i) {
+    std::string name(std::begin(chunks[i].hash), std::end(chunks[i].hash));
+    // Already stored while the file was being written
+    if (streamed_count != 0 && unreferenced.erase(name) != 0)
+      continue;
+    bool is_original(!maybe_changed[i] && i < original_chunks.size() &&
+                     chunks[i].hash == original_chunks[i].hash);
+    if (!is_original) {
+      if (original_names.empty()) {
+        for (const auto& original_chunk : original_chunks) {
+          original_names.emplace(std::begin(original_chunk.hash),
+                                 std::end(original_chunk.hash));
         }
       }
+      is_original = original_names.count(name) != 0;
+    }
+
+    // Store the new chunks and increment the reference count on the existing ones.
+    if (is_original) {
+      chunks_to_be_incremented.emplace_back(Identity(name));
+    } else {
+      auto content(file_data_->GetChunk(name));
+      new_chunks.emplace_back(std::move(name), std::move(content));
     }
-    boost::wait_for_all(put_requests.begin(), put_requests.end());
   }
 
+  for (const auto& name : unreferenced)
+    chunks_to_be_decremented.emplace_back(Identity(name));
   skip_chunk_incrementing_ = true;
+  return new_chunks;
+}
+
+void File::PendingChunks::Add(const NewChunks& chunks, bool streamed) {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  if (streamed)
+    streaming_ += chunks.size();
+  for (const auto& chunk : chunks) {
+    auto& pending(chunks_[chunk.first]);
+    if (pending.second++ == 0)
+      pending.first = chunk.second;
+  }
+}
+
+bool File::PendingChunks::Remove(const NewChunks& chunks, bool streamed) {
+  bool store_due(false);
+  {
+    const std::lock_guard<std::mutex> lock(mutex_);
+    if (streamed)
+      streaming_ -= chunks.size();
+    for (const auto& chunk : chunks) {
+      const auto found(chunks_.find(chunk.first));
+      if (found != chunks_.end() && --(found->second.second) == 0)
+        chunks_.erase(found);
+    }
+    if (store_deferred_ && chunks_.empty()) {
+      store_deferred_ = false;
+      store_due = true;
+    }
+  }
+  stored_.notify_all();
+  return store_due;
+}
+
+std::unordered_set<std::string> File::PendingChunks::DeferStore() {
+  std::unordered_set<std::string> names;
+  const std::lock_guard<std::mutex> lock(mutex_);
+  if (chunks_.empty())
+    return names;
+  store_deferred_ = true;
+  for (const auto& chunk : chunks_)
+    names.insert(chunk.first);
+  return names;
+}
+
+bool File::PendingChunks::WaitUntilStored() const {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (chunks_.empty())
+    return false;
+  stored_.wait(lock, [this] { return chunks_.empty(); });
+  return true;
+}
+
+bool File::PendingChunks::Get(const std::string& name, NonEmptyString& content) const {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  const auto found(chunks_.find(name));
+  if (found == chunks_.end())
+    return false;
+  content = found->second.first;
+  return true;
+}
+
+void File::PendingChunks::WaitUntilStored(const std::vector<ImmutableData::Name>& names) const {
+  std::unique_lock<std::mutex> lock(mutex_);
+  stored_.wait(lock, [this, &names] {
+    return std::none_of(names.begin(), names.end(), [this](const ImmutableData::Name& name) {
+      return chunks_.count(name.value.string()) != 0;
+    });
+  });
+}
+
+void File::PendingChunks::WaitUntilFewerStreaming(std::size_t count) const {
+  std::unique_lock<std::mutex> lock(mutex_);
+  stored_.wait(lock, [this, count] { return streaming_ < count; });
 }
 
 File::Data::Data(OriginalParameters original_parameters, const boost::filesystem::path& name,
                  encrypt::DataMap& data_map)
     : original_parameters_(std::move(original_parameters)),
+      spilled_chunks_(std::make_shared<SpilledChunks>()),
       buffer_(original_parameters_.max_memory_usage_, original_parameters_.max_disk_usage_,
-              [name](const std::string&, const NonEmptyString&) {
-                LOG(kWarning) << name << "is too large for storage";
-                BOOST_THROW_EXCEPTION(MakeError(CommonErrors::file_too_large));
-              },
+              MakeSpillFunctor(name, original_parameters_.spill_store_,
+                               original_parameters_.max_spill_usage_,
+                               original_parameters_.can_stream_, spilled_chunks_),
               original_parameters_.disk_buffer_location_),
-      self_encryptor_(data_map, buffer_, original_parameters_.get_chunk_from_store_),
-      open_count_(0) {}
+      self_encryptor_(data_map, buffer_,
+                      MakeChunkGetter(original_parameters_.get_chunk_from_store_,
+                                      spilled_chunks_)),
+      open_count_(0),
+      written_(),
+      coalesced_(),
+      coalesced_offset_(0) {}
+
+File::Data::~Data() {
+  if (!original_parameters_.spill_store_)
+    return;
+  const std::lock_guard<std::mutex> lock(spilled_chunks_->mutex);
+  for (const auto& name : spilled_chunks_->names)
+    original_parameters_.spill_store_->Delete(name);
+}
+
+std::function<void(const std::string&, const NonEmptyString&)> File::Data::MakeSpillFunctor(
+    const boost::filesystem::path& name, std::shared_ptr<SpillStore> spill_store,
+    DiskUsage max_spill_usage, OriginalParameters::CanStreamFunctor can_stream,
+    std::shared_ptr<SpilledChunks> spilled_chunks) {
+  return [name, spill_store, max_spill_usage, can_stream, spilled_chunks](
+      const std::string& key, const NonEmptyString& value) {
+    if (spill_store) {
+      const std::lock_guard<std::mutex> lock(spilled_chunks->mutex);
+      if (spilled_chunks->bytes + value.string().size() <= max_spill_usage.data &&
+          spill_store->Put(key, value)) {
+        spilled_chunks->names.insert(key);
+        spilled_chunks->bytes += value.string().size();
+        return;
+      }
+    }
+    // Held in memory until the writer streams it (see File::StreamFinalChunks()), or the close
+    // stores it.  Nothing is stored here, as the buffer may push chunks out under the file's lock.
+    if (can_stream && can_stream()) {
+      const std::lock_guard<std::mutex> lock(spilled_chunks->mutex);
+      spilled_chunks->held[key] = value;
+      return;
+    }
+    LOG(kWarning) << name << " is too large for storage";
+    BOOST_THROW_EXCEPTION(MakeError(CommonErrors::file_too_large));
+  };
+}
+
+std::function<NonEmptyString(const std::string&)> File::Data::MakeChunkGetter(
+    std::function<NonEmptyString(const std::string&)> get_chunk_from_store,
+    std::shared_ptr<SpilledChunks> spilled_chunks) {
+  return [get_chunk_from_store, spilled_chunks](const std::string& name) {
+    {
+      const std::lock_guard<std::mutex> lock(spilled_chunks->mutex);
+      const auto held(spilled_chunks->held.find(name));
+      if (held != spilled_chunks->held.end())
+        return held->second;
+    }
+    return get_chunk_from_store(name);
+  };
+}
+
+NonEmptyString File::Data::GetChunk(const std::string& name) {
+  bool spilled(false);
+  {
+    const std::lock_guard<std::mutex> lock(spilled_chunks_->mutex);
+    const auto held(spilled_chunks_->held.find(name));
+    if (held != spilled_chunks_->held.end())
+      return held->second;
+    spilled = spilled_chunks_->names.count(name) != 0;
+  }
+  NonEmptyString content;
+  if (spilled && original_parameters_.spill_store_->Get(name, content))
+    return content;
+  return buffer_.Get(name);
+}
+
+std::unordered_set<std::string> File::Data::StreamedChunks() const {
+  const std::lock_guard<std::mutex> lock(spilled_chunks_->mutex);
+  return spilled_chunks_->streamed;
+}
+
+bool File::Data::HoldsChunks() const {
+  const std::lock_guard<std::mutex> lock(spilled_chunks_->mutex);
+  return !spilled_chunks_->held.empty();
+}
+
+File::NewChunks File::Data::TakeFinalChunks() {
+  NewChunks final_chunks;
+  const auto& chunks(self_encryptor_.data_map().chunks);
+  // With fewer than five chunks, each is one of the first or last two.
+  if (chunks.size() < 5)
+    return final_chunks;
+  std::unordered_set<std::string> unfinished;
+  for (const std::size_t index : {std::size_t(0), std::size_t(1), chunks.size() - 2,
+                                  chunks.size() - 1}) {
+    unfinished.emplace(std::begin(chunks[index].hash), std::end(chunks[index].hash));
+  }
+
+  const std::lock_guard<std::mutex> lock(spilled_chunks_->mutex);
+  auto& held(spilled_chunks_->held);
+  for (auto itr(held.begin()); itr != held.end();) {
+    if (unfinished.count(itr->first) != 0) {
+      ++itr;
+      continue;
+    }
+    spilled_chunks_->streamed.insert(itr->first);
+    final_chunks.emplace_back(itr->first, itr->second);
+    itr = held.erase(itr);
+  }
+  return final_chunks;
+}
+
+void File::Data::MarkWritten(std::uint64_t offset, std::uint64_t length) {
+  if (length == 0)
+    return;
+  std::uint64_t begin(offset), end(offset + length);
+  auto next(written_.upper_bound(begin));
+  if (next != written_.begin() && std::prev(next)->second >= begin) {
+    --next;
+    begin = next->first;
+    end = std::max(end, next->second);
+    next = written_.erase(next);
+  }
+  while (next != written_.end() && next->first <= end) {
+    end = std::max(end, next->second);
+    next = written_.erase(next);
+  }
+  written_.emplace(begin, end);
+}
+
+bool File::Data::IsWritten(std::uint64_t offset, std::uint64_t length) const {
+  if (length == 0)
+    return false;
+  auto last(written_.lower_bound(offset + length));
+  return last != written_.begin() && (--last)->second > offset;
+}
 
 File::Data::OriginalParameters::OriginalParameters(
     const MemoryUsage max_memory_usage, const DiskUsage max_disk_usage,
     const boost::filesystem::path& disk_buffer_location,
-    std::function<NonEmptyString(const std::string&)> get_chunk_from_store)
+    std::function<NonEmptyString(const std::string&)> get_chunk_from_store,
+    std::shared_ptr<SpillStore> spill_store, const DiskUsage max_spill_usage,
+    CanStreamFunctor can_stream)
     : disk_buffer_location_(
           boost::filesystem::unique_path(disk_buffer_location / "%%%%%-%%%%%-%%%%%-%%%%%")),
       get_chunk_from_store_(std::move(get_chunk_from_store)),
       max_memory_usage_(max_memory_usage),
-      max_disk_usage_(max_disk_usage) {}
+      max_disk_usage_(max_disk_usage),
+      spill_store_(std::move(spill_store)),
+      max_spill_usage_(max_spill_usage),
+      can_stream_(std::move(can_stream)) {}
 
 File::Data::OriginalParameters::OriginalParameters(OriginalParameters&& rhs)
     : disk_buffer_location_(),
       get_chunk_from_store_(std::move(rhs.get_chunk_from_store_)),
       max_memory_usage_(std::move(rhs.max_memory_usage_)),
-      max_disk_usage_(std::move(rhs.max_disk_usage_)) {
+      max_disk_usage_(std::move(rhs.max_disk_usage_)),
+      spill_store_(std::move(rhs.spill_store_)),
+      max_spill_usage_(std::move(rhs.max_spill_usage_)),
+      can_stream_(std::move(rhs.can_stream_)) {
   disk_buffer_location_.swap(rhs.disk_buffer_location_);
 }
 
@@ -0,0 +1,126 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#include "maidsafe/drive/keep_alive_cache.h"
+
+#include <iterator>
+#include <utility>
+#include <vector>
+
+namespace maidsafe {
+
+namespace drive {
+
+namespace detail {
+
+KeepAliveCache::KeepAliveCache(boost::asio::io_service& io_service, std::size_t capacity,
+                               std::chrono::steady_clock::duration idle_time)
+    : io_service_(io_service),
+      capacity_(capacity),
+      idle_time_(idle_time),
+      mutex_(),
+      entries_(),
+      positions_(),
+      sweeper_(io_service),
+      sweeper_armed_(false),
+      evictions_(0) {}
+
+void KeepAliveCache::Add(const void* key, ReleaseFunctor release) {
+  std::vector<ReleaseFunctor> evicted;
+  {
+    const std::lock_guard<std::mutex> lock(mutex_);
+    const auto found(positions_.find(key));
+    if (found != std::end(positions_)) {
+      entries_.erase(found->second);
+      positions_.erase(found);
+    }
+    Entry entry = {key, std::move(release), std::chrono::steady_clock::now() + idle_time_};
+    positions_.emplace(key, entries_.insert(std::end(entries_), std::move(entry)));
+
+    while (entries_.size() > capacity_) {
+      evicted.push_back(std::move(entries_.front().release));
+      positions_.erase(entries_.front().key);
+      entries_.pop_front();
+      ++evictions_;
+    }
+    ArmSweeper();
+  }
+
+  // The caller may hold locks which the release functors take.
+  for (auto& release : evicted)
+    io_service_.post(std::move(release));
+}
+
+bool KeepAliveCache::Remove(const void* key) {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  const auto found(positions_.find(key));
+  if (found == std::end(positions_))
+    return false;
+  entries_.erase(found->second);
+  positions_.erase(found);
+  return true;
+}
+
+std::size_t KeepAliveCache::size() const {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+std::uint64_t KeepAliveCache::evictions() const {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  return evictions_;
+}
+
+void KeepAliveCache::ArmSweeper() {
+  // An armed sweeper never fires later than the front entry's expiry, since entries are only
+  // added at the back.  If it fires early, it re-arms.
+  if (sweeper_armed_ || entries_.empty())
+    return;
+  sweeper_armed_ = true;
+  sweeper_.expires_at(entries_.front().expiry);
+  const std::weak_ptr<KeepAliveCache> this_weak(shared_from_this());
+  sweeper_.async_wait([this_weak](const boost::system::error_code& error) {
+    const std::shared_ptr<KeepAliveCache> this_shared(this_weak.lock());
+    if (this_shared != nullptr && error != boost::asio::error::operation_aborted)
+      this_shared->Sweep();
+  });
+}
+
+void KeepAliveCache::Sweep() {
+  std::vector<ReleaseFunctor> expired;
+  {
+    const std::lock_guard<std::mutex> lock(mutex_);
+    sweeper_armed_ = false;
+    const auto now(std::chrono::steady_clock::now());
+    while (!entries_.empty() && entries_.front().expiry <= now) {
+      expired.push_back(std::move(entries_.front().release));
+      positions_.erase(entries_.front().key);
+      entries_.pop_front();
+    }
+    ArmSweeper();
+  }
+
+  for (const auto& release : expired)
+    release();
+}
+
+}  // namespace detail
+
+}  // namespace drive
+
+}  // namespace maidsafe
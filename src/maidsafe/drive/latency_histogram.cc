@@ -0,0 +1,70 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#include "maidsafe/drive/latency_histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace maidsafe {
+
+namespace drive {
+
+namespace detail {
+
+LatencyHistogram::LatencyHistogram() : buckets_(), count_(0), max_(0) {
+  for (auto& bucket : buckets_)
+    bucket = 0;
+}
+
+void LatencyHistogram::Record(std::chrono::steady_clock::duration latency) {
+  const auto micros(std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+  const std::uint64_t value(micros < 0 ? 0 : static_cast<std::uint64_t>(micros));
+  std::size_t index(0);
+  while (index != kBucketCount - 1 && (value >> index) != 0)
+    ++index;
+  ++buckets_[index];
+  ++count_;
+
+  std::uint64_t max(max_);
+  while (value > max && !max_.compare_exchange_weak(max, value)) {
+  }
+}
+
+std::chrono::microseconds LatencyHistogram::Percentile(double fraction) const {
+  const std::uint64_t count(count_);
+  if (count == 0)
+    return std::chrono::microseconds(0);
+  // The rank of the sample wanted, counting from 1
+  const auto rank(std::max<std::uint64_t>(
+      1, static_cast<std::uint64_t>(std::ceil(fraction * static_cast<double>(count)))));
+  std::uint64_t seen(0);
+  for (std::size_t index(0); index != kBucketCount; ++index) {
+    seen += buckets_[index];
+    if (seen >= rank)
+      return std::chrono::microseconds(std::uint64_t(1) << index);
+  }
+  // Samples recorded while this ran may not all be counted in the buckets yet.
+  return max();
+}
+
+}  // namespace detail
+
+}  // namespace drive
+
+}  // namespace maidsafe
@@ -55,6 +55,7 @@
 #include "maidsafe/drive/win_drive.h"
 #else
 #include "maidsafe/drive/unix_drive.h"
+#include "maidsafe/drive/unix_low_level_drive.h"
 #endif
 #include "maidsafe/drive/tools/launcher.h"
 
@@ -71,6 +72,7 @@ namespace {
 typedef CbfsDrive<nfs::FakeStore> LocalDrive;
 #else
 typedef FuseDrive<nfs::FakeStore> LocalDrive;
+typedef FuseLowLevelDrive<nfs::FakeStore> LowLevelLocalDrive;
 #endif
 
 Drive<nfs::FakeStore>* g_local_drive(nullptr);
@@ -141,7 +143,25 @@ po::options_description VisibleOptions() {
                                                " root parent directory identifier (required)")(
               "drive_name,N", po::value<std::string>(), " virtual drive name")(
               "create,C", " Must be called on first run")("check_data,Z",
-                                                          " check all data in chunkstore");
+                                                          " check all data in chunkstore")(
+              "worker_count,W", po::value<unsigned>(),
+              " number of threads servicing filesystem requests (default 1)")(
+              "low_level_fuse,L", " use the inode-based FUSE low-level API (ignored on Windows)")(
+              "entry_timeout", po::value<double>(),
+              " seconds the kernel may cache name lookups (default 1, ignored on Windows)")(
+              "attr_timeout", po::value<double>(),
+              " seconds the kernel may cache attributes (default 1, ignored on Windows)")(
+              "negative_timeout", po::value<double>(),
+              " seconds the kernel may cache failed lookups (default 0, ignored on Windows)")(
+              "direct_io_min_size", po::value<std::uint64_t>(),
+              " open files of at least this many bytes direct_io (default 0 for never, ignored on "
+              "Windows)")(
+              "direct_io_patterns", po::value<std::string>(),
+              " comma-separated filename globs to open direct_io (ignored on Windows)")(
+              "chunk_cache_size", po::value<std::uint64_t>(),
+              " bytes of chunk contents cached across all files (default 64 MiB, 0 disables)")(
+              "write_behind",
+              " acknowledge writes once queued, and encrypt them in the background");
   return options;
 }
 
@@ -220,6 +240,24 @@ void GetFromProgramOptions(const po::variables_map& variables_map, Options& opti
     options.root_parent_id = Identity(parent_id);
   options.drive_name = GetStringFromProgramOption("drive_name", variables_map);
   options.create_store = (variables_map.count("create") != 0);
+  if (variables_map.count("worker_count")) {
+    options.worker_count = variables_map.at("worker_count").as<unsigned>();
+    LOG(kInfo) << "worker_count set to " << options.worker_count;
+  }
+  options.low_level_fuse = (variables_map.count("low_level_fuse") != 0);
+  if (variables_map.count("entry_timeout"))
+    options.entry_timeout = variables_map.at("entry_timeout").as<double>();
+  if (variables_map.count("attr_timeout"))
+    options.attr_timeout = variables_map.at("attr_timeout").as<double>();
+  if (variables_map.count("negative_timeout"))
+    options.negative_timeout = variables_map.at("negative_timeout").as<double>();
+  if (variables_map.count("direct_io_min_size"))
+    options.direct_io_min_size = variables_map.at("direct_io_min_size").as<std::uint64_t>();
+  if (variables_map.count("direct_io_patterns"))
+    options.direct_io_patterns = variables_map.at("direct_io_patterns").as<std::string>();
+  if (variables_map.count("chunk_cache_size"))
+    options.chunk_cache_size = variables_map.at("chunk_cache_size").as<std::uint64_t>();
+  options.write_behind = (variables_map.count("write_behind") != 0);
 }
 
 void ValidateOptions(const Options& options) {
@@ -241,6 +279,14 @@ void ValidateOptions(const Options& options) {
     error_message += "  parent_id must be set to a 64 character string\n";
     g_return_code += 8;
   }
+  if (options.worker_count == 0) {
+    error_message += "  worker_count must be at least 1\n";
+    g_return_code += 16;
+  }
+  if (options.entry_timeout < 0 || options.attr_timeout < 0 || options.negative_timeout < 0) {
+    error_message += "  cache timeouts must not be negative\n";
+    g_return_code += 32;
+  }
 
   if (g_return_code) {
     g_error_message = "Fatal error:\n" + error_message + "\nRun with -h to see all options.\n\n";
@@ -255,6 +301,33 @@ void MonitorParentProcess(const Options& options) {
   Unmount();
 }
 
+std::unique_ptr<Drive<nfs::FakeStore>> MakeDrive(
+    std::shared_ptr<nfs::FakeStore> storage, const Options& options,
+    const std::string& mount_status_shared_object_name) {
+#ifdef MAIDSAFE_WIN32
+  return std::unique_ptr<Drive<nfs::FakeStore>>(new LocalDrive(
+      storage, options.unique_id, options.root_parent_id, options.mount_path, GetUserAppDir(),
+      options.drive_name, mount_status_shared_object_name, options.create_store,
+      BOOST_PP_STRINGIZE(PRODUCT_ID), options.chunk_cache_size, options.write_behind));
+#else
+  const FuseCacheTimeouts cache_timeouts(options.entry_timeout, options.attr_timeout,
+                                         options.negative_timeout);
+  const DirectIoPolicy direct_io_policy(options.direct_io_min_size, options.direct_io_patterns);
+  if (options.low_level_fuse) {
+    return std::unique_ptr<Drive<nfs::FakeStore>>(new LowLevelLocalDrive(
+        storage, options.unique_id, options.root_parent_id, options.mount_path, GetUserAppDir(),
+        options.drive_name, mount_status_shared_object_name, options.create_store,
+        options.worker_count, cache_timeouts, direct_io_policy, options.chunk_cache_size,
+        options.write_behind));
+  }
+  return std::unique_ptr<Drive<nfs::FakeStore>>(new LocalDrive(
+      storage, options.unique_id, options.root_parent_id, options.mount_path, GetUserAppDir(),
+      options.drive_name, mount_status_shared_object_name, options.create_store,
+      options.worker_count, cache_timeouts, direct_io_policy, options.chunk_cache_size,
+      options.write_behind));
+#endif
+}
+
 int MountAndWaitForIpcNotification(const Options& options) {
   fs::path storage_path(options.storage_path / "local_store");
   DiskUsage disk_usage(std::numeric_limits<uint64_t>().max());
@@ -273,22 +346,14 @@ int MountAndWaitForIpcNotification(const Options& options) {
     }
   }
 
-  LocalDrive drive(storage, options.unique_id, options.root_parent_id, options.mount_path,
-                   GetUserAppDir(), options.drive_name, options.mount_status_shared_object_name,
-                   options.create_store
-#ifdef MAIDSAFE_WIN32
-                   ,
-                   BOOST_PP_STRINGIZE(PRODUCT_ID)
-#endif
-                       );  // NOLINT
-
-  g_local_drive = &drive;
+  auto drive(MakeDrive(storage, options, options.mount_status_shared_object_name));
+  g_local_drive = drive.get();
 
   // Start a thread to poll the parent process' continued existence *before* calling drive.Mount().
   std::thread poll_parent([&] { MonitorParentProcess(options); });
 
   try {
-    drive.Mount();
+    drive->Mount();
   } catch (const std::exception& e) {
     LOG(kError) << "using VFS caught an exception " << boost::diagnostic_information(e);
   }
@@ -317,17 +382,10 @@ int MountAndWaitForSignal(const Options& options) {
     }
   }
 
-  LocalDrive drive(storage, options.unique_id, options.root_parent_id, options.mount_path,
-                   GetUserAppDir(), options.drive_name, "", options.create_store
-#ifdef MAIDSAFE_WIN32
-                   ,
-                   BOOST_PP_STRINGIZE(PRODUCT_ID)
-#endif
-                       );  // NOLINT
-
-  g_local_drive = &drive;
+  auto drive(MakeDrive(storage, options, ""));
+  g_local_drive = drive.get();
 
-  drive.Mount();
+  drive->Mount();
   return 0;
 }
 
@@ -18,6 +18,9 @@
 
 #include "maidsafe/drive/meta_data.h"
 
+#include <algorithm>
+#include <utility>
+
 #include "boost/algorithm/string/predicate.hpp"
 
 #include "maidsafe/common/log.h"
@@ -47,6 +50,7 @@ const uint32_t kAttributesRegular = 0x8000;
 
 MetaData::MetaData(FileType file_type)
     : data_map_(),
+      inline_content_(),
       directory_id_(),
       name_(),
       file_type_(file_type),
@@ -65,6 +69,7 @@ MetaData::MetaData(FileType file_type)
 
 MetaData::MetaData(const fs::path& name, FileType file_type)
     : data_map_((file_type == FileType::directory_file) ? nullptr : new encrypt::DataMap()),
+      inline_content_(),
       directory_id_((file_type == FileType::directory_file) ? new DirectoryId(RandomString(64))
                                                             : nullptr),
       name_(name),
@@ -89,6 +94,7 @@ MetaData::MetaData(const fs::path& name, FileType file_type)
 
 MetaData::MetaData(const protobuf::Path& entry)
     : data_map_(),
+      inline_content_(),
       directory_id_(nullptr),
       name_(entry.name()),
       file_type_(FileType::status_error),
@@ -122,10 +128,20 @@ MetaData::MetaData(const protobuf::Path& entry)
       file_type_ = FileType::regular_file;
       if (entry.has_directory_id())
         BOOST_THROW_EXCEPTION(MakeError(CommonErrors::parsing_error));
-      if (!entry.has_serialised_data_map())
+      if (entry.has_serialised_data_map() == entry.has_inline_content())
         BOOST_THROW_EXCEPTION(MakeError(CommonErrors::parsing_error));
       data_map_.reset(new encrypt::DataMap());
+      if (entry.has_inline_content()) {
+        inline_content_.reset(new std::string(entry.inline_content()));
+        allocation_size_ = std::min<std::uint64_t>(inline_content_->size(), size_);
+        break;
+      }
       encrypt::ParseDataMap(entry.serialised_data_map(), *data_map());
+      // Any part of the file past the end of the data map is a hole, which occupies nothing.
+      allocation_size_ = data_map()->content.size();
+      for (const auto& chunk : data_map()->chunks)
+        allocation_size_ += chunk.size;
+      allocation_size_ = std::min(allocation_size_, size_);
       break;
 
     case protobuf::Attributes::SYMLINK_FILE_TYPE:
@@ -160,6 +176,7 @@ MetaData::MetaData(const protobuf::Path& entry)
 
 MetaData::MetaData(MetaData&& other)
     : data_map_(),
+      inline_content_(),
       directory_id_(),
       name_(),
       file_type_(),
@@ -262,6 +279,17 @@ void MetaData::UpdateSize(const std::uint64_t new_size) {
   last_status_time_ = last_write_time();
 }
 
+void MetaData::ExtendSize(const std::uint64_t new_size) {
+  size_ = new_size;
+  allocation_size_ = size_;
+}
+
+void MetaData::SetInlineContent(std::string content) {
+  inline_content_.reset(new std::string(std::move(content)));
+}
+
+void MetaData::ClearInlineContent() { inline_content_.reset(); }
+
 void MetaData::UpdateAllocationSize(const std::uint64_t new_size) {
   allocation_size_ = new_size;
   last_write_time_ = common::Clock::now();
@@ -272,6 +300,7 @@ void MetaData::UpdateAllocationSize(const std::uint64_t new_size) {
 void MetaData::swap(MetaData& rhs) MAIDSAFE_NOEXCEPT {
   using std::swap;
   swap(data_map_, rhs.data_map_);
+  swap(inline_content_, rhs.inline_content_);
   swap(directory_id_, rhs.directory_id_);
   swap(name_, rhs.name_);
   swap(file_type_, rhs.file_type_);
@@ -58,6 +58,7 @@
 #include "maidsafe/drive/win_drive.h"
 #else
 #include "maidsafe/drive/unix_drive.h"
+#include "maidsafe/drive/unix_low_level_drive.h"
 #endif
 #include "maidsafe/drive/tools/launcher.h"
 
@@ -73,6 +74,7 @@ namespace {
 typedef CbfsDrive<nfs_client::MaidNodeNfs> NetworkDrive;
 #else
 typedef FuseDrive<nfs_client::MaidNodeNfs> NetworkDrive;
+typedef FuseLowLevelDrive<nfs_client::MaidNodeNfs> LowLevelNetworkDrive;
 #endif
 
 std::unique_ptr<Drive<nfs_client::MaidNodeNfs>> g_network_drive(nullptr);
@@ -122,7 +124,24 @@ process::ProcessInfo GetParentProcessInfo(const Options& /*options*/) { return g
 po::options_description CommandLineOptions() {
   po::options_description options("Network Drive options");
   options.add_options()("help,h", "Show help message.")("shared_memory", po::value<std::string>(),
-                                                        "Shared memory name (IPC).");
+                                                        "Shared memory name (IPC).")(
+      "worker_count", po::value<unsigned>(),
+      "Number of threads servicing filesystem requests (overrides IPC value).")(
+      "low_level_fuse", "Use the inode-based FUSE low-level API (overrides IPC value).")(
+      "attr_timeout", po::value<double>(),
+      "Seconds the kernel may cache attributes (overrides IPC value).")(
+      "entry_timeout", po::value<double>(),
+      "Seconds the kernel may cache name lookups (overrides IPC value).")(
+      "negative_timeout", po::value<double>(),
+      "Seconds the kernel may cache failed lookups (overrides IPC value).")(
+      "direct_io_min_size", po::value<std::uint64_t>(),
+      "Open files of at least this many bytes direct_io (overrides IPC value).")(
+      "direct_io_patterns", po::value<std::string>(),
+      "Comma-separated filename globs to open direct_io (overrides IPC value).")(
+      "chunk_cache_size", po::value<std::uint64_t>(),
+      "Bytes of chunk contents cached across all files (overrides IPC value).")(
+      "write_behind", "Acknowledge writes once queued, and encrypt them in the background "
+      "(overrides IPC value).");
   return options;
 }
 
@@ -154,6 +173,24 @@ void GetOptions(const po::variables_map& variables_map, Options& options) {
   if (!variables_map.count("shared_memory"))
     BOOST_THROW_EXCEPTION(maidsafe::MakeError(maidsafe::CommonErrors::uninitialised));
   ReadAndRemoveInitialSharedMemory(variables_map.at("shared_memory").as<std::string>(), options);
+  if (variables_map.count("worker_count"))
+    options.worker_count = variables_map.at("worker_count").as<unsigned>();
+  if (variables_map.count("low_level_fuse"))
+    options.low_level_fuse = true;
+  if (variables_map.count("attr_timeout"))
+    options.attr_timeout = variables_map.at("attr_timeout").as<double>();
+  if (variables_map.count("entry_timeout"))
+    options.entry_timeout = variables_map.at("entry_timeout").as<double>();
+  if (variables_map.count("negative_timeout"))
+    options.negative_timeout = variables_map.at("negative_timeout").as<double>();
+  if (variables_map.count("direct_io_min_size"))
+    options.direct_io_min_size = variables_map.at("direct_io_min_size").as<std::uint64_t>();
+  if (variables_map.count("direct_io_patterns"))
+    options.direct_io_patterns = variables_map.at("direct_io_patterns").as<std::string>();
+  if (variables_map.count("chunk_cache_size"))
+    options.chunk_cache_size = variables_map.at("chunk_cache_size").as<std::uint64_t>();
+  if (variables_map.count("write_behind"))
+    options.write_behind = true;
 }
 
 void ValidateOptions(const Options& options) {
@@ -188,6 +225,14 @@ void ValidateOptions(const Options& options) {
     error_message += "  symm_iv must be set\n";
     ++g_return_code;
   }
+  if (options.worker_count == 0) {
+    error_message += "  worker_count must be at least 1\n";
+    ++g_return_code;
+  }
+  if (options.entry_timeout < 0 || options.attr_timeout < 0 || options.negative_timeout < 0) {
+    error_message += "  cache timeouts must not be negative\n";
+    ++g_return_code;
+  }
 
   if (g_return_code) {
     g_error_message = "Fatal error:\n" + error_message + "\n\n";
@@ -221,14 +266,29 @@ int Mount(const Options& options) {
   maid.reset(new passport::Maid(passport::DecryptMaid(encrypted_maid, symm_key, symm_iv)));
 
   g_maid_node_nfs = nfs_client::MaidNodeNfs::MakeShared(*maid);
+#ifdef MAIDSAFE_WIN32
   g_network_drive.reset(new NetworkDrive(
       g_maid_node_nfs, options.unique_id, options.root_parent_id, options.mount_path, user_app_dir,
-      options.drive_name, options.mount_status_shared_object_name, options.create_store
-#ifdef MAIDSAFE_WIN32
-      ,
-      BOOST_PP_STRINGIZE(PRODUCT_ID)
+      options.drive_name, options.mount_status_shared_object_name, options.create_store,
+      BOOST_PP_STRINGIZE(PRODUCT_ID), options.chunk_cache_size, options.write_behind));
+#else
+  const FuseCacheTimeouts cache_timeouts(options.entry_timeout, options.attr_timeout,
+                                         options.negative_timeout);
+  const DirectIoPolicy direct_io_policy(options.direct_io_min_size, options.direct_io_patterns);
+  if (options.low_level_fuse) {
+    g_network_drive.reset(new LowLevelNetworkDrive(
+        g_maid_node_nfs, options.unique_id, options.root_parent_id, options.mount_path,
+        user_app_dir, options.drive_name, options.mount_status_shared_object_name,
+        options.create_store, options.worker_count, cache_timeouts, direct_io_policy,
+        options.chunk_cache_size, options.write_behind));
+  } else {
+    g_network_drive.reset(new NetworkDrive(
+        g_maid_node_nfs, options.unique_id, options.root_parent_id, options.mount_path,
+        user_app_dir, options.drive_name, options.mount_status_shared_object_name,
+        options.create_store, options.worker_count, cache_timeouts, direct_io_policy,
+        options.chunk_cache_size, options.write_behind));
+  }
 #endif
-          ));  // NOLINT
 
   if (options.monitor_parent) {
     std::thread poll_parent([&] {
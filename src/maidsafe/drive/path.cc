@@ -26,10 +26,10 @@ namespace drive {
 
 namespace detail {
 
-Path::Path(MetaData::FileType file_type) : meta_data(file_type) {}
+Path::Path(MetaData::FileType file_type) : meta_data(file_type), meta_data_mutex() {}
 
 Path::Path(std::shared_ptr<Directory> parent, MetaData::FileType file_type)
-    : parent_(parent), meta_data(file_type) {}
+    : parent_(parent), meta_data(file_type), meta_data_mutex() {}
 
 std::shared_ptr<Directory> Path::Parent() const { return parent_.lock(); }
 
@@ -0,0 +1,265 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#include "maidsafe/drive/readahead.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "maidsafe/common/log.h"
+
+#include "maidsafe/drive/config.h"
+
+namespace maidsafe {
+
+namespace drive {
+
+namespace detail {
+
+namespace {
+
+// The number of chunks fetched ahead when a stream is first detected.
+const std::size_t kInitialWindow(2);
+// The number of consecutive sequential reads which make a stream.
+const unsigned kSequentialReadThreshold(2);
+
+}  // unnamed namespace
+
+Readahead::Readahead(GetChunkFunctor get_chunk, PrefetchFunctor prefetch_chunk,
+                     std::shared_ptr<ChunkCache> chunk_cache, std::size_t max_in_flight)
+    : get_chunk_(std::move(get_chunk)),
+      prefetch_chunk_(std::move(prefetch_chunk)),
+      chunk_cache_(std::move(chunk_cache)),
+      max_in_flight_(std::max<std::size_t>(max_in_flight, 1)),
+      mutex_(),
+      last_offset_(0),
+      next_offset_(0),
+      sequential_count_(0),
+      window_(kInitialWindow),
+      prefetch_end_(0),
+      cursor_index_(0),
+      cursor_offset_(0),
+      prefetched_(),
+      queued_(),
+      hits_(0),
+      misses_(0),
+      stalls_(0) {}
+
+std::vector<std::size_t> Readahead::Notify(const encrypt::DataMap& data_map,
+                                           std::uint64_t offset, std::uint32_t length) {
+  std::vector<std::size_t> demanded;
+  if (!prefetch_chunk_ || length == 0 || data_map.chunks.empty())
+    return demanded;
+
+  const std::lock_guard<std::mutex> lock(mutex_);
+  // A multithreaded drive may handle the kernel's requests slightly out of order, so allow up to
+  // a chunk's slack either side of the stream.
+  const std::uint64_t slack(kOptimalIoSize);
+  if (offset + slack >= last_offset_ && offset <= next_offset_ + slack) {
+    ++sequential_count_;
+    next_offset_ = std::max(next_offset_, offset + length);
+  } else {
+    sequential_count_ = 1;
+    window_ = kInitialWindow;
+    DropUndemanded(prefetched_, std::end(prefetched_));
+    DropUndemanded(queued_, std::end(queued_));
+    prefetch_end_ = 0;
+    next_offset_ = offset + length;
+  }
+  last_offset_ = offset;
+
+  // Drop the chunks fetched ahead which the reader has passed.
+  const std::size_t first(FindChunk(data_map, offset));
+  DropUndemanded(prefetched_, prefetched_.lower_bound(first));
+  DropUndemanded(queued_, queued_.lower_bound(first));
+
+  // Request every chunk this read spans at once.  If there's no chunk cache, a read within one
+  // chunk is left to the encryptor, since it may well hold that chunk already.
+  const std::size_t last(FindChunk(data_map, offset + length - 1));
+  if (last != first || (chunk_cache_ && chunk_cache_->capacity() != 0)) {
+    for (std::size_t index(first); index <= last && index < data_map.chunks.size(); ++index) {
+      if (Enqueue(data_map, index, false))
+        demanded.push_back(index);
+    }
+  }
+
+  // Then those following the end of this read, if reads are sequential.
+  if (IsStreaming()) {
+    if (prefetch_end_ != 0 && last >= prefetch_end_)
+      GrowWindow();  // The reader has overtaken the window
+    const std::size_t end(std::min(data_map.chunks.size(), last + 1 + window_));
+    for (std::size_t index(last + 1); index < end; ++index)
+      Enqueue(data_map, index, true);
+    prefetch_end_ = std::max(prefetch_end_, end);
+  }
+
+  IssueQueued();
+  return demanded;
+}
+
+void Readahead::Release(const std::vector<std::size_t>& demanded) {
+  if (demanded.empty())
+    return;
+  const std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto index : demanded) {
+    for (auto* requests : {&prefetched_, &queued_}) {
+      const auto itr(requests->find(index));
+      if (itr != std::end(*requests) && itr->second.demand_count != 0 &&
+          --itr->second.demand_count == 0) {
+        requests->erase(itr);
+      }
+    }
+  }
+}
+
+NonEmptyString Readahead::GetChunk(const std::string& name) {
+  const auto has_name([&name](const std::pair<const std::size_t, Prefetched>& entry) {
+    return entry.second.name == name;
+  });
+  boost::shared_future<ImmutableData> prefetched;
+  {
+    const std::lock_guard<std::mutex> lock(mutex_);
+    const auto itr(std::find_if(std::begin(prefetched_), std::end(prefetched_), has_name));
+    if (itr == std::end(prefetched_)) {
+      // Still queued behind the in-flight limit, so fetch it directly instead.
+      const auto queued_itr(std::find_if(std::begin(queued_), std::end(queued_), has_name));
+      if (queued_itr != std::end(queued_))
+        queued_.erase(queued_itr);
+    } else {
+      prefetched = itr->second.chunk;
+      if (itr->second.demand_count == 0 && !prefetched.is_ready()) {
+        ++stalls_;
+        GrowWindow();
+      }
+    }
+  }
+
+  if (prefetched.valid()) {
+    try {
+      auto data(prefetched.get().data());
+      ++hits_;
+      if (chunk_cache_)
+        chunk_cache_->Put(name, data);
+      const std::lock_guard<std::mutex> lock(mutex_);
+      // A chunk fetched ahead has served its purpose once used, while one a read spans is kept
+      // until that read releases it.
+      const auto itr(std::find_if(std::begin(prefetched_), std::end(prefetched_), has_name));
+      if (itr != std::end(prefetched_) && itr->second.demand_count == 0)
+        prefetched_.erase(itr);
+      IssueQueued();
+      return data;
+    } catch (const std::exception& e) {
+      LOG(kWarning) << "Prefetching chunk failed, retrying: " << e.what();
+    }
+  }
+  ++misses_;
+  return get_chunk_(name);
+}
+
+void Readahead::Reset() {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  last_offset_ = next_offset_ = 0;
+  sequential_count_ = 0;
+  window_ = kInitialWindow;
+  prefetch_end_ = 0;
+  cursor_index_ = 0;
+  cursor_offset_ = 0;
+  prefetched_.clear();
+  queued_.clear();
+}
+
+std::size_t Readahead::window() const {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  return window_;
+}
+
+void Readahead::DropUndemanded(std::map<std::size_t, Prefetched>& requests,
+                               std::map<std::size_t, Prefetched>::iterator end) {
+  for (auto itr(std::begin(requests)); itr != end;) {
+    if (itr->second.demand_count == 0)
+      itr = requests.erase(itr);
+    else
+      ++itr;
+  }
+}
+
+bool Readahead::IsStreaming() const {
+  return prefetch_chunk_ && sequential_count_ >= kSequentialReadThreshold;
+}
+
+void Readahead::GrowWindow() { window_ = std::min(window_ * 2, kMaxReadaheadChunks); }
+
+bool Readahead::Enqueue(const encrypt::DataMap& data_map, std::size_t index, bool ahead) {
+  for (auto* requests : {&prefetched_, &queued_}) {
+    const auto itr(requests->find(index));
+    if (itr != std::end(*requests)) {
+      if (!ahead)
+        ++itr->second.demand_count;
+      return true;
+    }
+  }
+  const auto& hash(data_map.chunks[index].hash);
+  Prefetched request;
+  request.name = std::string(std::begin(hash), std::end(hash));
+  if (chunk_cache_ && chunk_cache_->Contains(request.name))
+    return false;
+  request.demand_count = ahead ? 0 : 1;
+  queued_.emplace(index, std::move(request));
+  return true;
+}
+
+void Readahead::IssueQueued() {
+  auto in_flight(static_cast<std::size_t>(std::count_if(
+      std::begin(prefetched_), std::end(prefetched_),
+      [](const std::pair<const std::size_t, Prefetched>& entry) {
+        return !entry.second.chunk.is_ready();
+      })));
+  while (!queued_.empty() && in_flight < max_in_flight_) {
+    auto request(std::move(queued_.begin()->second));
+    const std::size_t index(queued_.begin()->first);
+    queued_.erase(queued_.begin());
+    try {
+      request.chunk = prefetch_chunk_(request.name);
+    } catch (const std::exception& e) {
+      LOG(kWarning) << "Failed to start fetching chunk " << index << ": " << e.what();
+      queued_.clear();
+      return;
+    }
+    prefetched_.emplace(index, std::move(request));
+    ++in_flight;
+  }
+}
+
+std::size_t Readahead::FindChunk(const encrypt::DataMap& data_map, std::uint64_t position) {
+  if (position < cursor_offset_ || cursor_index_ >= data_map.chunks.size()) {
+    cursor_index_ = 0;
+    cursor_offset_ = 0;
+  }
+  while (cursor_index_ < data_map.chunks.size() &&
+         cursor_offset_ + data_map.chunks[cursor_index_].size <= position) {
+    cursor_offset_ += data_map.chunks[cursor_index_].size;
+    ++cursor_index_;
+  }
+  return cursor_index_;
+}
+
+}  // namespace detail
+
+}  // namespace drive
+
+}  // namespace maidsafe
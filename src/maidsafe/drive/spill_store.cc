@@ -0,0 +1,263 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#include "maidsafe/drive/spill_store.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <vector>
+
+#ifndef MAIDSAFE_WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "boost/filesystem/operations.hpp"
+
+#include "maidsafe/common/error.h"
+#include "maidsafe/common/log.h"
+
+namespace maidsafe {
+
+namespace drive {
+
+namespace detail {
+
+SpillStore::SpillStore(const boost::filesystem::path& path, std::uint64_t capacity,
+                       std::uint32_t slot_size, std::uint64_t growth_step)
+    : path_(path),
+      slot_size_(std::max<std::uint32_t>(slot_size, 1)),
+      slot_limit_(capacity / slot_size_),
+      capacity_(slot_limit_ * slot_size_),
+      growth_step_(std::max<std::uint64_t>(growth_step / slot_size_, 1)),
+      mutex_(),
+      free_(),
+      entries_(),
+      slot_count_(0),
+      slots_used_(0),
+#ifdef MAIDSAFE_WIN32
+      io_mutex_(),
+      file_(path.string().c_str(),
+            std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc) {
+  if (!file_.is_open()) {
+#else
+      file_descriptor_(open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR)) {
+  if (file_descriptor_ == -1) {
+#endif
+    LOG(kError) << "Failed to create spill store at " << path_;
+    BOOST_THROW_EXCEPTION(MakeError(CommonErrors::filesystem_io_error));
+  }
+}
+
+SpillStore::~SpillStore() {
+#ifdef MAIDSAFE_WIN32
+  file_.close();
+#else
+  close(file_descriptor_);
+#endif
+  boost::system::error_code error_code;
+  boost::filesystem::remove(path_, error_code);
+}
+
+bool SpillStore::Put(const std::string& name, const NonEmptyString& content) {
+  const std::string& data(content.string());
+  std::uint64_t first_slot(0);
+  {
+    const std::lock_guard<std::mutex> lock(mutex_);
+    const auto found(entries_.find(name));
+    if (found != std::end(entries_)) {
+      ++found->second.references;
+      return true;
+    }
+    const std::uint64_t slot_count((data.size() + slot_size_ - 1) / slot_size_);
+    first_slot = Allocate(slot_count);
+    if (first_slot == slot_limit_)
+      return false;
+    // Not readable until written.
+    Entry entry = {first_slot, slot_count, static_cast<std::uint32_t>(data.size()), 1, false};
+    entries_.emplace(name, entry);
+  }
+
+  const bool written(WriteAt(first_slot * slot_size_, data.data(), data.size()));
+  if (!written)
+    LOG(kError) << "Failed to write to spill store at " << path_;
+  const std::lock_guard<std::mutex> lock(mutex_);
+  const auto found(entries_.find(name));
+  assert(found != std::end(entries_));
+  found->second.written = written;
+  if (!written)
+    Release(found);
+  return written;
+}
+
+bool SpillStore::Get(const std::string& name, NonEmptyString& content) {
+  Entry entry;
+  {
+    const std::lock_guard<std::mutex> lock(mutex_);
+    const auto found(entries_.find(name));
+    if (found == std::end(entries_) || !found->second.written)
+      return false;
+    // Keeps the slots from being reused while they're read.
+    ++found->second.references;
+    entry = found->second;
+  }
+
+  std::string data(entry.size, 0);
+  const bool read(ReadAt(entry.first_slot * slot_size_, &data[0], data.size()));
+  {
+    const std::lock_guard<std::mutex> lock(mutex_);
+    Release(entries_.find(name));
+  }
+  if (!read) {
+    LOG(kError) << "Failed to read from spill store at " << path_;
+    return false;
+  }
+  content = NonEmptyString(std::move(data));
+  return true;
+}
+
+void SpillStore::Delete(const std::string& name) {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  const auto found(entries_.find(name));
+  if (found != std::end(entries_))
+    Release(found);
+}
+
+void SpillStore::Release(std::unordered_map<std::string, Entry>::iterator entry) {
+  assert(entry != std::end(entries_));
+  if (--entry->second.references != 0)
+    return;
+  Free(entry->second.first_slot, entry->second.slot_count);
+  slots_used_ -= entry->second.slot_count;
+  entries_.erase(entry);
+}
+
+std::uint64_t SpillStore::size() const {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  return slots_used_ * slot_size_;
+}
+
+std::uint64_t SpillStore::file_size() const {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  return slot_count_ * slot_size_;
+}
+
+std::uint64_t SpillStore::Allocate(std::uint64_t count) {
+  if (count == 0 || count > slot_limit_)
+    return slot_limit_;
+  for (;;) {
+    for (auto run(std::begin(free_)); run != std::end(free_); ++run) {
+      if (run->second < count)
+        continue;
+      const std::uint64_t first_slot(run->first);
+      if (run->second > count)
+        free_.emplace(first_slot + count, run->second - count);
+      free_.erase(run);
+      slots_used_ += count;
+      return first_slot;
+    }
+    if (!Grow())
+      return slot_limit_;
+  }
+}
+
+void SpillStore::Free(std::uint64_t first_slot, std::uint64_t count) {
+  auto next(free_.lower_bound(first_slot));
+  if (next != std::end(free_) && first_slot + count == next->first) {
+    count += next->second;
+    next = free_.erase(next);
+  }
+  if (next != std::begin(free_)) {
+    const auto previous(std::prev(next));
+    if (previous->first + previous->second == first_slot) {
+      previous->second += count;
+      return;
+    }
+  }
+  free_.emplace(first_slot, count);
+}
+
+bool SpillStore::Grow() {
+  const std::uint64_t new_slot_count(std::min(slot_count_ + growth_step_, slot_limit_));
+  if (new_slot_count == slot_count_)
+    return false;
+#ifdef MAIDSAFE_WIN32
+  // Writing the last byte extends the file.
+  const char zero(0);
+  if (!WriteAt(new_slot_count * slot_size_ - 1, &zero, 1))
+    return false;
+#elif defined(MAIDSAFE_APPLE) || defined(MAIDSAFE_BSD)
+  if (ftruncate(file_descriptor_, static_cast<off_t>(new_slot_count * slot_size_)) != 0)
+    return false;
+#else
+  // Reserves the blocks now, so that a full disk shows up here rather than part way through a
+  // later write.
+  if (posix_fallocate(file_descriptor_, static_cast<off_t>(slot_count_ * slot_size_),
+                      static_cast<off_t>((new_slot_count - slot_count_) * slot_size_)) != 0) {
+    return false;
+  }
+#endif
+  Free(slot_count_, new_slot_count - slot_count_);
+  slot_count_ = new_slot_count;
+  return true;
+}
+
+bool SpillStore::WriteAt(std::uint64_t offset, const char* data, std::size_t size) {
+#ifdef MAIDSAFE_WIN32
+  const std::lock_guard<std::mutex> lock(io_mutex_);
+  file_.seekp(offset);
+  file_.write(data, size);
+  return file_.good();
+#else
+  while (size != 0) {
+    const ssize_t written(pwrite(file_descriptor_, data, size, static_cast<off_t>(offset)));
+    if (written <= 0)
+      return false;
+    data += written;
+    size -= static_cast<std::size_t>(written);
+    offset += static_cast<std::uint64_t>(written);
+  }
+  return true;
+#endif
+}
+
+bool SpillStore::ReadAt(std::uint64_t offset, char* data, std::size_t size) const {
+#ifdef MAIDSAFE_WIN32
+  const std::lock_guard<std::mutex> lock(io_mutex_);
+  file_.seekg(offset);
+  file_.read(data, size);
+  return file_.good();
+#else
+  while (size != 0) {
+    const ssize_t read_size(pread(file_descriptor_, data, size, static_cast<off_t>(offset)));
+    if (read_size <= 0)
+      return false;
+    data += read_size;
+    size -= static_cast<std::size_t>(read_size);
+    offset += static_cast<std::uint64_t>(read_size);
+  }
+  return true;
+#endif
+}
+
+}  // namespace detail
+
+}  // namespace drive
+
+}  // namespace maidsafe
@@ -0,0 +1,137 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "maidsafe/common/test.h"
+#include "maidsafe/drive/buffer_budget.h"
+
+namespace maidsafe {
+namespace drive {
+namespace detail {
+namespace test {
+
+TEST(BufferBudgetTest, BEH_GrantsWithinTotals) {
+  const auto budget(std::make_shared<BufferBudget>(250, 1000, 100, 400, nullptr, 10,
+                                                   std::chrono::milliseconds(0)));
+  auto first(budget->Acquire(nullptr));
+  EXPECT_EQ(100U, first->memory());
+  EXPECT_EQ(400U, first->disk());
+  auto second(budget->Acquire(nullptr));
+  EXPECT_EQ(0U, budget->shortfalls());
+
+  // Once the totals run low, grants shrink
+  auto third(budget->Acquire(nullptr));
+  EXPECT_EQ(50U, third->memory());
+  EXPECT_EQ(200U, third->disk());
+  EXPECT_EQ(0U, budget->overcommits());
+
+  // Once they're spent, the minimum is granted beyond them
+  auto fourth(budget->Acquire(nullptr));
+  EXPECT_EQ(10U, fourth->memory());
+  EXPECT_EQ(10U, fourth->disk());
+  EXPECT_EQ(2U, budget->shortfalls());
+  EXPECT_EQ(1U, budget->overcommits());
+  EXPECT_EQ(260U, budget->memory_granted());
+  EXPECT_EQ(1010U, budget->disk_granted());
+  EXPECT_EQ(4U, budget->buffer_count());
+
+  // Destroying a grant returns it
+  second.reset();
+  EXPECT_EQ(160U, budget->memory_granted());
+  EXPECT_EQ(610U, budget->disk_granted());
+  EXPECT_EQ(3U, budget->buffer_count());
+  fourth.reset();
+  auto fifth(budget->Acquire(nullptr));
+  EXPECT_EQ(100U, fifth->memory());
+  EXPECT_EQ(400U, fifth->disk());
+}
+
+TEST(BufferBudgetTest, BEH_MemoryAndDiskGrantedSeparately) {
+  const auto budget(std::make_shared<BufferBudget>(1000, 450, 100, 400, nullptr, 10,
+                                                   std::chrono::milliseconds(0)));
+  auto first(budget->Acquire(nullptr));
+  // The disk left is short, but that doesn't cut the memory granted
+  auto second(budget->Acquire(nullptr));
+  EXPECT_EQ(100U, second->memory());
+  EXPECT_EQ(50U, second->disk());
+  EXPECT_EQ(1U, budget->shortfalls());
+  EXPECT_EQ(0U, budget->overcommits());
+}
+
+TEST(BufferBudgetTest, BEH_ColdestIdleBuffersReleasedFirst) {
+  const auto budget(std::make_shared<BufferBudget>(300, 300, 100, 100, nullptr, 10,
+                                                   std::chrono::milliseconds(0)));
+  std::vector<int> released;
+  auto first(budget->Acquire([&] { released.push_back(1); }));
+  auto second(budget->Acquire([&] { released.push_back(2); }));
+  auto third(budget->Acquire([&] { released.push_back(3); }));
+
+  // The first is idle but then used again, so the second is now the coldest idle buffer.  The
+  // third is in use, so it isn't asked.
+  first->SetIdle(true);
+  second->SetIdle(true);
+  first->SetIdle(false);
+  first->SetIdle(true);
+  auto fourth(budget->Acquire(nullptr));
+  EXPECT_EQ(10U, fourth->memory());
+  EXPECT_EQ(std::vector<int>({2}), released);
+
+  // A buffer already asked isn't asked again
+  auto fifth(budget->Acquire(nullptr));
+  EXPECT_EQ(std::vector<int>({2, 1}), released);
+
+  second.reset();
+  fourth.reset();
+  fifth.reset();
+  auto sixth(budget->Acquire(nullptr));
+  EXPECT_EQ(100U, sixth->memory());
+  EXPECT_EQ(std::vector<int>({2, 1}), released);
+}
+
+TEST(BufferBudgetTest, BEH_WaitsForRelease) {
+  const auto budget(std::make_shared<BufferBudget>(100, 100, 100, 100, nullptr, 10,
+                                                   std::chrono::seconds(10)));
+  std::unique_ptr<BufferBudget::Grant> first;
+  std::thread releaser;
+  first = budget->Acquire([&] {
+    releaser = std::thread([&] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      first.reset();
+    });
+  });
+  first->SetIdle(true);
+
+  // Rather than granting nothing, or the minimum beyond the budget, the idle buffer's release is
+  // waited for
+  auto second(budget->Acquire(nullptr));
+  releaser.join();
+  EXPECT_EQ(100U, second->memory());
+  EXPECT_EQ(100U, second->disk());
+  EXPECT_EQ(1U, budget->shortfalls());
+  EXPECT_EQ(0U, budget->overcommits());
+  EXPECT_EQ(1U, budget->buffer_count());
+}
+
+}  // namespace test
+}  // namespace detail
+}  // namespace drive
+}  // namespace maidsafe
@@ -0,0 +1,80 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#include <string>
+
+#include "maidsafe/common/test.h"
+#include "maidsafe/drive/chunk_cache.h"
+
+namespace maidsafe {
+namespace drive {
+namespace detail {
+namespace test {
+
+TEST(ChunkCacheTest, BEH_GetAndPut) {
+  ChunkCache cache(1024, 4);
+  NonEmptyString content;
+  EXPECT_FALSE(cache.Get("a", content));
+  cache.Put("a", NonEmptyString(std::string(100, 'a')));
+  EXPECT_TRUE(cache.Contains("a"));
+  ASSERT_TRUE(cache.Get("a", content));
+  EXPECT_EQ(NonEmptyString(std::string(100, 'a')), content);
+  EXPECT_EQ(100U, cache.size());
+  EXPECT_EQ(1U, cache.hits());
+  EXPECT_EQ(1U, cache.misses());
+
+  // Re-adding a cached chunk doesn't duplicate it
+  cache.Put("a", NonEmptyString(std::string(100, 'a')));
+  EXPECT_EQ(100U, cache.size());
+
+  // Chunks larger than a shard's share of the capacity aren't cached
+  cache.Put("b", NonEmptyString(std::string(257, 'b')));
+  EXPECT_FALSE(cache.Contains("b"));
+}
+
+TEST(ChunkCacheTest, BEH_EvictsLeastRecentlyUsed) {
+  ChunkCache cache(300, 1);
+  cache.Put("a", NonEmptyString(std::string(100, 'a')));
+  cache.Put("b", NonEmptyString(std::string(100, 'b')));
+  cache.Put("c", NonEmptyString(std::string(100, 'c')));
+  NonEmptyString content;
+  EXPECT_TRUE(cache.Get("a", content));
+  // Contains() doesn't count as a use, so "b" is the least recently used
+  EXPECT_TRUE(cache.Contains("b"));
+
+  cache.Put("d", NonEmptyString(std::string(150, 'd')));
+  EXPECT_TRUE(cache.Contains("a"));
+  EXPECT_FALSE(cache.Contains("b"));
+  EXPECT_FALSE(cache.Contains("c"));
+  EXPECT_TRUE(cache.Contains("d"));
+  EXPECT_EQ(2U, cache.evictions());
+  EXPECT_EQ(250U, cache.size());
+}
+
+TEST(ChunkCacheTest, BEH_ZeroCapacityDisables) {
+  ChunkCache cache(0);
+  cache.Put("a", NonEmptyString(std::string(1, 'a')));
+  NonEmptyString content;
+  EXPECT_FALSE(cache.Get("a", content));
+  EXPECT_EQ(0U, cache.size());
+}
+
+}  // namespace test
+}  // namespace detail
+}  // namespace drive
+}  // namespace maidsafe
@@ -22,9 +22,11 @@
 #include <time.h>
 #endif
 
+#include <algorithm>
 #include <fstream>  // NOLINT
 #include <mutex>
 #include <string>
+#include <vector>
 
 #include "boost/filesystem/path.hpp"
 #ifdef _MSC_VER
@@ -446,6 +448,42 @@ TEST_F(DirectoryHandlerTest, BEH_RenameAndMoveFile) {
                std::exception);
 }
 
+TEST_F(DirectoryHandlerTest, BEH_RefreshFromStorage) {
+  listing_handler_ = detail::DirectoryHandler<nfs::FakeStore>::Create(
+      data_store_, unique_user_id_, root_parent_id_,
+      boost::filesystem::unique_path(GetUserAppDir() / "Buffers" / "%%%%%-%%%%%-%%%%%-%%%%%"), true,
+      asio_service_.service());
+  EXPECT_NO_THROW(listing_handler_->Add(kRoot / "First",
+                                        File::Create(asio_service_.service(), "First", false)));
+  EXPECT_NO_THROW(listing_handler_->StoreAll());
+
+  // A second client of the same drive.
+  auto other_handler(detail::DirectoryHandler<nfs::FakeStore>::Create(
+      data_store_, unique_user_id_, root_parent_id_,
+      boost::filesystem::unique_path(GetUserAppDir() / "Buffers" / "%%%%%-%%%%%-%%%%%-%%%%%"),
+      false, asio_service_.service()));
+  std::shared_ptr<Directory> directory;
+  EXPECT_NO_THROW(directory = other_handler->Get<Directory>(kRoot));
+  EXPECT_TRUE(directory->HasChild("First"));
+  EXPECT_TRUE(other_handler->RefreshFromStorage().empty());
+
+  EXPECT_NO_THROW(listing_handler_->Add(kRoot / "Second",
+                                        File::Create(asio_service_.service(), "Second", false)));
+  EXPECT_NO_THROW(listing_handler_->StoreAll());
+
+  const auto changes(other_handler->RefreshFromStorage());
+  const auto root_change(std::find_if(std::begin(changes), std::end(changes),
+                                      [](const RemoteChange& change) {
+    return change.relative_path == kRoot;
+  }));
+  ASSERT_TRUE(root_change != std::end(changes));
+  ASSERT_EQ(1U, root_change->changed_children.size());
+  EXPECT_TRUE(fs::path("Second") == root_change->changed_children.front());
+  EXPECT_NO_THROW(directory = other_handler->Get<Directory>(kRoot));
+  EXPECT_TRUE(directory->HasChild("Second"));
+  EXPECT_TRUE(other_handler->RefreshFromStorage().empty());
+}
+
 }  // namespace test
 
 }  // namespace detail
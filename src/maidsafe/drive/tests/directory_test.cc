@@ -20,8 +20,12 @@
 #include <windows.h>
 #endif
 
+#include <atomic>
+#include <chrono>
 #include <fstream>
 #include <string>
+#include <thread>
+#include <vector>
 #include "boost/filesystem.hpp"
 #include "boost/thread.hpp"
 #include "boost/random/mersenne_twister.hpp"
@@ -29,6 +33,7 @@
 #include "boost/random/variate_generator.hpp"
 
 #include "maidsafe/common/crypto.h"
+#include "maidsafe/common/error.h"
 #include "maidsafe/common/log.h"
 #include "maidsafe/common/test.h"
 #include "maidsafe/common/utils.h"
@@ -55,9 +60,14 @@ namespace test {
 class DirectoryTestListener : public std::enable_shared_from_this<DirectoryTestListener>,
                               public Directory::Listener {
  public:
+  DirectoryTestListener() : put_count(0), fail_puts(false) {}
+
   // Directory::Listener
   virtual void DirectoryPut(std::shared_ptr<Directory> path) override {
     LOG(kInfo) << "Putting directory.";
+    if (fail_puts)
+      BOOST_THROW_EXCEPTION(MakeError(CommonErrors::unknown));
+    ++put_count;
     ImmutableData contents(NonEmptyString(path->Serialise()));
     std::static_pointer_cast<Directory>(path)->AddNewVersion(contents.name());
   }
@@ -68,6 +78,12 @@ class DirectoryTestListener : public std::enable_shared_from_this<DirectoryTestL
   virtual void DirectoryIncrementChunks(const std::vector<ImmutableData::Name>&) override {
     LOG(kInfo) << "Incrementing chunks.";
   }
+  virtual void DirectoryDecrementChunks(const std::vector<ImmutableData::Name>&) override {
+    LOG(kInfo) << "Decrementing chunks.";
+  }
+
+  std::atomic<int> put_count;
+  std::atomic<bool> fail_puts;
 };
 
 class DirectoryTest : public testing::Test {
@@ -502,6 +518,85 @@ TEST_F(DirectoryTest, BEH_IteratorReset) {
   // EXPECT_TRUE(directory_listing1 < directory_listing2);
 }
 
+TEST_F(DirectoryTest, BEH_GetChildren) {
+  auto directory(Directory::Create(ParentId(unique_id_), parent_id_, asio_service_.service(),
+                                   GetListener(), ""));
+  EXPECT_TRUE(directory->GetChildren().empty());
+
+  const std::vector<std::string> kNames{"D", "B", "A", "C"};
+  for (const auto& name : kNames)
+    EXPECT_NO_THROW(directory->AddChild(File::Create(asio_service_.service(), name, false)));
+
+  auto children(directory->GetChildren());
+  ASSERT_EQ(kNames.size(), children.size());
+  char c('A');
+  for (const auto& child : children)
+    EXPECT_TRUE(std::string(1, c++) == child->meta_data.name());
+
+  // Taking the children must not disturb the internal iterator
+  std::shared_ptr<const Path> file;
+  EXPECT_NO_THROW(file = directory->GetChildAndIncrementCounter());
+  EXPECT_TRUE("A" == file->meta_data.name());
+  children = directory->GetChildren();
+  EXPECT_NO_THROW(file = directory->GetChildAndIncrementCounter());
+  EXPECT_TRUE("B" == file->meta_data.name());
+
+  EXPECT_NO_THROW(directory->RemoveChild("B"));
+  children = directory->GetChildren();
+  ASSERT_EQ(kNames.size() - 1, children.size());
+  EXPECT_TRUE("C" == children[1]->meta_data.name());
+}
+
+TEST_F(DirectoryTest, BEH_SyncGroupCommit) {
+  auto directory(Directory::Create(ParentId(unique_id_), parent_id_, asio_service_.service(),
+                                   GetListener(), ""));
+  // Creation schedules the initial store; Sync brings it forward and waits for it.
+  EXPECT_NO_THROW(directory->Sync());
+  EXPECT_EQ(1, listener->put_count);
+  EXPECT_EQ(1U, directory->VersionsCount());
+
+  // Nothing has changed, so a further Sync must not store again.
+  EXPECT_NO_THROW(directory->Sync());
+  EXPECT_EQ(1, listener->put_count);
+
+  // Many concurrent syncs following a single change share one store.
+  EXPECT_NO_THROW(directory->AddChild(File::Create(asio_service_.service(), "A", false)));
+  std::vector<std::thread> syncers;
+  for (int i(0); i != 8; ++i)
+    syncers.emplace_back([directory] { directory->Sync(); });
+  for (auto& syncer : syncers)
+    syncer.join();
+  EXPECT_EQ(2, listener->put_count);
+  EXPECT_EQ(2U, directory->VersionsCount());
+  EXPECT_FALSE(directory->HasPending());
+}
+
+TEST_F(DirectoryTest, BEH_FailedStore) {
+  auto directory(Directory::Create(ParentId(unique_id_), parent_id_, asio_service_.service(),
+                                   GetListener(), ""));
+  // Waits for the cancelled timer's handler too.
+  const auto finished([directory] {
+    for (int i(0); i != 100 && directory->HasPending(); ++i)
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    return !directory->HasPending();
+  });
+  listener->fail_puts = true;
+  // Sync reports the failure, and the store is no longer pending.
+  EXPECT_THROW(directory->Sync(), std::exception);
+  EXPECT_TRUE(finished());
+
+  // A store run by the timer logs the failure instead, and likewise finishes.
+  EXPECT_NO_THROW(directory->AddChild(File::Create(asio_service_.service(), "A", false)));
+  EXPECT_TRUE(directory->HasPending());
+  EXPECT_TRUE(finished());
+  EXPECT_EQ(0, listener->put_count);
+
+  listener->fail_puts = false;
+  EXPECT_NO_THROW(directory->AddChild(File::Create(asio_service_.service(), "B", false)));
+  EXPECT_NO_THROW(directory->Sync());
+  EXPECT_EQ(1, listener->put_count);
+}
+
 }  // namespace test
 
 }  // namespace detail
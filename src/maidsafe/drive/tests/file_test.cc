@@ -15,18 +15,26 @@
 
     See the Licences for the specific language governing permissions and limitations relating to
     use of the MaidSafe Software.                                                                 */
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <future>
 #include <memory>
 #include <stdexcept>
+#include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include "maidsafe/common/asio_service.h"
 #include "maidsafe/common/config.h"
 #include "maidsafe/common/data_types/immutable_data.h"
 #include "maidsafe/common/on_scope_exit.h"
 #include "maidsafe/common/test.h"
+#include "maidsafe/common/utils.h"
 #include "maidsafe/drive/directory.h"
 #include "maidsafe/drive/file.h"
+#include "maidsafe/encrypt/data_map.h"
 
 namespace maidsafe {
 namespace drive {
@@ -77,6 +85,18 @@ class TestListener : public Directory::Listener {
     }
   }
 
+  virtual void DirectoryDecrementChunks(
+      const std::vector<ImmutableData::Name>& decrement) override {
+    for (const auto& name : decrement) {
+      const auto find_iter = chunk_map_.find(name.value.string());
+      if (find_iter == chunk_map_.end()) {
+        ADD_FAILURE() << "Request to decrement chunk that does not exist";
+      } else if (--(find_iter->second.second) == 0) {
+        chunk_map_.erase(find_iter);
+      }
+    }
+  }
+
  private:
   std::unordered_map<std::string, std::pair<NonEmptyString, unsigned>> chunk_map_;
 };
@@ -109,7 +129,7 @@ class FileTests : public ::testing::Test {
       ASSERT_GE(3u, iterations);
       ++iterations;
 
-      std::this_thread::sleep_for(detail::kFileInactivityDelay);
+      std::this_thread::sleep_for(detail::kDirectoryInactivityDelay);
       asio_service_.reset();
       completed += asio_service_.poll();
     } while (completed < number_handlers);
@@ -117,6 +137,22 @@ class FileTests : public ::testing::Test {
     EXPECT_EQ(number_handlers, completed);
   }
 
+  // Runs the handlers which are ready, without waiting.
+  void RunReadyHandlers() {
+    asio_service_.reset();
+    asio_service_.poll();
+  }
+
+  std::size_t TotalChunksStored() const { return test_listener_->TotalChunksStored(); }
+
+  // The entry for the only file in the parent set by SetListener(), as the parent serialises it.
+  protobuf::Path SerialiseParent() {
+    protobuf::Directory proto_directory;
+    EXPECT_TRUE(proto_directory.ParseFromString(test_directory_->Serialise()));
+    EXPECT_EQ(1, proto_directory.children_size());
+    return proto_directory.children_size() == 0 ? protobuf::Path() : proto_directory.children(0);
+  }
+
   std::shared_ptr<File> CreateTestFile() { return File::Create(asio_service_, "foo", false); }
 
   // This isn't called automatically so that WaitForHandlers can identify
@@ -135,7 +171,16 @@ class FileTests : public ::testing::Test {
     test_file.SetParent(test_directory_);
   }
 
-  void OpenTestFile(File& test_file) {
+  // As above, and adds the file to the parent's listing.
+  void AddToParent(const std::shared_ptr<File>& test_file) {
+    SetListener(*test_file);
+    test_directory_->AddChild(test_file);
+  }
+
+  void OpenTestFile(File& test_file, boost::asio::io_service* upload_service = nullptr,
+                    const std::shared_ptr<BufferBudget>& buffer_budget = nullptr,
+                    const std::shared_ptr<KeepAliveCache>& keep_alive_cache = nullptr,
+                    boost::asio::io_service* write_behind_service = nullptr) {
     if (test_path_ == nullptr) {
       test_path_ = ::maidsafe::test::CreateTestPath("MaidSafe_Test_Drive");
       if (test_path_ == nullptr || test_path_->string() == "") {
@@ -151,7 +196,9 @@ class FileTests : public ::testing::Test {
                      }
                      BOOST_THROW_EXCEPTION(std::runtime_error("unexpected chunk missing"));
                    },
-                   MemoryUsage(kTestMemoryUsageMax), DiskUsage(kTestDiskUsageMax), *test_path_);
+                   MemoryUsage(kTestMemoryUsageMax), DiskUsage(kTestDiskUsageMax), *test_path_,
+                   Readahead::PrefetchFunctor(), nullptr, upload_service, buffer_budget,
+                   keep_alive_cache, write_behind_service);
   }
 
   static std::uint32_t WriteTestFile(File& test_file, const std::string contents,
@@ -302,6 +349,177 @@ TEST_F(FileTests, BEH_ReadPastEnd) {
   EXPECT_EQ(MetaData::FileType::regular_file, test_file->meta_data.file_type());
 }
 
+TEST_F(FileTests, BEH_ScatterGather) {
+  const std::shared_ptr<File> test_file = CreateTestFile();
+  ASSERT_NE(nullptr, test_file.get());
+  const on_scope_exit close_file([test_file] { test_file->Close(); });
+  OpenTestFile(*test_file);
+
+  const std::string first("scatter"), second(""), third("gather");
+  const std::vector<File::WriteSegment> write_segments{
+      File::WriteSegment(first.data(), std::uint32_t(first.size())),
+      File::WriteSegment(second.data(), std::uint32_t(second.size())),
+      File::WriteSegment(third.data(), std::uint32_t(third.size()))};
+  EXPECT_EQ(first.size() + third.size(), test_file->WriteV(write_segments, 0));
+  EXPECT_EQ(first.size() + third.size(), test_file->meta_data.size());
+  EXPECT_EQ(first + third, ReadTestFile(*test_file));
+
+  // Reads stop at the end of the file, leaving later segments untouched
+  std::string head(5, 'x'), middle(6, 'x'), tail(4, 'x');
+  const std::vector<File::ReadSegment> read_segments{
+      File::ReadSegment(&head[0], std::uint32_t(head.size())),
+      File::ReadSegment(&middle[0], std::uint32_t(middle.size())),
+      File::ReadSegment(&tail[0], std::uint32_t(tail.size()))};
+  EXPECT_EQ(8u, test_file->ReadV(read_segments, 5));
+  EXPECT_EQ("ergat", head);
+  EXPECT_EQ("herxxx", middle);
+  EXPECT_EQ(std::string(4, 'x'), tail);
+}
+
+TEST_F(FileTests, BEH_CoalescedWrites) {
+  const std::shared_ptr<File> test_file = CreateTestFile();
+  ASSERT_NE(nullptr, test_file.get());
+  const on_scope_exit close_file([test_file] { test_file->Close(); });
+  OpenTestFile(*test_file);
+
+  // Small sequential writes, followed by one which rewrites the start of the file
+  const std::uint32_t piece_size(4096);
+  std::string expected(RandomString(64 * piece_size));
+  for (std::uint32_t offset(0); offset != expected.size(); offset += piece_size) {
+    EXPECT_EQ(piece_size, WriteTestFile(*test_file, expected.substr(offset, piece_size), offset));
+    EXPECT_EQ(offset + piece_size, test_file->meta_data.size());
+  }
+  const std::string rewrite(RandomString(piece_size));
+  EXPECT_EQ(piece_size, WriteTestFile(*test_file, rewrite, 0));
+  expected.replace(0, piece_size, rewrite);
+  EXPECT_EQ(expected.size(), test_file->meta_data.size());
+  EXPECT_EQ(expected, ReadTestFile(*test_file));
+
+  // A write the size of a whole extent bypasses it
+  const std::string large(RandomString(kWriteCoalescingSize));
+  EXPECT_EQ(large.size(), WriteTestFile(*test_file, large, std::uint32_t(expected.size())));
+  expected += large;
+  EXPECT_EQ(expected.size(), test_file->meta_data.size());
+  EXPECT_EQ(expected, ReadTestFile(*test_file));
+}
+
+TEST_F(FileTests, BEH_WriteBehind) {
+  const std::shared_ptr<File> test_file = CreateTestFile();
+  // Not run until the test chooses, so the queue only drains when something needs it to
+  boost::asio::io_service write_behind_service;
+  const on_scope_exit close_file([test_file] { test_file->Close(); });
+  OpenTestFile(*test_file, nullptr, nullptr, nullptr, &write_behind_service);
+
+  // Acknowledged before reaching the encryptor, but seen by stats and reads straight away
+  const std::string head(RandomString(1000));
+  EXPECT_EQ(head.size(), WriteTestFile(*test_file, head, 0));
+  EXPECT_EQ(head.size(), test_file->meta_data.size());
+  EXPECT_EQ(head, ReadTestFile(*test_file));
+  // The read drained the queue, so the drain posted by the write finds nothing to do
+  write_behind_service.reset();
+  EXPECT_EQ(1u, write_behind_service.poll());
+
+  // A full queue holds up the next writer until it has drained.  The filler compresses to
+  // almost nothing, so fits the test's small buffer.
+  const std::string filler(static_cast<std::size_t>(kWriteBehindQueueSize), 'a');
+  EXPECT_EQ(filler.size(), WriteTestFile(*test_file, filler, std::uint32_t(head.size())));
+  std::atomic<bool> written(false);
+  std::thread writer([&] {
+    WriteTestFile(*test_file, "b", std::uint32_t(head.size() + filler.size()));
+    written = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_FALSE(written);
+  for (int i(0); i != 100 && !written; ++i) {
+    write_behind_service.reset();
+    write_behind_service.poll();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  writer.join();
+  EXPECT_EQ(head + filler + "b", ReadTestFile(*test_file));
+}
+
+TEST_F(FileTests, BEH_InlineFile) {
+  const std::shared_ptr<File> test_file = CreateTestFile();
+  ASSERT_NE(nullptr, test_file.get());
+  SetListener(*test_file);
+  test_file->meta_data.SetInlineContent(std::string());
+  const on_scope_exit close_file([test_file] { test_file->Close(); });
+  OpenTestFile(*test_file);
+  EXPECT_TRUE(test_file->IsBuffered());
+
+  std::string expected(RandomString(1000));
+  EXPECT_EQ(expected.size(), WriteTestFile(*test_file, expected, 0));
+  test_file->Truncate(2000);
+  expected.resize(2000, '\0');
+  EXPECT_EQ(expected, ReadTestFile(*test_file));
+  EXPECT_EQ(1000u, test_file->meta_data.allocation_size());
+
+  // The content is serialised in place of a data map, and no chunks are stored
+  {
+    protobuf::Directory proto;
+    std::vector<ImmutableData::Name> chunks;
+    test_file->Serialise(proto, chunks);
+    EXPECT_TRUE(chunks.empty());
+    EXPECT_EQ(0u, TotalChunksStored());
+    ASSERT_EQ(1, proto.children_size());
+    EXPECT_FALSE(proto.children(0).has_serialised_data_map());
+    const MetaData reloaded(proto.children(0));
+    ASSERT_NE(nullptr, reloaded.inline_content());
+    EXPECT_EQ(expected.substr(0, 1000), *reloaded.inline_content());
+    EXPECT_EQ(expected.size(), reloaded.size());
+  }
+
+  // Outgrowing the limit moves the content into the encryptor
+  const std::string appended(RandomString(kMaxInlineFileSize));
+  EXPECT_EQ(appended.size(),
+            WriteTestFile(*test_file, appended, std::uint32_t(expected.size())));
+  expected += appended;
+  EXPECT_EQ(nullptr, test_file->meta_data.inline_content());
+  EXPECT_EQ(expected, ReadTestFile(*test_file));
+  {
+    protobuf::Directory proto;
+    std::vector<ImmutableData::Name> chunks;
+    test_file->Serialise(proto, chunks);
+    ASSERT_EQ(1, proto.children_size());
+    EXPECT_TRUE(proto.children(0).has_serialised_data_map());
+    EXPECT_FALSE(proto.children(0).has_inline_content());
+  }
+  EXPECT_EQ(expected, ReadTestFile(*test_file));
+}
+
+TEST_F(FileTests, BEH_ConcurrentReads) {
+  const std::shared_ptr<File> test_file = CreateTestFile();
+  ASSERT_NE(nullptr, test_file.get());
+  const on_scope_exit close_file([test_file] { test_file->Close(); });
+  OpenTestFile(*test_file);
+
+  const std::string test_output(RandomString(64 * 1024));
+  EXPECT_EQ(test_output.size(), WriteTestFile(*test_file, test_output, 0));
+
+  // Each reader checks its own stripe repeatedly while the others read theirs
+  const unsigned reader_count(4);
+  const std::uint32_t stripe(std::uint32_t(test_output.size() / reader_count));
+  std::vector<std::thread> readers;
+  std::vector<unsigned> mismatches(reader_count, 0);
+  for (unsigned i(0); i != reader_count; ++i) {
+    readers.emplace_back([&, i] {
+      for (int iteration(0); iteration != 20; ++iteration) {
+        if (ReadTestFile(*test_file, stripe, i * stripe) !=
+            test_output.substr(i * stripe, stripe)) {
+          ++mismatches[i];
+        }
+      }
+    });
+  }
+  for (auto& reader : readers)
+    reader.join();
+
+  for (unsigned i(0); i != reader_count; ++i)
+    EXPECT_EQ(0u, mismatches[i]) << "Reader " << i << " saw the wrong data";
+  EXPECT_EQ(test_output, ReadTestFile(*test_file));
+}
+
 TEST_F(FileTests, BEH_TruncateIncrease) {
   const std::shared_ptr<File> test_file = CreateTestFile();
   ASSERT_NE(nullptr, test_file.get());
@@ -327,7 +545,7 @@ TEST_F(FileTests, BEH_TruncateIncrease) {
   EXPECT_EQ(last_write_time, test_file->meta_data.last_status_time());
   EXPECT_EQ(last_write_time, test_file->meta_data.last_access_time());
   EXPECT_EQ(new_file_size, test_file->meta_data.size());
-  EXPECT_EQ(new_file_size, test_file->meta_data.allocation_size());
+  EXPECT_EQ(0u, test_file->meta_data.allocation_size());
   EXPECT_EQ(MetaData::FileType::regular_file, test_file->meta_data.file_type());
 
   EXPECT_EQ(std::string(new_file_size, '\0'), ReadTestFile(*test_file));
@@ -336,10 +554,50 @@ TEST_F(FileTests, BEH_TruncateIncrease) {
   EXPECT_EQ(last_write_time, test_file->meta_data.last_status_time());
   EXPECT_LE(last_write_time, test_file->meta_data.last_access_time());
   EXPECT_EQ(new_file_size, test_file->meta_data.size());
-  EXPECT_EQ(new_file_size, test_file->meta_data.allocation_size());
+  EXPECT_EQ(0u, test_file->meta_data.allocation_size());
   EXPECT_EQ(MetaData::FileType::regular_file, test_file->meta_data.file_type());
 }
 
+TEST_F(FileTests, BEH_SparseFile) {
+  const std::shared_ptr<File> test_file = CreateTestFile();
+  ASSERT_NE(nullptr, test_file.get());
+  SetListener(*test_file);
+  const on_scope_exit close_file([test_file] { test_file->Close(); });
+  OpenTestFile(*test_file);
+
+  const std::string head(RandomString(4096));
+  const std::uint32_t file_size(8 * 1024 * 1024);
+  EXPECT_EQ(head.size(), WriteTestFile(*test_file, head, 0));
+  test_file->Truncate(file_size);
+  EXPECT_EQ(file_size, test_file->meta_data.size());
+  EXPECT_EQ(head.size(), test_file->meta_data.allocation_size());
+
+  // The hole reads as zeros, both on its own and following the data
+  EXPECT_EQ(std::string(100, '\0'), ReadTestFile(*test_file, 100, file_size - 100));
+  EXPECT_EQ(head + std::string(100, '\0'),
+            ReadTestFile(*test_file, std::uint32_t(head.size() + 100), 0));
+  EXPECT_TRUE(ReadTestFile(*test_file, 100, file_size).empty());
+
+  // Only the data is encrypted, while the directory keeps the full size
+  protobuf::Directory proto;
+  std::vector<ImmutableData::Name> chunks;
+  test_file->Serialise(proto, chunks);
+  ASSERT_EQ(1, proto.children_size());
+  EXPECT_EQ(file_size, proto.children(0).attributes().st_size());
+  const MetaData reloaded(proto.children(0));
+  EXPECT_EQ(file_size, reloaded.size());
+  EXPECT_EQ(head.size(), reloaded.allocation_size());
+
+  // A write past the hole fills it, but a shrink to within the hole needs nothing written
+  test_file->Truncate(file_size / 2);
+  EXPECT_EQ(file_size / 2, test_file->meta_data.size());
+  EXPECT_EQ(head.size(), test_file->meta_data.allocation_size());
+  EXPECT_EQ(head.size(), WriteTestFile(*test_file, head, file_size / 2));
+  EXPECT_EQ(file_size / 2 + head.size(), test_file->meta_data.size());
+  EXPECT_EQ(test_file->meta_data.size(), test_file->meta_data.allocation_size());
+  EXPECT_EQ(head, ReadTestFile(*test_file, std::uint32_t(head.size()), file_size / 2));
+}
+
 TEST_F(FileTests, BEH_TruncateDecrease) {
   const std::shared_ptr<File> test_file = CreateTestFile();
   ASSERT_NE(nullptr, test_file.get());
@@ -389,23 +647,223 @@ TEST_F(FileTests, BEH_TruncateDecrease) {
   EXPECT_EQ(MetaData::FileType::regular_file, test_file->meta_data.file_type());
 }
 
-TEST_F(FileTests, BEH_CloseTimer) {
+TEST_F(FileTests, BEH_KeepAlive) {
   const std::shared_ptr<File> test_file = CreateTestFile();
   EXPECT_EQ(0u, test_file->meta_data.size());
   EXPECT_EQ(0u, test_file->meta_data.allocation_size());
 
+  const auto keep_alive_cache(std::make_shared<KeepAliveCache>(
+      asio_service_, detail::kMaxIdleOpenFiles, std::chrono::milliseconds(100)));
   const std::size_t file_size = 500;
   {
     const on_scope_exit close_file([test_file] { test_file->Close(); });
-    OpenTestFile(*test_file);
+    OpenTestFile(*test_file, nullptr, nullptr, keep_alive_cache);
     test_file->Truncate(file_size);
+    // Sparse, so nothing is allocated
     EXPECT_EQ(file_size, test_file->meta_data.size());
-    EXPECT_EQ(file_size, test_file->meta_data.allocation_size());
+    EXPECT_EQ(0u, test_file->meta_data.allocation_size());
   }
 
+  // The buffer is kept until the cache's sweeper finds it idle
+  EXPECT_TRUE(test_file->IsBuffered());
+  EXPECT_EQ(1u, keep_alive_cache->size());
   WaitForHandlers(1);
+  EXPECT_FALSE(test_file->IsBuffered());
+  EXPECT_EQ(0u, keep_alive_cache->size());
   EXPECT_EQ(file_size, test_file->meta_data.size());
-  EXPECT_EQ(file_size, test_file->meta_data.allocation_size());
+  EXPECT_EQ(0u, test_file->meta_data.allocation_size());
+}
+
+TEST_F(FileTests, BEH_ReopenDuringUpload) {
+  const std::shared_ptr<File> test_file = CreateTestFile();
+  SetListener(*test_file);
+
+  // The uploads are queued here, and not run until the file has been reopened and read
+  boost::asio::io_service upload_service;
+  const std::string file_contents(RandomString(10000));
+  {
+    const on_scope_exit close_file([test_file] { test_file->Close(); });
+    OpenTestFile(*test_file, &upload_service);
+    EXPECT_EQ(file_contents.size(), WriteTestFile(*test_file, file_contents, 0));
+  }
+
+  // The parent's initial store (cancelled by the write), its rescheduled store and the close
+  WaitForHandlers(3);
+  EXPECT_FALSE(test_file->IsBuffered());
+  EXPECT_EQ(0u, TotalChunksStored());
+
+  {
+    const on_scope_exit close_file([test_file] { test_file->Close(); });
+    OpenTestFile(*test_file, &upload_service);
+    EXPECT_EQ(file_contents, ReadTestFile(*test_file));
+  }
+
+  upload_service.reset();
+  EXPECT_EQ(1u, upload_service.poll());
+  EXPECT_EQ(3u, TotalChunksStored());
+}
+
+TEST_F(FileTests, BEH_SerialiseDuringUpload) {
+  const std::shared_ptr<File> test_file = CreateTestFile();
+  AddToParent(test_file);
+
+  boost::asio::io_service upload_service;
+  const std::string file_contents(RandomString(10000));
+  {
+    const on_scope_exit close_file([test_file] { test_file->Close(); });
+    OpenTestFile(*test_file, &upload_service);
+    EXPECT_EQ(file_contents.size(), WriteTestFile(*test_file, file_contents, 0));
+  }
+  // The parent's initial store (cancelled by the add), the add's store (cancelled by the write),
+  // the write's store and the close
+  WaitForHandlers(4);
+  EXPECT_FALSE(test_file->IsBuffered());
+  EXPECT_EQ(0u, TotalChunksStored());
+
+  // The parent is serialised, and the file reopened and read, while the upload is still queued
+  auto serialised(std::async(std::launch::async, [this] { return SerialiseParent(); }));
+  {
+    const on_scope_exit close_file([test_file] { test_file->Close(); });
+    OpenTestFile(*test_file, &upload_service);
+    EXPECT_EQ(file_contents, ReadTestFile(*test_file));
+  }
+  const auto status(serialised.wait_for(std::chrono::seconds(10)));
+  upload_service.reset();
+  EXPECT_EQ(1u, upload_service.poll());
+  ASSERT_EQ(std::future_status::ready, status);
+
+  // Until the chunks were stored, the data map from before the write was serialised
+  std::string serialised_data_map;
+  encrypt::SerialiseDataMap(*test_file->meta_data.data_map(), serialised_data_map);
+  EXPECT_NE(serialised_data_map, serialised.get().serialised_data_map());
+  EXPECT_EQ(3u, TotalChunksStored());
+
+  // The upload stored the parent again, this time with the written data map.  The other handler
+  // is the second close.
+  WaitForHandlers(2);
+  EXPECT_EQ(serialised_data_map, SerialiseParent().serialised_data_map());
+}
+
+TEST_F(FileTests, BEH_SerialiseOpenFile) {
+  const std::shared_ptr<File> test_file = CreateTestFile();
+  SetListener(*test_file);
+  const on_scope_exit close_file([test_file] { test_file->Close(); });
+  OpenTestFile(*test_file);
+
+  std::string file_contents(RandomString(10000));
+  EXPECT_EQ(file_contents.size(), WriteTestFile(*test_file, file_contents, 0));
+
+  // The first checkpoint stores the written chunks
+  {
+    protobuf::Directory actual_proto;
+    std::vector<ImmutableData::Name> actual_chunks;
+    test_file->Serialise(actual_proto, actual_chunks);
+    EXPECT_TRUE(actual_chunks.empty());
+    EXPECT_EQ(3u, TotalChunksStored());
+    EXPECT_EQ(file_contents, ReadTestFile(*test_file));
+  }
+  // Without writes in between, the next refers to the same chunks again
+  {
+    protobuf::Directory actual_proto;
+    std::vector<ImmutableData::Name> actual_chunks;
+    test_file->Serialise(actual_proto, actual_chunks);
+    EXPECT_EQ(3u, actual_chunks.size());
+    EXPECT_EQ(3u, TotalChunksStored());
+    EXPECT_EQ(file_contents, ReadTestFile(*test_file));
+  }
+
+  const std::string appended(RandomString(5000));
+  EXPECT_EQ(appended.size(),
+            WriteTestFile(*test_file, appended, std::uint32_t(file_contents.size())));
+  file_contents += appended;
+  EXPECT_EQ(file_contents, ReadTestFile(*test_file));
+  {
+    protobuf::Directory actual_proto;
+    std::vector<ImmutableData::Name> actual_chunks;
+    test_file->Serialise(actual_proto, actual_chunks);
+    ASSERT_EQ(1, actual_proto.children_size());
+    EXPECT_EQ(file_contents.size(), actual_proto.children(0).attributes().st_size());
+    EXPECT_EQ(file_contents, ReadTestFile(*test_file));
+  }
+}
+
+TEST_F(FileTests, BEH_CheckpointDuringUpload) {
+  const std::shared_ptr<File> test_file = CreateTestFile();
+  SetListener(*test_file);
+  boost::asio::io_service upload_service;
+  const on_scope_exit close_file([test_file] { test_file->Close(); });
+  OpenTestFile(*test_file, &upload_service);
+
+  const std::string file_contents(RandomString(10000));
+  EXPECT_EQ(file_contents.size(), WriteTestFile(*test_file, file_contents, 0));
+
+  // The checkpoint's chunks are queued for upload rather than stored under the file's lock, so
+  // the empty file is serialised until they have been
+  {
+    protobuf::Directory actual_proto;
+    std::vector<ImmutableData::Name> actual_chunks;
+    test_file->Serialise(actual_proto, actual_chunks);
+    ASSERT_EQ(1, actual_proto.children_size());
+    EXPECT_EQ(0u, actual_proto.children(0).attributes().st_size());
+    EXPECT_EQ(0u, TotalChunksStored());
+    EXPECT_EQ(file_contents, ReadTestFile(*test_file));
+  }
+
+  upload_service.reset();
+  EXPECT_EQ(1u, upload_service.poll());
+  EXPECT_EQ(3u, TotalChunksStored());
+  {
+    protobuf::Directory actual_proto;
+    std::vector<ImmutableData::Name> actual_chunks;
+    test_file->Serialise(actual_proto, actual_chunks);
+    ASSERT_EQ(1, actual_proto.children_size());
+    EXPECT_EQ(file_contents.size(), actual_proto.children(0).attributes().st_size());
+    EXPECT_EQ(file_contents, ReadTestFile(*test_file));
+  }
+}
+
+TEST_F(FileTests, BEH_BufferBudget) {
+  // The test's io_service isn't run while the second file is opened, so its buffer can't wait for
+  // the first's release.
+  const auto budget(std::make_shared<BufferBudget>(
+      kTestMemoryUsageMax, kTestDiskUsageMax, kTestMemoryUsageMax, kTestDiskUsageMax, nullptr,
+      kTestMemoryUsageMax / 2, std::chrono::milliseconds(0)));
+  const auto keep_alive_cache(std::make_shared<KeepAliveCache>(
+      asio_service_, detail::kMaxIdleOpenFiles, std::chrono::hours(1)));
+  const std::shared_ptr<File> first_file = CreateTestFile();
+  OpenTestFile(*first_file, nullptr, budget, keep_alive_cache);
+  EXPECT_EQ(kTestMemoryUsageMax, budget->memory_granted());
+  first_file->Close();
+  EXPECT_EQ(1u, keep_alive_cache->size());
+
+  // The budget is spent, so the second file's buffer gets just the minimum, and the first file's
+  // idle buffer is released without waiting for the cache to expire it.
+  const std::shared_ptr<File> second_file = CreateTestFile();
+  const on_scope_exit close_file([second_file] { second_file->Close(); });
+  OpenTestFile(*second_file, nullptr, budget, keep_alive_cache);
+  EXPECT_EQ(1u, budget->shortfalls());
+  EXPECT_EQ(1u, budget->overcommits());
+  EXPECT_EQ(2u, budget->buffer_count());
+  EXPECT_EQ(kTestMemoryUsageMax + kTestMemoryUsageMax / 2, budget->memory_granted());
+  EXPECT_TRUE(first_file->IsBuffered());
+
+  for (int i(0); i != 100 && first_file->IsBuffered(); ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    RunReadyHandlers();
+  }
+  EXPECT_FALSE(first_file->IsBuffered());
+  EXPECT_EQ(0u, keep_alive_cache->size());
+  EXPECT_EQ(1u, budget->buffer_count());
+  EXPECT_EQ(kTestMemoryUsageMax / 2, budget->memory_granted());
+
+  // Both files' buffers can be written to at once
+  const std::string file_contents(RandomString(kTestMemoryUsageMax / 4));
+  EXPECT_EQ(file_contents.size(), WriteTestFile(*second_file, file_contents, 0));
+  OpenTestFile(*first_file, nullptr, budget, keep_alive_cache);
+  const on_scope_exit close_first_file([first_file] { first_file->Close(); });
+  EXPECT_EQ(file_contents.size(), WriteTestFile(*first_file, file_contents, 0));
+  EXPECT_EQ(file_contents, ReadTestFile(*second_file));
+  EXPECT_EQ(file_contents, ReadTestFile(*first_file));
 }
 
 TEST_F(FileTests, BEH_ExceedMaxDiskUsage) {
@@ -426,6 +884,70 @@ TEST_F(FileTests, BEH_ExceedMaxDiskUsage) {
   EXPECT_THROW(WaitForHandlers(1), maidsafe::common_error);
 }
 
+TEST_F(FileTests, BEH_StreamLargeFile) {
+  const std::shared_ptr<File> test_file = CreateTestFile();
+  SetListener(*test_file);
+
+  // As above, but with a parent to store to, chunks which don't fit the buffer are held rather
+  // than failing the file, and those other than the first and last two stored before the close.
+  const std::string file_contents(RandomString((kTestMemoryUsageMax + kTestDiskUsageMax) * 4));
+  {
+    const on_scope_exit close_file([test_file] { test_file->Close(); });
+    OpenTestFile(*test_file);
+    EXPECT_EQ(file_contents.size(), WriteTestFile(*test_file, file_contents, 0));
+  }
+
+  // The parent's initial store (cancelled by the write), its rescheduled store and the close
+  WaitForHandlers(3);
+  EXPECT_FALSE(test_file->IsBuffered());
+  EXPECT_EQ(file_contents.size(), test_file->meta_data.size());
+  EXPECT_LT(0u, TotalChunksStored());
+
+  // The streamed chunks are read back from storage like any others
+  {
+    const on_scope_exit close_file([test_file] { test_file->Close(); });
+    OpenTestFile(*test_file);
+    EXPECT_EQ(file_contents, ReadTestFile(*test_file));
+  }
+}
+
+TEST_F(FileTests, BEH_RewriteStreamedChunks) {
+  const std::shared_ptr<File> test_file = CreateTestFile();
+  SetListener(*test_file);
+
+  boost::asio::io_service upload_service;
+  std::string file_contents(RandomString((kTestMemoryUsageMax + kTestDiskUsageMax) * 4));
+  {
+    const on_scope_exit close_file([test_file] { test_file->Close(); });
+    OpenTestFile(*test_file, &upload_service);
+    EXPECT_EQ(file_contents.size(), WriteTestFile(*test_file, file_contents, 0));
+    upload_service.reset();
+    upload_service.poll();
+
+    // Rewrite the middle of the file, whose chunks may have been streamed already
+    const std::string rewrite(RandomString(kMaxChunkSize));
+    const std::uint32_t offset(std::uint32_t(file_contents.size() / 2));
+    EXPECT_EQ(rewrite.size(), WriteTestFile(*test_file, rewrite, offset));
+    file_contents.replace(offset, rewrite.size(), rewrite);
+  }
+
+  upload_service.reset();
+  upload_service.poll();
+  // The parent's initial store (cancelled by the write), its rescheduled store and the close
+  WaitForHandlers(3);
+  upload_service.reset();
+  upload_service.poll();
+
+  // The streamed chunks which were rewritten are no longer stored
+  EXPECT_FALSE(test_file->IsBuffered());
+  EXPECT_EQ(test_file->meta_data.data_map()->chunks.size(), TotalChunksStored());
+  {
+    const on_scope_exit close_file([test_file] { test_file->Close(); });
+    OpenTestFile(*test_file);
+    EXPECT_EQ(file_contents, ReadTestFile(*test_file));
+  }
+}
+
 TEST_F(FileTests, BEH_FlushFile) {
   /* Compression appears to differ slightly in windows, so this test was
     designed so that each chunk has a single value (the simple case
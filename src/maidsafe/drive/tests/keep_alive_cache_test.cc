@@ -0,0 +1,80 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include "boost/asio/io_service.hpp"
+
+#include "maidsafe/common/test.h"
+#include "maidsafe/drive/keep_alive_cache.h"
+
+namespace maidsafe {
+namespace drive {
+namespace detail {
+namespace test {
+
+TEST(KeepAliveCacheTest, BEH_LeastRecentlyClosedEvictedFirst) {
+  boost::asio::io_service io_service;
+  const auto cache(std::make_shared<KeepAliveCache>(io_service, 2, std::chrono::hours(1)));
+  std::vector<int> released;
+  int first(0), second(0), third(0);
+  cache->Add(&first, [&] { released.push_back(1); });
+  cache->Add(&second, [&] { released.push_back(2); });
+  // Re-adding makes the first the most recently closed
+  cache->Add(&first, [&] { released.push_back(1); });
+  cache->Add(&third, [&] { released.push_back(3); });
+  EXPECT_EQ(2U, cache->size());
+  EXPECT_EQ(1U, cache->evictions());
+
+  // Evictions are posted rather than run by Add()
+  EXPECT_TRUE(released.empty());
+  io_service.poll();
+  EXPECT_EQ(std::vector<int>({2}), released);
+
+  // A removed entry is never released
+  EXPECT_TRUE(cache->Remove(&first));
+  EXPECT_FALSE(cache->Remove(&first));
+  EXPECT_EQ(1U, cache->size());
+}
+
+TEST(KeepAliveCacheTest, BEH_IdleEntriesExpire) {
+  boost::asio::io_service io_service;
+  const auto cache(
+      std::make_shared<KeepAliveCache>(io_service, 10, std::chrono::milliseconds(100)));
+  std::vector<int> released;
+  int first(0), second(0), third(0);
+  const auto start(std::chrono::steady_clock::now());
+  cache->Add(&first, [&] { released.push_back(1); });
+  cache->Add(&second, [&] { released.push_back(2); });
+  cache->Add(&third, [&] { released.push_back(3); });
+  EXPECT_TRUE(cache->Remove(&second));
+
+  while (released.size() != 2 && std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+    io_service.run_one();
+  EXPECT_LE(std::chrono::milliseconds(100), std::chrono::steady_clock::now() - start);
+  EXPECT_EQ(std::vector<int>({1, 3}), released);
+  EXPECT_EQ(0U, cache->size());
+  EXPECT_EQ(0U, cache->evictions());
+}
+
+}  // namespace test
+}  // namespace detail
+}  // namespace drive
+}  // namespace maidsafe
@@ -0,0 +1,63 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#include <chrono>
+#include <thread>
+
+#include "maidsafe/common/test.h"
+#include "maidsafe/drive/latency_histogram.h"
+
+namespace maidsafe {
+namespace drive {
+namespace detail {
+namespace test {
+
+TEST(LatencyHistogramTest, BEH_Percentiles) {
+  LatencyHistogram histogram;
+  EXPECT_EQ(0U, histogram.count());
+  EXPECT_EQ(std::chrono::microseconds(0), histogram.Percentile(0.5));
+
+  // 90 fast samples and 10 slow ones
+  for (int i(0); i != 90; ++i)
+    histogram.Record(std::chrono::microseconds(3));
+  for (int i(0); i != 10; ++i)
+    histogram.Record(std::chrono::milliseconds(5));
+  EXPECT_EQ(100U, histogram.count());
+
+  // Each is reported as the upper bound of its power-of-two bucket
+  EXPECT_EQ(std::chrono::microseconds(4), histogram.Percentile(0.5));
+  EXPECT_EQ(std::chrono::microseconds(4), histogram.Percentile(0.9));
+  EXPECT_EQ(std::chrono::microseconds(8192), histogram.Percentile(0.91));
+  EXPECT_EQ(std::chrono::microseconds(8192), histogram.Percentile(1.0));
+  EXPECT_EQ(std::chrono::microseconds(5000), histogram.max());
+}
+
+TEST(LatencyHistogramTest, BEH_ScopedLatency) {
+  LatencyHistogram histogram;
+  {
+    const ScopedLatency latency(histogram);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(1U, histogram.count());
+  EXPECT_LE(std::chrono::microseconds(10000), histogram.max());
+}
+
+}  // namespace test
+}  // namespace detail
+}  // namespace drive
+}  // namespace maidsafe
@@ -0,0 +1,228 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "maidsafe/common/test.h"
+#include "maidsafe/drive/config.h"
+#include "maidsafe/drive/readahead.h"
+
+namespace maidsafe {
+namespace drive {
+namespace detail {
+namespace test {
+
+namespace {
+
+std::string ChunkName(std::size_t index) { return "chunk" + std::to_string(index); }
+
+class ReadaheadTests : public ::testing::Test {
+ protected:
+  ReadaheadTests()
+      : ::testing::Test(),
+        data_map_(),
+        promises_(),
+        direct_gets_(0),
+        readahead_([this](const std::string& name) {
+                     ++direct_gets_;
+                     return NonEmptyString(name);
+                   },
+                   [this](const std::string& name) {
+                     return promises_[name].get_future().share();
+                   }) {
+    for (std::size_t i(0); i != 160; ++i) {
+      encrypt::ChunkDetails chunk;
+      const std::string name(ChunkName(i));
+      chunk.hash.assign(std::begin(name), std::end(name));
+      chunk.size = kOptimalIoSize;
+      data_map_.chunks.push_back(chunk);
+    }
+  }
+
+  // Reads 'length' bytes at 'offset' the way a self-encryptor would, fetching each chunk touched.
+  void Read(std::uint64_t offset, std::uint32_t length) {
+    const auto demanded(readahead_.Notify(data_map_, offset, length));
+    for (auto index(offset / kOptimalIoSize); index <= (offset + length - 1) / kOptimalIoSize;
+         ++index) {
+      EXPECT_EQ(NonEmptyString(ChunkName(index)), readahead_.GetChunk(ChunkName(index)));
+    }
+    readahead_.Release(demanded);
+  }
+
+  bool Requested(std::size_t index) const { return promises_.count(ChunkName(index)) != 0; }
+
+  void Fulfil(std::size_t index) {
+    promises_[ChunkName(index)].set_value(ImmutableData(NonEmptyString(ChunkName(index))));
+  }
+
+  encrypt::DataMap data_map_;
+  std::map<std::string, boost::promise<ImmutableData>> promises_;
+  unsigned direct_gets_;
+  Readahead readahead_;
+};
+
+}  // anonymous namespace
+
+TEST_F(ReadaheadTests, BEH_SequentialStreamPrefetches) {
+  const std::uint32_t kReadSize(128 * 1024);
+  Read(0, kReadSize);
+  EXPECT_TRUE(promises_.empty());
+  EXPECT_EQ(1U, direct_gets_);
+
+  // The second sequential read starts a stream, fetching the window after the current chunk
+  Read(kReadSize, kReadSize);
+  EXPECT_EQ(2U, readahead_.window());
+  EXPECT_TRUE(Requested(1));
+  EXPECT_TRUE(Requested(2));
+  EXPECT_FALSE(Requested(3));
+
+  // A prefetched chunk which has arrived is used without a direct get
+  Fulfil(1);
+  Read(kOptimalIoSize, kReadSize);
+  EXPECT_EQ(1U, readahead_.hits());
+  EXPECT_EQ(0U, readahead_.stalls());
+  EXPECT_EQ(2U, readahead_.window());
+  EXPECT_TRUE(Requested(3));
+
+  // Waiting for a prefetched chunk doubles the window
+  std::thread fulfil([this] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    Fulfil(2);
+  });
+  Read(2 * kOptimalIoSize, kReadSize);
+  fulfil.join();
+  EXPECT_EQ(2U, readahead_.hits());
+  EXPECT_EQ(1U, readahead_.stalls());
+  EXPECT_EQ(4U, readahead_.window());
+  Read(2 * kOptimalIoSize + kReadSize, kReadSize);
+  EXPECT_TRUE(Requested(6));
+  EXPECT_FALSE(Requested(7));
+  // A chunk fetched ahead is dropped once used, as the encryptor or chunk cache then holds it, so
+  // the direct fetches were chunk 0 (twice, before the stream began) and chunk 2's second use
+  EXPECT_EQ(3U, direct_gets_);
+}
+
+TEST_F(ReadaheadTests, BEH_RandomReadResets) {
+  const std::uint32_t kReadSize(kOptimalIoSize);
+  Read(0, kReadSize);
+  readahead_.Notify(data_map_, kReadSize, kReadSize);
+  EXPECT_TRUE(Requested(2));
+  Read(10 * kOptimalIoSize, kReadSize);
+  Read(30 * kOptimalIoSize, kReadSize);
+  EXPECT_EQ(2U, readahead_.window());
+  EXPECT_FALSE(Requested(31));
+  // A prefetched chunk which was dropped is fetched directly
+  const auto direct_gets(direct_gets_);
+  EXPECT_EQ(NonEmptyString(ChunkName(2)), readahead_.GetChunk(ChunkName(2)));
+  EXPECT_EQ(direct_gets + 1, direct_gets_);
+}
+
+TEST_F(ReadaheadTests, BEH_ResetForReplacedDataMap) {
+  readahead_.Release(readahead_.Notify(data_map_, 4 * kOptimalIoSize, 2 * kOptimalIoSize));
+  EXPECT_TRUE(Requested(4));
+
+  // A checkpoint replaces the data map, and the file's chunk boundaries with it
+  encrypt::DataMap replaced;
+  for (std::size_t i(0); i != 8; ++i) {
+    encrypt::ChunkDetails chunk;
+    const std::string name("replaced" + std::to_string(i));
+    chunk.hash.assign(std::begin(name), std::end(name));
+    chunk.size = 2 * kOptimalIoSize;
+    replaced.chunks.push_back(chunk);
+  }
+  readahead_.Reset();
+  const auto demanded(readahead_.Notify(replaced, 5 * kOptimalIoSize, 2 * kOptimalIoSize));
+  EXPECT_EQ((std::vector<std::size_t>{2, 3}), demanded);
+  EXPECT_EQ(1U, promises_.count("replaced2"));
+  EXPECT_EQ(1U, promises_.count("replaced3"));
+  readahead_.Release(demanded);
+}
+
+TEST_F(ReadaheadTests, BEH_OvertakenWindowGrowsToCap) {
+  // Each read spans more chunks than the window can, so the reader keeps overtaking it
+  const std::uint32_t kReadSize(20 * kOptimalIoSize);
+  std::uint64_t offset(0);
+  for (std::size_t i(0); i != 6; ++i, offset += kReadSize)
+    readahead_.Notify(data_map_, offset, kReadSize);
+  EXPECT_EQ(kMaxReadaheadChunks, readahead_.window());
+}
+
+TEST_F(ReadaheadTests, BEH_SpannedChunksFetchedInParallel) {
+  Readahead readahead([this](const std::string& name) {
+                        ++direct_gets_;
+                        return NonEmptyString(name);
+                      },
+                      [this](const std::string& name) {
+                        return promises_[name].get_future().share();
+                      },
+                      nullptr, 3);
+  // A read spanning five chunks requests them at once, up to the in-flight limit
+  const auto demanded(readahead.Notify(data_map_, kOptimalIoSize / 2, 4 * kOptimalIoSize));
+  EXPECT_EQ(5U, demanded.size());
+  EXPECT_TRUE(Requested(0));
+  EXPECT_TRUE(Requested(1));
+  EXPECT_TRUE(Requested(2));
+  EXPECT_FALSE(Requested(3));
+
+  // Each chunk collected lets another queued request be issued
+  Fulfil(0);
+  EXPECT_EQ(NonEmptyString(ChunkName(0)), readahead.GetChunk(ChunkName(0)));
+  EXPECT_TRUE(Requested(3));
+  EXPECT_FALSE(Requested(4));
+
+  // A chunk still queued when it's needed is fetched directly, and not requested again
+  EXPECT_EQ(NonEmptyString(ChunkName(4)), readahead.GetChunk(ChunkName(4)));
+  EXPECT_EQ(1U, direct_gets_);
+  Fulfil(1);
+  EXPECT_EQ(NonEmptyString(ChunkName(1)), readahead.GetChunk(ChunkName(1)));
+  EXPECT_FALSE(Requested(4));
+  EXPECT_EQ(2U, readahead.hits());
+  EXPECT_EQ(0U, readahead.stalls());
+  readahead.Release(demanded);
+}
+
+TEST_F(ReadaheadTests, BEH_ConcurrentReadersKeepTheirChunks) {
+  const std::uint32_t kReadSize(2 * kOptimalIoSize);
+  const auto first_demanded(readahead_.Notify(data_map_, 0, kReadSize));
+  const auto second_demanded(readahead_.Notify(data_map_, 0, kReadSize));
+  // A read elsewhere in the file doesn't drop the chunks the other reads span
+  const auto third_demanded(readahead_.Notify(data_map_, 50 * kOptimalIoSize, kReadSize));
+  EXPECT_TRUE(Requested(50));
+  Fulfil(0);
+  EXPECT_EQ(NonEmptyString(ChunkName(0)), readahead_.GetChunk(ChunkName(0)));
+  EXPECT_EQ(1U, readahead_.hits());
+
+  // The chunks are kept until every read spanning them has finished
+  readahead_.Release(first_demanded);
+  EXPECT_EQ(NonEmptyString(ChunkName(0)), readahead_.GetChunk(ChunkName(0)));
+  EXPECT_EQ(2U, readahead_.hits());
+  readahead_.Release(second_demanded);
+  readahead_.Release(third_demanded);
+  EXPECT_EQ(NonEmptyString(ChunkName(0)), readahead_.GetChunk(ChunkName(0)));
+  EXPECT_EQ(2U, readahead_.hits());
+  EXPECT_EQ(1U, readahead_.misses());
+}
+
+}  // namespace test
+}  // namespace detail
+}  // namespace drive
+}  // namespace maidsafe
@@ -0,0 +1,93 @@
+/*  Copyright 2014 MaidSafe.net limited
+
+    This MaidSafe Software is licensed to you under (1) the MaidSafe.net Commercial License,
+    version 1.0 or later, or (2) The General Public License (GPL), version 3, depending on which
+    licence you accepted on initial access to the Software (the "Licences").
+
+    By contributing code to the MaidSafe Software, or to this project generally, you agree to be
+    bound by the terms of the MaidSafe Contributor Agreement, version 1.0, found in the root
+    directory of this project at LICENSE, COPYING and CONTRIBUTOR respectively and also
+    available at: http://www.maidsafe.net/licenses
+
+    Unless required by applicable law or agreed to in writing, the MaidSafe Software distributed
+    under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS
+    OF ANY KIND, either express or implied.
+
+    See the Licences for the specific language governing permissions and limitations relating to
+    use of the MaidSafe Software.                                                                 */
+
+#include <string>
+
+#include "boost/filesystem/operations.hpp"
+
+#include "maidsafe/common/test.h"
+#include "maidsafe/drive/spill_store.h"
+
+namespace maidsafe {
+namespace drive {
+namespace detail {
+namespace test {
+
+class SpillStoreTest : public ::testing::Test {
+ protected:
+  SpillStoreTest() : test_path_(::maidsafe::test::CreateTestPath("MaidSafe_Test_Drive")) {}
+
+  ::maidsafe::test::TestPath test_path_;
+};
+
+TEST_F(SpillStoreTest, BEH_PutGetAndDelete) {
+  const boost::filesystem::path path(*test_path_ / "spill");
+  {
+    SpillStore store(path, 1000, 100, 300);
+    NonEmptyString content;
+    EXPECT_FALSE(store.Get("a", content));
+
+    const NonEmptyString a(std::string(250, 'a')), b(std::string(100, 'b'));
+    EXPECT_TRUE(store.Put("a", a));
+    EXPECT_TRUE(store.Put("b", b));
+    EXPECT_EQ(400U, store.size());
+    EXPECT_EQ(600U, store.file_size());
+    ASSERT_TRUE(store.Get("a", content));
+    EXPECT_EQ(a, content);
+    ASSERT_TRUE(store.Get("b", content));
+    EXPECT_EQ(b, content);
+
+    // A second reference keeps the chunk until both are deleted
+    EXPECT_TRUE(store.Put("a", a));
+    EXPECT_EQ(400U, store.size());
+    store.Delete("a");
+    EXPECT_TRUE(store.Get("a", content));
+    store.Delete("a");
+    EXPECT_FALSE(store.Get("a", content));
+    EXPECT_EQ(100U, store.size());
+    EXPECT_TRUE(boost::filesystem::exists(path));
+  }
+  EXPECT_FALSE(boost::filesystem::exists(path));
+}
+
+TEST_F(SpillStoreTest, BEH_ReusesFreedSlots) {
+  SpillStore store(*test_path_ / "spill", 1000, 100, 1000);
+  for (char c('a'); c != 'k'; ++c)
+    EXPECT_TRUE(store.Put(std::string(1, c), NonEmptyString(std::string(100, c))));
+  EXPECT_EQ(1000U, store.size());
+  EXPECT_FALSE(store.Put("k", NonEmptyString(std::string(1, 'k'))));
+
+  // Freeing neighbouring slots makes room for a chunk spanning them
+  store.Delete("d");
+  store.Delete("e");
+  EXPECT_FALSE(store.Put("l", NonEmptyString(std::string(300, 'l'))));
+  EXPECT_TRUE(store.Put("m", NonEmptyString(std::string(200, 'm'))));
+  EXPECT_EQ(1000U, store.size());
+  EXPECT_EQ(1000U, store.file_size());
+
+  NonEmptyString content;
+  ASSERT_TRUE(store.Get("m", content));
+  EXPECT_EQ(NonEmptyString(std::string(200, 'm')), content);
+  ASSERT_TRUE(store.Get("f", content));
+  EXPECT_EQ(NonEmptyString(std::string(100, 'f')), content);
+}
+
+}  // namespace test
+}  // namespace detail
+}  // namespace drive
+}  // namespace maidsafe
@@ -20,7 +20,9 @@
 #include <boost/filesystem/operations.hpp>
 
 #include "maidsafe/common/test.h"
+#include "maidsafe/drive/symlink.h"
 #include "maidsafe/drive/unix_drive.h"
+#include "maidsafe/drive/unix_low_level_drive.h"
 
 #include "maidsafe/drive/tests/meta_data_test.h"
 #include "maidsafe/drive/tests/test_utils.h"
@@ -39,6 +41,19 @@ const std::initializer_list<mode_t> possible_permissions = {S_IRUSR, S_IWUSR, S_
                                                             S_IWGRP, S_IXGRP, S_IROTH, S_IWOTH,
                                                             S_IXOTH, S_ISUID, S_ISGID, S_ISVTX};
 
+std::shared_ptr<detail::Path> MakePath(const std::string& name) {
+  return detail::Symlink::Create(boost::filesystem::path(name), boost::filesystem::path("target"));
+}
+
+bool IsUnlinked(const detail::NodeTable& nodes, fuse_ino_t node_id) {
+  try {
+    nodes.GetRelativePath(node_id);
+  } catch (const drive_error& error) {
+    return error.code() == make_error_code(DriveErrors::no_such_file);
+  }
+  return false;
+}
+
 bool VerifyNonPermissionBits(const mode_t mode) {
   const mode_t NonPermissionBits = ~(detail::ModePermissionMask());
   return (mode & NonPermissionBits) == 0;
@@ -133,6 +148,161 @@ TEST(UnixDriveTest, BEH_IsSupported) {
   }
 }
 
+TEST(UnixDriveTest, BEH_AttributeCache) {
+  detail::AttributeCache cache(std::chrono::hours(1));
+  struct stat attributes;
+  std::memset(&attributes, 0, sizeof(attributes));
+  attributes.st_size = 7;
+  auto epoch(cache.CurrentEpoch());
+  cache.Insert("/a", attributes, epoch);
+  cache.Insert("/a/b", attributes, epoch);
+  cache.Insert("/a/b/c", attributes, epoch);
+  cache.Insert("/ab", attributes, epoch);
+
+  struct stat found;
+  EXPECT_TRUE(cache.Find("/a/b", found));
+  EXPECT_EQ(7, found.st_size);
+  EXPECT_FALSE(cache.Find("/missing", found));
+  EXPECT_EQ(1U, cache.hits());
+  EXPECT_EQ(1U, cache.misses());
+
+  // Erasing a path drops its descendants but not its siblings
+  cache.Erase("/a/b");
+  EXPECT_TRUE(cache.Find("/a", found));
+  EXPECT_FALSE(cache.Find("/a/b", found));
+  EXPECT_FALSE(cache.Find("/a/b/c", found));
+  EXPECT_TRUE(cache.Find("/ab", found));
+  cache.Erase("/a");
+  EXPECT_FALSE(cache.Find("/a", found));
+  EXPECT_TRUE(cache.Find("/ab", found));
+
+  // A listing read before an erasure can't re-insert what it invalidated
+  cache.Insert("/a/b/c", attributes, epoch);
+  cache.Insert("/ab", attributes, epoch);
+  cache.Insert("/c", attributes, epoch);
+  EXPECT_FALSE(cache.Find("/a/b/c", found));
+  EXPECT_TRUE(cache.Find("/ab", found));
+  EXPECT_TRUE(cache.Find("/c", found));
+  epoch = cache.CurrentEpoch();
+  cache.Insert("/a/b/c", attributes, epoch);
+  EXPECT_TRUE(cache.Find("/a/b/c", found));
+
+  // Erasing just an entry leaves its descendants, and doesn't block inserting them
+  epoch = cache.CurrentEpoch();
+  cache.EraseEntry("/a/b");
+  cache.Insert("/a/b/d", attributes, epoch);
+  EXPECT_TRUE(cache.Find("/a/b/c", found));
+  EXPECT_TRUE(cache.Find("/a/b/d", found));
+
+  // Erasing the root drops everything
+  cache.Erase("/");
+  EXPECT_FALSE(cache.Find("/a/b/c", found));
+  EXPECT_FALSE(cache.Find("/c", found));
+
+  // A zero timeout disables caching
+  detail::AttributeCache disabled(std::chrono::seconds(0));
+  disabled.Insert("/a", attributes, disabled.CurrentEpoch());
+  EXPECT_FALSE(disabled.Find("/a", found));
+}
+
+TEST(UnixDriveTest, BEH_NodeTableLookups) {
+  detail::NodeTable nodes(MakePath("root"));
+  const auto a(MakePath("a")), b(MakePath("b"));
+  const auto a_id(nodes.AddLookup(FUSE_ROOT_ID, "a", a));
+  const auto b_id(nodes.AddLookup(a_id, "b", b));
+  EXPECT_NE(a_id, b_id);
+  EXPECT_EQ(a_id, nodes.AddLookup(FUSE_ROOT_ID, "a", a));
+  EXPECT_EQ(3U, nodes.size());
+  EXPECT_EQ(boost::filesystem::path("/a/b"), nodes.GetRelativePath(b_id));
+  EXPECT_EQ(b_id, nodes.FindNodeId(boost::filesystem::path("/a/b")));
+  EXPECT_EQ(b_id, nodes.FindNodeId(b.get()));
+  EXPECT_EQ(fuse_ino_t(FUSE_ROOT_ID), nodes.FindNodeId(boost::filesystem::path("/")));
+  EXPECT_EQ(0U, nodes.FindNodeId(boost::filesystem::path("/a/missing")));
+  EXPECT_EQ(a, nodes.GetPath(a_id));
+
+  // A node stays until the kernel has forgotten every lookup of it.
+  nodes.Forget(a_id, 1);
+  EXPECT_EQ(a, nodes.GetPath(a_id));
+  nodes.Forget(a_id, 1);
+  EXPECT_THROW(nodes.GetPath(a_id), drive_error);
+  EXPECT_EQ(0U, nodes.FindNodeId(a.get()));
+  EXPECT_TRUE(IsUnlinked(nodes, b_id));
+  nodes.Forget(b_id, 5);
+  nodes.Forget(FUSE_ROOT_ID, 1);
+  EXPECT_EQ(1U, nodes.size());
+}
+
+TEST(UnixDriveTest, BEH_NodeTableRename) {
+  detail::NodeTable nodes(MakePath("root"));
+  const auto dir_id(nodes.AddLookup(FUSE_ROOT_ID, "dir", MakePath("dir")));
+  const auto file_id(nodes.AddLookup(dir_id, "file", MakePath("file")));
+  const auto other_id(nodes.AddLookup(FUSE_ROOT_ID, "other", MakePath("other")));
+
+  // Nodes below a renamed directory follow it.
+  nodes.MoveNode(FUSE_ROOT_ID, "dir", FUSE_ROOT_ID, "renamed");
+  EXPECT_EQ(boost::filesystem::path("/renamed/file"), nodes.GetRelativePath(file_id));
+  EXPECT_EQ(0U, nodes.FindNodeId(boost::filesystem::path("/dir/file")));
+  EXPECT_EQ(file_id, nodes.FindNodeId(boost::filesystem::path("/renamed/file")));
+
+  // A rename over an existing entry unlinks its node, which stays until forgotten.
+  nodes.MoveNode(FUSE_ROOT_ID, "renamed", FUSE_ROOT_ID, "other");
+  EXPECT_TRUE(IsUnlinked(nodes, other_id));
+  EXPECT_NO_THROW(nodes.GetPath(other_id));
+  EXPECT_EQ(dir_id, nodes.FindNodeId(boost::filesystem::path("/other")));
+  EXPECT_EQ(boost::filesystem::path("/other/file"), nodes.GetRelativePath(file_id));
+
+  nodes.UnlinkNode(FUSE_ROOT_ID, "other");
+  EXPECT_TRUE(IsUnlinked(nodes, dir_id));
+  EXPECT_TRUE(IsUnlinked(nodes, file_id));
+  EXPECT_NO_THROW(nodes.GetPath(file_id));
+  EXPECT_EQ(4U, nodes.size());
+}
+
+TEST(UnixDriveTest, BEH_NodeTableRemoteChange) {
+  detail::NodeTable nodes(MakePath("root"));
+  const auto original(MakePath("a")), reloaded(MakePath("a"));
+  const auto node_id(nodes.AddLookup(FUSE_ROOT_ID, "a", original));
+
+  // Reloading the entry keeps its node id.
+  EXPECT_EQ(node_id, nodes.ReplaceNode("/a", reloaded));
+  EXPECT_EQ(reloaded, nodes.GetPath(node_id));
+  EXPECT_EQ(node_id, nodes.FindNodeId(reloaded.get()));
+  EXPECT_EQ(0U, nodes.FindNodeId(original.get()));
+  EXPECT_EQ(0U, nodes.ReplaceNode("/missing", reloaded));
+
+  // A lookup which sees a newer object first gives it a node of its own, so the two never share
+  // a path, and the later replacement finds the new node already in place.
+  const auto newer(MakePath("a"));
+  const auto newer_id(nodes.AddLookup(FUSE_ROOT_ID, "a", newer));
+  EXPECT_NE(node_id, newer_id);
+  EXPECT_TRUE(IsUnlinked(nodes, node_id));
+  EXPECT_EQ(newer_id, nodes.ReplaceNode("/a", newer));
+  EXPECT_EQ(newer_id, nodes.FindNodeId(boost::filesystem::path("/a")));
+
+  // Removal by the other client unlinks the node, which is only dropped once forgotten.
+  EXPECT_EQ(newer_id, nodes.ReplaceNode("/a", nullptr));
+  EXPECT_TRUE(IsUnlinked(nodes, newer_id));
+  EXPECT_EQ(0U, nodes.FindNodeId(boost::filesystem::path("/a")));
+  nodes.Forget(newer_id, 1);
+  nodes.Forget(node_id, 1);
+  EXPECT_EQ(1U, nodes.size());
+}
+
+TEST(UnixDriveTest, BEH_DirectIoPolicy) {
+  EXPECT_FALSE(DirectIoPolicy().Selects("/a/movie.mkv", 1ULL << 40, O_RDONLY));
+
+  DirectIoPolicy policy(1024, "*.mkv,,backup-*");
+  EXPECT_FALSE(policy.Selects("/a/notes.txt", 1023, O_RDONLY));
+  EXPECT_TRUE(policy.Selects("/a/notes.txt", 1024, O_RDONLY));
+  EXPECT_TRUE(policy.Selects("/a/movie.mkv", 0, O_RDWR));
+  EXPECT_TRUE(policy.Selects("/backup-2014.tar", 0, O_RDONLY));
+  // Patterns are matched against the filename only
+  EXPECT_FALSE(policy.Selects("/backup-dir/notes.txt", 0, O_RDONLY));
+#ifdef O_DIRECT
+  EXPECT_TRUE(DirectIoPolicy().Selects("/a/notes.txt", 0, O_RDONLY | O_DIRECT));
+#endif
+}
+
 }  // namespace test
 }  // namespace drive
 }  // namespace maidsafe
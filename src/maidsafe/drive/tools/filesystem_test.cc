@@ -23,14 +23,17 @@
 #endif
 
 #include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <cstdint>
 #include <fstream>
 #include <functional>
+#include <iostream>
 #include <iterator>
 #include <memory>
 #include <set>
 #include <string>
+#include <thread>
 #include <vector>
 
 #ifdef MAIDSAFE_BSD
@@ -1378,6 +1381,32 @@ TEST(FileSystemTest, BEH_CheckAttributesForConcurrentOpenInstances) {
 #endif
 }
 
+TEST(FileSystemTest, BEH_ConcurrentDirectoryListings) {
+  // Several listings of the same directory in parallel must each see every entry exactly once
+  const on_scope_exit cleanup(clean_root);
+  const size_t file_count(300), listing_count(8);
+  std::set<fs::path> expected;
+  for (size_t i(0); i != file_count; ++i)
+    expected.insert(CreateFile(g_root, 1).first.filename());
+
+  std::vector<std::multiset<fs::path>> listings(listing_count);
+  std::vector<std::thread> threads;
+  for (size_t i(0); i != listing_count; ++i) {
+    threads.emplace_back([&listings, i] {
+      fs::directory_iterator end;
+      for (fs::directory_iterator directory_itr(g_root); directory_itr != end; ++directory_itr)
+        listings[i].insert(directory_itr->path().filename());
+    });
+  }
+  for (auto& thread : threads)
+    thread.join();
+
+  for (const auto& listing : listings) {
+    ASSERT_EQ(file_count, listing.size());
+    EXPECT_TRUE(std::equal(std::begin(expected), std::end(expected), std::begin(listing)));
+  }
+}
+
 TEST(FileSystemTest, BEH_Locale) {
   const on_scope_exit cleanup(clean_root);
 
@@ -1418,6 +1447,33 @@ TEST(FileSystemTest, DISABLED_FUNC_CreateAndBuildMinimalCXXProject) {
   ASSERT_NO_THROW(CreateAndBuildMinimalCppProject(g_temp));
 }
 
+// Prints unbuffered sequential write rates for a few sizes.  Run with '--disk' for a baseline.
+TEST(FileSystemTest, FUNC_SequentialWriteThroughput) {
+  const on_scope_exit cleanup(clean_root);
+  const size_t file_size(64 << 20);  // 64MB
+  for (const size_t write_size : {size_t(4) << 10, size_t(128) << 10, size_t(1) << 20}) {
+    const fs::path file(g_root / RandomAlphaNumericString(8));
+    const std::string data(RandomString(write_size));
+    const auto start(std::chrono::steady_clock::now());
+    {
+      std::ofstream out_file;
+      out_file.rdbuf()->pubsetbuf(nullptr, 0);
+      out_file.open(file.string().c_str(), std::ofstream::binary);
+      ASSERT_TRUE(out_file.good());
+      for (size_t written(0); written < file_size; written += write_size) {
+        out_file.write(data.data(), data.size());
+        ASSERT_TRUE(out_file.good()) << "Written: " << written;
+      }
+    }
+    const auto elapsed(std::chrono::duration_cast<std::chrono::milliseconds>(
+                           std::chrono::steady_clock::now() - start).count());
+    EXPECT_EQ(file_size, fs::file_size(file));
+    std::cout << "Wrote " << BytesToBinarySiUnits(file_size) << " in "
+              << BytesToBinarySiUnits(write_size) << " pieces at "
+              << BytesToBinarySiUnits(file_size * 1000 / std::max<int64_t>(elapsed, 1)) << "/s\n";
+  }
+}
+
 TEST(FileSystemTest, BEH_Write256MbFileToTempAndCopyToDrive) {
   const on_scope_exit cleanup(clean_root);
 
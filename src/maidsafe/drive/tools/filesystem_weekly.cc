@@ -16,16 +16,26 @@
     See the Licences for the specific language governing permissions and limitations relating to
     use of the MaidSafe Software.                                                                 */
 
+#include <atomic>
 #include <chrono>
 #include <cstdint>
 #include <cstdio>
+#include <fstream>
 #include <functional>
 #include <string>
+#include <thread>
+#include <vector>
 
 #ifdef MAIDSAFE_BSD
 extern "C" char** environ;
 #endif
 
+#ifndef MAIDSAFE_WIN32
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#endif
+
 #include "boost/filesystem/path.hpp"
 #include "boost/filesystem/operations.hpp"
 #include "boost/program_options.hpp"
@@ -181,9 +191,32 @@ void PrintResult(const std::chrono::high_resolution_clock::time_point& start,
          BytesToBinarySiUnits(rate).c_str());
 }
 
-}  // namespace
+void PrintOperationsResult(const std::chrono::high_resolution_clock::time_point& start,
+                           const std::chrono::high_resolution_clock::time_point& stop,
+                           size_t operation_count, std::string action_type) {
+  auto duration(std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count());
+  if (duration == 0)
+    duration = 1;
+  uint64_t rate((static_cast<uint64_t>(operation_count) * 1000000) / duration);
+  printf("%s %s times in %f seconds at a rate of %s ops/s\n", action_type.c_str(),
+         std::to_string(operation_count).c_str(), (duration / 1000000.0),
+         std::to_string(rate).c_str());
+}
+
+#ifdef O_DIRECT
+// Returns the value in kB of the field 'key' (e.g. "VmRSS:") in a /proc file, or 0 if unavailable.
+uint64_t ReadProcKilobytes(const fs::path& proc_file, const std::string& key) {
+  std::ifstream input_stream(proc_file.c_str());
+  std::string line;
+  while (std::getline(input_stream, line)) {
+    if (line.compare(0, key.size(), key) == 0)
+      return std::stoull(line.substr(key.size()));
+  }
+  return 0;
+}
+#endif
 
-void CopyThenReadLargeFile() {
+}  // namespace
   on_scope_exit cleanup(clean_root);
 
   // Create file on disk
@@ -220,6 +253,88 @@ void CopyThenReadLargeFile() {
   PrintResult(compare_start_time, compare_stop_time, size, "Compared");
 }
 
+#ifdef O_DIRECT
+// Reads a large file once through the kernel page cache and once with O_DIRECT, which the drive
+// always serves through its direct_io streaming path.  Alongside each pass's throughput, the growth
+// of the page cache and the drive process's peak resident set show what each mode costs in memory.
+// Mount with '--direct_io_min_size' to have ordinary opens of large files streamed too.
+void ReadLargeFileCachedAndDirect(std::shared_ptr<drive::Launcher> launcher) {
+  on_scope_exit cleanup(clean_root);
+
+  const size_t size(300 * 1024 * 1024), buffer_size(1024 * 1024);
+  fs::path file(GenerateFile(g_temp, size));
+  fs::copy_file(file, g_root / file.filename(), fs::copy_option::fail_if_exists);
+  const fs::path drive_status(
+      launcher ? fs::path("/proc") / std::to_string(launcher->DriveProcessId()) / "status"
+               : fs::path());
+
+  void* buffer(nullptr);
+  if (posix_memalign(&buffer, 4096, buffer_size) != 0)
+    BOOST_THROW_EXCEPTION(MakeError(CommonErrors::unknown));
+  on_scope_exit free_buffer([buffer] { free(buffer); });
+
+  for (int flags : {O_RDONLY, O_RDONLY | O_DIRECT}) {
+    int file_descriptor(open((g_root / file.filename()).c_str(), flags));
+    if (file_descriptor == -1)
+      BOOST_THROW_EXCEPTION(MakeError(CommonErrors::filesystem_io_error));
+    on_scope_exit close_file([file_descriptor] { close(file_descriptor); });
+    posix_fadvise(file_descriptor, 0, 0, POSIX_FADV_DONTNEED);
+    if (!drive_status.empty()) {  // Resets the drive's VmHWM
+      std::ofstream clear_refs((drive_status.parent_path() / "clear_refs").c_str());
+      clear_refs << "5";
+    }
+
+    const uint64_t cached_before(ReadProcKilobytes("/proc/meminfo", "Cached:"));
+    size_t total(0);
+    ssize_t result(0);
+    auto read_start_time(std::chrono::high_resolution_clock::now());
+    while ((result = read(file_descriptor, buffer, buffer_size)) > 0)
+      total += static_cast<size_t>(result);
+    auto read_stop_time(std::chrono::high_resolution_clock::now());
+    if (result == -1 || total != size)
+      BOOST_THROW_EXCEPTION(MakeError(CommonErrors::filesystem_io_error));
+    const uint64_t cached_after(ReadProcKilobytes("/proc/meminfo", "Cached:"));
+
+    PrintResult(read_start_time, read_stop_time, size,
+                flags == O_RDONLY ? "Read (cached)" : "Read (direct_io)");
+    const uint64_t cache_growth(cached_after > cached_before ? cached_after - cached_before : 0);
+    printf("  page cache grew by %s", BytesToBinarySiUnits(cache_growth * 1024).c_str());
+    if (!drive_status.empty()) {
+      printf(", drive peak RSS %s",
+             BytesToBinarySiUnits(ReadProcKilobytes(drive_status, "VmHWM:") * 1024).c_str());
+    }
+    printf("\n");
+  }
+}
+#endif
+
+#ifndef MAIDSAFE_WIN32
+// Writes 1 GiB to one file, calling fsync after every 64 MiB.  Each fsync stores the parent
+// directory, which checkpoints the open file's data map, so this shows what those checkpoints cost
+// a continuous writer.
+void WriteLargeFileWithSyncs() {
+  on_scope_exit cleanup(clean_root);
+
+  const size_t size(1024 * 1024 * 1024), block_size(1024 * 1024), sync_interval(64 * 1024 * 1024);
+  const std::string block(RandomString(block_size));
+  const fs::path file(g_root / (RandomAlphaNumericString(5) + ".dat"));
+  const int file_descriptor(open(file.c_str(), O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR));
+  if (file_descriptor == -1)
+    BOOST_THROW_EXCEPTION(MakeError(CommonErrors::filesystem_io_error));
+  on_scope_exit close_file([file_descriptor] { close(file_descriptor); });
+
+  auto write_start_time(std::chrono::high_resolution_clock::now());
+  for (size_t written(0); written != size; written += block_size) {
+    if (write(file_descriptor, block.data(), block_size) != static_cast<ssize_t>(block_size))
+      BOOST_THROW_EXCEPTION(MakeError(CommonErrors::filesystem_io_error));
+    if ((written + block_size) % sync_interval == 0 && fsync(file_descriptor) != 0)
+      BOOST_THROW_EXCEPTION(MakeError(CommonErrors::filesystem_io_error));
+  }
+  auto write_stop_time(std::chrono::high_resolution_clock::now());
+  PrintResult(write_start_time, write_stop_time, size, "Wrote (with fsync every 64 MiB)");
+}
+#endif
+
 void CopyThenReadManySmallFiles() {
   on_scope_exit cleanup(clean_root);
 
@@ -275,6 +390,137 @@ void CopyThenReadManySmallFiles() {
   }
 }
 
+// Every open and release reaches the drive, even when the kernel has the content cached, so this
+// shows how the request rate scales as more client threads are added.  Run against a drive mounted
+// with '--worker_count' greater than 1 to see the effect of multithreaded dispatch.
+void OpenReadAndCloseFilesConcurrently() {
+  on_scope_exit cleanup(clean_root);
+
+  const size_t file_count(64), file_size(4096), operations_per_thread(2000);
+  std::vector<fs::path> files;
+  files.reserve(file_count);
+  while (files.size() < file_count)
+    files.push_back(GenerateFile(g_root, file_size));
+
+  const unsigned max_thread_count(std::max(2U, static_cast<unsigned>(Concurrency()) * 2));
+  for (unsigned thread_count(1); thread_count <= max_thread_count; thread_count *= 2) {
+    std::atomic<bool> failed(false);
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count);
+    auto start_time(std::chrono::high_resolution_clock::now());
+    for (unsigned i(0); i != thread_count; ++i) {
+      threads.emplace_back([&, i] {
+        std::vector<char> buffer(file_size);
+        for (size_t operation(0); operation != operations_per_thread; ++operation) {
+          std::ifstream input_stream(files[(i + operation) % files.size()].c_str(),
+                                     std::ios::binary);
+          input_stream.read(&buffer[0], buffer.size());
+          if (!input_stream.good())
+            failed = true;
+        }
+      });
+    }
+    for (auto& thread : threads)
+      thread.join();
+    auto stop_time(std::chrono::high_resolution_clock::now());
+    if (failed)
+      BOOST_THROW_EXCEPTION(MakeError(CommonErrors::filesystem_io_error));
+    PrintOperationsResult(start_time, stop_time, thread_count * operations_per_thread,
+                          std::to_string(thread_count) + " thread(s) opened, read and closed");
+  }
+}
+
+// Several threads read disjoint stripes of one file, so the reads all reach the same open file in
+// the drive.  Where available, O_DIRECT keeps the kernel's page cache from answering them instead.
+void ReadOneFileConcurrently() {
+  on_scope_exit cleanup(clean_root);
+
+  const size_t size(128 * 1024 * 1024), block_size(1024 * 1024);
+  const fs::path file(GenerateFile(g_root, size));
+
+  const unsigned max_thread_count(std::max(2U, static_cast<unsigned>(Concurrency()) * 2));
+  for (unsigned thread_count(1); thread_count <= max_thread_count; thread_count *= 2) {
+    const size_t stripe_size(((size / thread_count) / block_size) * block_size);
+    std::atomic<bool> failed(false);
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count);
+    auto start_time(std::chrono::high_resolution_clock::now());
+    for (unsigned i(0); i != thread_count; ++i) {
+      threads.emplace_back([&, i] {
+        const size_t stripe_begin(i * stripe_size);
+#ifdef O_DIRECT
+        void* buffer(nullptr);
+        if (posix_memalign(&buffer, 4096, block_size) != 0) {
+          failed = true;
+          return;
+        }
+        on_scope_exit free_buffer([buffer] { free(buffer); });
+        const int file_descriptor(open(file.c_str(), O_RDONLY | O_DIRECT));
+        if (file_descriptor == -1) {
+          failed = true;
+          return;
+        }
+        on_scope_exit close_file([file_descriptor] { close(file_descriptor); });
+        for (size_t offset(stripe_begin); offset != stripe_begin + stripe_size;
+             offset += block_size) {
+          if (pread(file_descriptor, buffer, block_size, offset) !=
+              static_cast<ssize_t>(block_size)) {
+            failed = true;
+          }
+        }
+#else
+        std::vector<char> buffer(block_size);
+        std::ifstream input_stream(file.c_str(), std::ios::binary);
+        input_stream.seekg(stripe_begin);
+        for (size_t offset(stripe_begin); offset != stripe_begin + stripe_size;
+             offset += block_size) {
+          input_stream.read(&buffer[0], buffer.size());
+        }
+        if (!input_stream.good())
+          failed = true;
+#endif
+      });
+    }
+    for (auto& thread : threads)
+      thread.join();
+    auto stop_time(std::chrono::high_resolution_clock::now());
+    if (failed)
+      BOOST_THROW_EXCEPTION(MakeError(CommonErrors::filesystem_io_error));
+    PrintResult(start_time, stop_time, stripe_size * thread_count,
+                std::to_string(thread_count) + " thread(s) read one file,");
+  }
+}
+
+// Walks a tree stat'ing every entry, as 'find' or 'ls -lR' would.  The first pass shows the cost of
+// the getattr calls which follow each listing; the second, made while the kernel's caches are
+// still warm, shows what the entry and attribute timeouts save.
+void ListAndStatTree() {
+  on_scope_exit cleanup(clean_root);
+
+  const size_t directory_count(20), files_per_directory(500);
+  for (size_t i(0); i != directory_count; ++i) {
+    const fs::path directory(GenerateDirectory(g_root));
+    for (size_t j(0); j != files_per_directory; ++j)
+      std::ofstream(fs::path(directory / RandomAlphaNumericString(12)).c_str());
+  }
+
+  for (int pass(1); pass <= 2; ++pass) {
+    size_t entry_count(0);
+    uintmax_t total_size(0);
+    auto start_time(std::chrono::high_resolution_clock::now());
+    for (fs::recursive_directory_iterator itr(g_root), end; itr != end; ++itr) {
+      if (fs::is_regular_file(itr->status()))
+        total_size += fs::file_size(itr->path());
+      ++entry_count;
+    }
+    auto stop_time(std::chrono::high_resolution_clock::now());
+    if (entry_count != directory_count * (files_per_directory + 1) || total_size != 0)
+      BOOST_THROW_EXCEPTION(MakeError(CommonErrors::filesystem_io_error));
+    PrintOperationsResult(start_time, stop_time, entry_count,
+                          "Pass " + std::to_string(pass) + " listed and stat'ed");
+  }
+}
+
 void CloneMaidSafeAndBuildDefaults(const fs::path& start_directory) {
   on_scope_exit cleanup(clean_root);
   boost::system::error_code error_code;
@@ -490,14 +736,33 @@ void DownloadAndExtractBoost(const fs::path& start_directory) {
 }
 
 int RunTool(int argc, char** argv, const fs::path& root, const fs::path& temp,
-            const drive::Options& /*options*/, std::shared_ptr<drive::Launcher> /*launcher*/,
+            const drive::Options& /*options*/, std::shared_ptr<drive::Launcher> launcher,
             int /*test_type*/) {
   std::vector<std::string> arguments(argv, argv + argc);
 
   bool no_big_test(std::any_of(std::begin(arguments), std::end(arguments),
                                [](const std::string& arg) { return arg == "--no_big_test"; }));
+  bool no_direct_io_test(std::any_of(std::begin(arguments), std::end(arguments),
+                                     [](const std::string& arg) {
+                                       return arg == "--no_direct_io_test";
+                                     }));
+  bool no_checkpoint_test(
+      std::any_of(std::begin(arguments), std::end(arguments),
+                  [](const std::string& arg) { return arg == "--no_checkpoint_test"; }));
   bool no_small_test(std::any_of(std::begin(arguments), std::end(arguments),
                                  [](const std::string& arg) { return arg == "--no_small_test"; }));
+  bool no_concurrent_operations_test(
+      std::any_of(std::begin(arguments), std::end(arguments), [](const std::string& arg) {
+        return arg == "--no_concurrent_operations_test";
+      }));
+  bool no_concurrent_read_test(
+      std::any_of(std::begin(arguments), std::end(arguments), [](const std::string& arg) {
+        return arg == "--no_concurrent_read_test";
+      }));
+  bool no_list_and_stat_test(
+      std::any_of(std::begin(arguments), std::end(arguments), [](const std::string& arg) {
+        return arg == "--no_list_and_stat_test";
+      }));
   bool no_clone_and_build_maidsafe_test(
       std::any_of(std::begin(arguments), std::end(arguments), [](const std::string& arg) {
         return arg == "--no_clone_and_build_maidsafe_test";
@@ -521,9 +786,33 @@ int RunTool(int argc, char** argv, const fs::path& root, const fs::path& temp,
   if (!no_big_test)
     CopyThenReadLargeFile();
 
+#ifdef O_DIRECT
+  if (!no_direct_io_test)
+    ReadLargeFileCachedAndDirect(launcher);
+#else
+  static_cast<void>(no_direct_io_test);
+  static_cast<void>(launcher);
+#endif
+
+#ifndef MAIDSAFE_WIN32
+  if (!no_checkpoint_test)
+    WriteLargeFileWithSyncs();
+#else
+  static_cast<void>(no_checkpoint_test);
+#endif
+
   if (!no_small_test)
     CopyThenReadManySmallFiles();
 
+  if (!no_concurrent_operations_test)
+    OpenReadAndCloseFilesConcurrently();
+
+  if (!no_concurrent_read_test)
+    ReadOneFileConcurrently();
+
+  if (!no_list_and_stat_test)
+    ListAndStatTree();
+
   if (!no_clone_and_build_maidsafe_test)
     CloneMaidSafeAndBuildDefaults(g_root);
 
@@ -113,6 +113,15 @@ enum SharedMemoryArgIndex {
   kSymmKeyArg,
   kSymmIvArg,
   kParentProcessHandle,
+  kWorkerCountArg,
+  kLowLevelFuseArg,
+  kEntryTimeoutArg,
+  kAttrTimeoutArg,
+  kNegativeTimeoutArg,
+  kDirectIoMinSizeArg,
+  kDirectIoPatternsArg,
+  kChunkCacheSizeArg,
+  kWriteBehindArg,
   kMaxArgIndex
 };
 
@@ -157,6 +166,15 @@ void ReadAndRemoveInitialSharedMemory(const std::string& initial_shared_memory_n
       GetMountStatusSharedMemoryName(initial_shared_memory_name);
   options.parent_handle =
       reinterpret_cast<void*>(std::stoull(shared_memory_args[kParentProcessHandle]));
+  options.worker_count = static_cast<unsigned>(std::stoul(shared_memory_args[kWorkerCountArg]));
+  options.low_level_fuse = (std::stoi(shared_memory_args[kLowLevelFuseArg]) != 0);
+  options.entry_timeout = std::stod(shared_memory_args[kEntryTimeoutArg]);
+  options.attr_timeout = std::stod(shared_memory_args[kAttrTimeoutArg]);
+  options.negative_timeout = std::stod(shared_memory_args[kNegativeTimeoutArg]);
+  options.direct_io_min_size = std::stoull(shared_memory_args[kDirectIoMinSizeArg]);
+  options.direct_io_patterns = shared_memory_args[kDirectIoPatternsArg];
+  options.chunk_cache_size = std::stoull(shared_memory_args[kChunkCacheSizeArg]);
+  options.write_behind = (std::stoi(shared_memory_args[kWriteBehindArg]) != 0);
   ipc::RemoveSharedMemory(initial_shared_memory_name);
 }
 
@@ -208,6 +226,15 @@ void Launcher::CreateInitialSharedMemory(const Options& options) {
   shared_memory_args[kSymmIvArg] = options.symm_iv;
   shared_memory_args[kParentProcessHandle] =
       std::to_string(reinterpret_cast<uintptr_t>(this_process_handle_));
+  shared_memory_args[kWorkerCountArg] = std::to_string(options.worker_count);
+  shared_memory_args[kLowLevelFuseArg] = options.low_level_fuse ? "1" : "0";
+  shared_memory_args[kEntryTimeoutArg] = std::to_string(options.entry_timeout);
+  shared_memory_args[kAttrTimeoutArg] = std::to_string(options.attr_timeout);
+  shared_memory_args[kNegativeTimeoutArg] = std::to_string(options.negative_timeout);
+  shared_memory_args[kDirectIoMinSizeArg] = std::to_string(options.direct_io_min_size);
+  shared_memory_args[kDirectIoPatternsArg] = options.direct_io_patterns;
+  shared_memory_args[kChunkCacheSizeArg] = std::to_string(options.chunk_cache_size);
+  shared_memory_args[kWriteBehindArg] = options.write_behind ? "1" : "0";
   ipc::CreateSharedMemory(initial_shared_memory_name_, shared_memory_args);
 }
 
@@ -82,6 +82,13 @@ enum class TestType {
   kDisk
 } g_test_type;
 bool g_enable_vfs_logging;
+unsigned g_worker_count;
+bool g_low_level_fuse;
+double g_entry_timeout, g_attr_timeout;
+std::uint64_t g_direct_io_min_size;
+std::string g_direct_io_patterns;
+std::uint64_t g_chunk_cache_size;
+bool g_write_behind;
 #ifdef MAIDSAFE_WIN32
 const std::string kHelpInfo(
     "You must pass exactly one of '--disk', '--local', '--local_console', "
@@ -188,6 +195,29 @@ po::options_description CommandLineOptions() {
       "enable_vfs_logging", po::bool_switch(&g_enable_vfs_logging),
       "Enable logging on the VFS (this is only useful if used with '--local' or '--network'.");
 #endif
+  command_line_options.add_options()(
+      "worker_count", po::value<unsigned>(&g_worker_count)->default_value(1),
+      "Number of threads servicing requests on the VFS (ignored with '--disk').")(
+      "low_level_fuse", po::bool_switch(&g_low_level_fuse),
+      "Mount the VFS via the FUSE low-level API (ignored with '--disk' and on Windows).")(
+      "entry_timeout", po::value<double>(&g_entry_timeout)->default_value(1.0),
+      "Seconds the kernel may cache name lookups on the VFS (ignored with '--disk').")(
+      "attr_timeout", po::value<double>(&g_attr_timeout)->default_value(1.0),
+      "Seconds the kernel may cache attributes on the VFS (ignored with '--disk').")(
+      "direct_io_min_size", po::value<std::uint64_t>(&g_direct_io_min_size)->default_value(0),
+      "Open files of at least this many bytes direct_io on the VFS; 0 disables this (ignored "
+      "with '--disk' and on Windows).")(
+      "direct_io_patterns", po::value<std::string>(&g_direct_io_patterns),
+      "Comma-separated filename globs to open direct_io on the VFS (ignored with '--disk' and "
+      "on Windows).")(
+      "chunk_cache_size",
+      po::value<std::uint64_t>(&g_chunk_cache_size)
+          ->default_value(drive::detail::kDefaultChunkCacheSize),
+      "Bytes of chunk contents the VFS caches across all files; 0 disables this (ignored with "
+      "'--disk').")(
+      "write_behind", po::bool_switch(&g_write_behind),
+      "Acknowledge writes to the VFS once queued, and encrypt them in the background (ignored "
+      "with '--disk').");
 
   return command_line_options;
 }
@@ -275,6 +305,14 @@ std::function<void()> PrepareLocalVfs() {
   options.root_parent_id = Identity(RandomString(64));
   options.create_store = true;
   options.drive_type = static_cast<drive::DriveType>(g_test_type);
+  options.worker_count = g_worker_count;
+  options.low_level_fuse = g_low_level_fuse;
+  options.entry_timeout = g_entry_timeout;
+  options.attr_timeout = g_attr_timeout;
+  options.direct_io_min_size = g_direct_io_min_size;
+  options.direct_io_patterns = g_direct_io_patterns;
+  options.chunk_cache_size = g_chunk_cache_size;
+  options.write_behind = g_write_behind;
   if (g_enable_vfs_logging)
     options.drive_logging_args = "--log_* V --log_colour_mode 2 --log_no_async";
 
@@ -324,6 +362,14 @@ std::function<void()> PrepareNetworkVfs() {
   options.symm_iv = symm_iv.string();
   options.create_store = true;
   options.drive_type = static_cast<drive::DriveType>(g_test_type);
+  options.worker_count = g_worker_count;
+  options.low_level_fuse = g_low_level_fuse;
+  options.entry_timeout = g_entry_timeout;
+  options.attr_timeout = g_attr_timeout;
+  options.direct_io_min_size = g_direct_io_min_size;
+  options.direct_io_patterns = g_direct_io_patterns;
+  options.chunk_cache_size = g_chunk_cache_size;
+  options.write_behind = g_write_behind;
   if (g_enable_vfs_logging)
     options.drive_logging_args = "--log_* V --log_colour_mode 2 --log_no_async";
 